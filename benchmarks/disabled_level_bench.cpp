@@ -0,0 +1,58 @@
+// cost of a LOG_* statement whose level is disabled at runtime, per level;
+// sites below EASY_LOGGER_ACTIVE_LEVEL cost the same as the empty loop
+#include <easy_logger/logger.h>
+
+#include <chrono>
+#include <cstdio>
+
+namespace {
+
+constexpr std::size_t iterations = 100'000'000;
+
+template <typename fn_tt>
+double ns_per_call(fn_tt &&fn) {
+  const auto begin = std::chrono::steady_clock::now();
+  for (std::size_t i = 0; i < iterations; ++i)
+    fn(i);
+  const auto end = std::chrono::steady_clock::now();
+  return std::chrono::duration<double, std::nano>(end - begin).count() / iterations;
+}
+
+// keeps the empty loop's counter alive; MSVC has no inline asm, a volatile store stands in for it there
+inline void do_not_optimize(std::size_t value) {
+#if defined(__GNUC__)
+  asm volatile("" : : "r"(value));
+#else
+  static volatile std::size_t sink;
+  sink = value;
+#endif
+}
+
+void report(const char *name, double ns) {
+  std::printf("%-24s %8.3f ns/call\n", name, ns);
+}
+
+}  // namespace
+
+int main() {
+  using util::logger::easy_logger;
+  easy_logger::get().init("disabled_level_bench.log");
+
+  report("empty loop", ns_per_call([](std::size_t i) { do_not_optimize(i); }));
+
+  easy_logger::set_level(spdlog::level::debug);
+  report("LOG_TRACE disabled", ns_per_call([]([[maybe_unused]] std::size_t i) { LOG_TRACE("trace {}", i); }));
+  easy_logger::set_level(spdlog::level::info);
+  report("LOG_DEBUG disabled", ns_per_call([]([[maybe_unused]] std::size_t i) { LOG_DEBUG("debug {}", i); }));
+  easy_logger::set_level(spdlog::level::warn);
+  report("LOG_INFO disabled", ns_per_call([]([[maybe_unused]] std::size_t i) { LOG_INFO("info {}", i); }));
+  easy_logger::set_level(spdlog::level::err);
+  report("LOG_WARN disabled", ns_per_call([]([[maybe_unused]] std::size_t i) { LOG_WARN("warn {}", i); }));
+  easy_logger::set_level(spdlog::level::critical);
+  report("LOG_ERROR disabled", ns_per_call([]([[maybe_unused]] std::size_t i) { LOG_ERROR("error {}", i); }));
+  easy_logger::set_level(spdlog::level::off);
+  report("LOG_CRIT disabled", ns_per_call([]([[maybe_unused]] std::size_t i) { LOG_CRIT("crit {}", i); }));
+
+  easy_logger::shutdown();
+  return 0;
+}
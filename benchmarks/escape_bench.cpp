@@ -0,0 +1,79 @@
+// sanitize.h's SIMD kernels against the scalar scan on payloads like the ones we log: a JSON request body
+// (many quotes), a SQL statement (clean), a Chinese message (non-ASCII) and a multi-line stack trace
+#include <easy_logger/sanitize.h>
+
+#include <chrono>
+#include <cstdio>
+#include <string>
+#include <string_view>
+
+namespace {
+
+constexpr std::size_t bytes_per_case = 256ull * 1024 * 1024;
+
+template <typename fn_tt>
+double mb_per_second(std::string_view payload, fn_tt &&fn) {
+  const std::size_t rounds = bytes_per_case / payload.size();
+  spdlog::memory_buf_t out;
+  const auto begin = std::chrono::steady_clock::now();
+  for (std::size_t i = 0; i < rounds; ++i) {
+    out.clear();
+    fn(out, payload);
+  }
+  const auto end = std::chrono::steady_clock::now();
+  return static_cast<double>(rounds * payload.size()) / 1e6 / std::chrono::duration<double>(end - begin).count();
+}
+
+std::string repeat(std::string_view piece, std::size_t size) {
+  std::string text;
+  while (text.size() < size)
+    text += piece;
+  return text;
+}
+
+template <typename scan_tt>
+void run(const char *scan, const char *name, std::string_view payload) {
+  namespace sanitize = util::logger::sanitize;
+  const double json = mb_per_second(payload, [](auto &out, auto text) { sanitize::escape_json<scan_tt>(out, text); });
+  const double console =
+    mb_per_second(payload, [](auto &out, auto text) { sanitize::escape_console<scan_tt>(out, text); });
+  std::printf("%-8s %-12s json %9.1f MB/s  console %9.1f MB/s\n", scan, name, json, console);
+}
+
+// a logfmt value is scanned to its end only when it needs no quotes
+template <typename scan_tt>
+void run_logfmt(const char *scan, std::string_view token) {
+  namespace sanitize = util::logger::sanitize;
+  const double quoting = mb_per_second(token, [](auto &out, auto text) {
+    out.push_back(sanitize::needs_quoting<scan_tt>(text) ? '"' : ' ');
+  });
+  std::printf("%-8s %-12s logfmt check %9.1f MB/s\n", scan, "url token", quoting);
+}
+
+}  // namespace
+
+int main() {
+  namespace sanitize = util::logger::sanitize;
+  const std::string body = repeat(
+    R"({"order_id":1234567,"customer":{"name":"Alice Example","email":"alice@example.com"},"items":[{"sku":"A-1","qty":2}]},)",
+    4096);
+  const std::string sql = repeat(
+    "SELECT o.id, o.total, c.name FROM orders o JOIN customers c ON c.id = o.customer_id WHERE o.created_at > "
+    "'2024-07-15 00:00:00' AND o.status IN ('paid', 'shipped') ORDER BY o.created_at DESC LIMIT 100; ",
+    4096);
+  const std::string chinese = repeat("用户登录失败，密码错误次数超过限制，账号已被锁定 30 分钟。", 4096);
+  const std::string token = repeat("https://example.com/api/v1/orders/1234567/items/", 4096);
+  const std::string trace = repeat("    at net::server::accept(int) (src/net/server.cpp:128)\n", 4096);
+
+  const struct {
+    const char *name;
+    std::string_view payload;
+  } cases[] = {{"json body", body}, {"sql", sql}, {"chinese", chinese}, {"stack trace", trace}};
+  for (const auto &c : cases) {
+    run<sanitize::scalar_scan>("scalar", c.name, c.payload);
+    run<sanitize::native_scan>("native", c.name, c.payload);
+  }
+  run_logfmt<sanitize::scalar_scan>("scalar", token);
+  run_logfmt<sanitize::native_scan>("native", token);
+  return 0;
+}
@@ -0,0 +1,254 @@
+// per-call latency and throughput of every macro family (LOG_*, PRINT_*, STM_*) for each combination of
+// logger mode (sync / async / deferred), sink (file / null), level (enabled / disabled) and thread count;
+// latencies are measured on the calling thread in cycles (TSC / cntvct, steady_clock ns elsewhere)
+//
+// usage: easy_logger_bench [--threads 1,2,4] [--iterations N] [--json path] [--filter text]
+#include <easy_logger/logger.h>
+#include <spdlog/sinks/basic_file_sink.h>
+#include <spdlog/sinks/null_sink.h>
+
+#include <algorithm>
+#include <chrono>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <fstream>
+#include <latch>
+#include <string>
+#include <string_view>
+#include <thread>
+#include <vector>
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <x86intrin.h>
+#elif defined(_M_X64) || defined(_M_IX86) || defined(_M_ARM64)
+#include <intrin.h>
+#endif
+
+namespace {
+
+using util::logger::easy_logger;
+
+#if defined(__x86_64__) || defined(__i386__) || defined(_M_X64) || defined(_M_IX86)
+constexpr const char *cycle_unit = "cycles";
+inline std::uint64_t read_cycles() {
+  return __rdtsc();
+}
+#elif defined(__aarch64__) && defined(__GNUC__)
+constexpr const char *cycle_unit = "cycles";
+inline std::uint64_t read_cycles() {
+  std::uint64_t value;
+  asm volatile("mrs %0, cntvct_el0" : "=r"(value));
+  return value;
+}
+#elif defined(_M_ARM64)
+// MSVC has no inline asm on ARM64, the intrinsic reads the same register
+constexpr const char *cycle_unit = "cycles";
+inline std::uint64_t read_cycles() {
+  return static_cast<std::uint64_t>(_ReadStatusReg(ARM64_CNTVCT));
+}
+#else
+constexpr const char *cycle_unit = "ns";
+inline std::uint64_t read_cycles() {
+  return std::chrono::steady_clock::now().time_since_epoch().count();
+}
+#endif
+
+enum class family { log, print, stm };
+enum class mode { sync, async, deferred };
+enum class sink { file, null };
+
+constexpr const char *names[][3] = {
+  {"LOG", "PRINT", "STM"},
+  {"sync", "async", "deferred"},
+  {"file", "null"},
+};
+
+struct config {
+  family front;
+  mode logger;
+  sink target;
+  bool enabled;
+  std::size_t threads;
+};
+
+struct result {
+  config setup;
+  std::size_t calls = 0;
+  double seconds = 0;
+  std::uint64_t p50 = 0, p99 = 0, p999 = 0, max = 0;
+
+  double throughput() const {
+    return seconds > 0 ? calls / seconds : 0;
+  }
+};
+
+std::string describe(const config &setup) {
+  return std::string(names[0][static_cast<int>(setup.front)]) + '/' + names[1][static_cast<int>(setup.logger)] + '/' +
+         names[2][static_cast<int>(setup.target)] + '/' + (setup.enabled ? "enabled" : "disabled") + '/' +
+         std::to_string(setup.threads) + 't';
+}
+
+// the same formatter easy_logger::init() installs, so the file sink does the real formatting work
+void install_logger(const config &setup) {
+  spdlog::sink_ptr target;
+  if (setup.target == sink::file)
+    target = std::make_shared<spdlog::sinks::basic_file_sink_mt>("easy_logger_bench.log", true);
+  else
+    target = std::make_shared<spdlog::sinks::null_sink_mt>();
+
+  if (setup.logger == mode::async) {
+    util::logger::easy_logger_static::init({});
+    spdlog::set_default_logger(
+      std::make_shared<spdlog::async_logger>("", target, spdlog::thread_pool(), spdlog::async_overflow_policy::block));
+  } else {
+    spdlog::set_default_logger(std::make_shared<spdlog::logger>("", target));
+  }
+  spdlog::set_formatter(std::make_unique<util::logger::default_formatter>());
+  easy_logger::set_level(setup.enabled ? spdlog::level::info : spdlog::level::warn);
+
+  if (setup.logger == mode::deferred)
+    util::logger::deferred::backend::get().start(spdlog::default_logger(), {}, true);
+}
+
+// drains whatever the backends still hold so the next run starts idle
+void remove_logger() {
+  util::logger::deferred::backend::get().stop();
+  spdlog::shutdown();
+}
+
+template <typename fn_tt>
+void timed_loop(std::vector<std::uint64_t> &samples, fn_tt &&fn) {
+  for (std::size_t i = 0; i < samples.size(); ++i) {
+    const auto begin = read_cycles();
+    fn(i);
+    samples[i] = read_cycles() - begin;
+  }
+}
+
+void call_loop(family front, std::vector<std::uint64_t> &samples) {
+  const std::string name = "player";
+  switch (front) {
+    case family::log:
+      timed_loop(samples, [&](std::size_t i) { LOG_INFO("bench {} {} {}", i, 3.25 * i, name); });
+      break;
+    case family::print:
+      timed_loop(samples, [&](std::size_t i) { PRINT_INFO("bench %zu %f %s", i, 3.25 * i, name.c_str()); });
+      break;
+    case family::stm:
+      timed_loop(samples, [&](std::size_t i) { STM_INFO("bench", i, 3.25 * i, name); });
+      break;
+  }
+}
+
+result run(const config &setup, std::size_t iterations) {
+  install_logger(setup);
+
+  using clock = std::chrono::steady_clock;
+  std::vector<std::vector<std::uint64_t>> samples(setup.threads, std::vector<std::uint64_t>(iterations));
+  std::vector<std::pair<clock::time_point, clock::time_point>> spans(setup.threads);
+  std::latch ready(static_cast<std::ptrdiff_t>(setup.threads));
+  std::vector<std::thread> threads;
+  for (std::size_t t = 0; t < setup.threads; ++t) {
+    threads.emplace_back([&, t] {
+      ready.arrive_and_wait();
+      spans[t].first = clock::now();
+      call_loop(setup.front, samples[t]);
+      spans[t].second = clock::now();
+    });
+  }
+  for (auto &thread : threads)
+    thread.join();
+  const auto begin = std::min_element(spans.begin(), spans.end())->first;
+  const auto end =
+    std::max_element(spans.begin(), spans.end(), [](auto &a, auto &b) { return a.second < b.second; })->second;
+
+  remove_logger();
+
+  std::vector<std::uint64_t> all;
+  all.reserve(setup.threads * iterations);
+  for (auto &thread_samples : samples)
+    all.insert(all.end(), thread_samples.begin(), thread_samples.end());
+  std::sort(all.begin(), all.end());
+
+  const auto percentile = [&](double p) {
+    return all[std::min(all.size() - 1, static_cast<std::size_t>(p * all.size()))];
+  };
+  result out{setup, all.size(), std::chrono::duration<double>(end - begin).count()};
+  out.p50 = percentile(0.50);
+  out.p99 = percentile(0.99);
+  out.p999 = percentile(0.999);
+  out.max = all.back();
+  return out;
+}
+
+std::vector<std::size_t> parse_list(std::string_view text) {
+  std::vector<std::size_t> values;
+  while (!text.empty()) {
+    const auto comma = text.find(',');
+    values.push_back(std::strtoull(std::string(text.substr(0, comma)).c_str(), nullptr, 10));
+    text = comma == std::string_view::npos ? std::string_view{} : text.substr(comma + 1);
+  }
+  std::erase(values, 0);
+  return values;
+}
+
+void write_json(const std::string &path, const std::vector<result> &results) {
+  std::ofstream out(path);
+  out << "{\n  \"unit\": \"" << cycle_unit << "\",\n  \"results\": [\n";
+  for (std::size_t i = 0; i < results.size(); ++i) {
+    const auto &r = results[i];
+    out << "    {\"name\": \"" << describe(r.setup) << "\", \"family\": \"" << names[0][static_cast<int>(r.setup.front)]
+        << "\", \"mode\": \"" << names[1][static_cast<int>(r.setup.logger)] << "\", \"sink\": \""
+        << names[2][static_cast<int>(r.setup.target)] << "\", \"enabled\": " << (r.setup.enabled ? "true" : "false")
+        << ", \"threads\": " << r.setup.threads << ", \"calls\": " << r.calls << ", \"seconds\": " << r.seconds
+        << ", \"throughput\": " << static_cast<std::uint64_t>(r.throughput()) << ", \"p50\": " << r.p50
+        << ", \"p99\": " << r.p99 << ", \"p999\": " << r.p999 << ", \"max\": " << r.max << '}'
+        << (i + 1 < results.size() ? ",\n" : "\n");
+  }
+  out << "  ]\n}\n";
+}
+
+}  // namespace
+
+int main(int argc, char **argv) {
+  std::vector<std::size_t> thread_counts{1, 2, 4};
+  std::size_t iterations = 100'000;
+  std::string json_path;
+  std::string filter;
+  for (int i = 1; i + 1 < argc; i += 2) {
+    const std::string_view arg = argv[i];
+    if (arg == "--threads")
+      thread_counts = parse_list(argv[i + 1]);
+    else if (arg == "--iterations")
+      iterations = std::max<std::size_t>(std::strtoull(argv[i + 1], nullptr, 10), 1);
+    else if (arg == "--json")
+      json_path = argv[i + 1];
+    else if (arg == "--filter")
+      filter = argv[i + 1];
+  }
+
+  std::printf("%-36s %14s %10s %10s %10s %12s  (%s)\n", "name", "calls/s", "p50", "p99", "p99.9", "max", cycle_unit);
+  std::vector<result> results;
+  for (auto front : {family::log, family::print, family::stm}) {
+    for (auto logger : {mode::sync, mode::async, mode::deferred}) {
+      for (auto target : {sink::file, sink::null}) {
+        for (bool enabled : {true, false}) {
+          for (auto threads : thread_counts) {
+            const config setup{front, logger, target, enabled, threads};
+            if (!filter.empty() && describe(setup).find(filter) == std::string::npos)
+              continue;
+            const auto &r = results.emplace_back(run(setup, iterations));
+            std::printf("%-36s %14.0f %10llu %10llu %10llu %12llu\n", describe(setup).c_str(), r.throughput(),
+              static_cast<unsigned long long>(r.p50), static_cast<unsigned long long>(r.p99),
+              static_cast<unsigned long long>(r.p999), static_cast<unsigned long long>(r.max));
+          }
+        }
+      }
+    }
+  }
+
+  if (!json_path.empty())
+    write_json(json_path, results);
+  return 0;
+}
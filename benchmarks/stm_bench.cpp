@@ -0,0 +1,54 @@
+// STM_* against the previous stm(), which built "{} {} ..." placeholders, ran std::format into a
+// std::string and handed that to spdlog; both log to a null sink so only the caller's cost is measured
+#include <easy_logger/logger.h>
+#include <spdlog/sinks/null_sink.h>
+
+#include <chrono>
+#include <cstdio>
+#include <string>
+
+namespace {
+
+constexpr std::size_t iterations = 2'000'000;
+
+template <typename fn_tt>
+double ns_per_call(fn_tt &&fn) {
+  const auto begin = std::chrono::steady_clock::now();
+  for (std::size_t i = 0; i < iterations; ++i)
+    fn(i);
+  const auto end = std::chrono::steady_clock::now();
+  return std::chrono::duration<double, std::nano>(end - begin).count() / iterations;
+}
+
+void report(const char *name, double ns) {
+  std::printf("%-24s %8.3f ns/call\n", name, ns);
+}
+
+template <typename... args_tt>
+void stm_std_format(const spdlog::source_loc &loc, spdlog::level::level_enum lvl, args_tt &&...args) {
+  using util::logger::easy_logger;
+  spdlog::log(loc, lvl,
+    std::format(easy_logger::format_string_placeholders<sizeof...(args)>::sv, std::forward<args_tt>(args)...));
+}
+
+}  // namespace
+
+int main() {
+  using util::logger::easy_logger;
+  spdlog::set_default_logger(std::make_shared<spdlog::logger>("", std::make_shared<spdlog::sinks::null_sink_mt>()));
+  easy_logger::set_level(spdlog::level::trace);
+
+  const std::string name = "player";
+  const spdlog::source_loc loc{__FILE__, __LINE__, "main"};
+
+  report("std::format ints", ns_per_call([&](std::size_t i) { stm_std_format(loc, spdlog::level::info, "id", i, -7, 42u); }));
+  report("STM_INFO ints", ns_per_call([&](std::size_t i) { STM_INFO("id", i, -7, 42u); }));
+
+  report("std::format mixed", ns_per_call([&](std::size_t i) {
+    stm_std_format(loc, spdlog::level::info, name, i, 1.5 * i, 'c', true);
+  }));
+  report("STM_INFO mixed", ns_per_call([&](std::size_t i) { STM_INFO(name, i, 1.5 * i, 'c', true); }));
+
+  easy_logger::shutdown();
+  return 0;
+}
@@ -0,0 +1,288 @@
+//
+//  arg_codec.h
+//  inlay
+//
+//  raw argument capture for the deferred logging path
+//
+
+#pragma once
+
+#include <spdlog/common.h>
+
+#include <array>
+#include <bit>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <format>
+#include <iterator>
+#include <new>
+#include <string>
+#include <string_view>
+#include <tuple>
+#include <type_traits>
+
+#include "auto_format_rules.h"
+#include "compiled_format.h"
+#include "site.h"
+
+namespace util::logger {
+
+// opt-in for trivially copyable user types whose std::formatter only reads the object itself,
+// such values are copied into the record and formatted on the backend thread
+template <typename tt>
+struct is_deferred_copyable : std::false_type {};
+
+// opt-in for user types that own memory (strings, containers) whose std::formatter only reads the object
+// itself: the object is built inside the record, moved from an rvalue argument or copied from an lvalue,
+// formatted on the backend thread and destroyed there; pass std::move(value) to skip the copy
+template <typename tt>
+struct is_deferred_movable : std::false_type {};
+
+namespace codec {
+
+template <typename tt>
+concept string_like = std::is_same_v<tt, const char *> || std::is_same_v<tt, char *> ||
+                      std::is_same_v<tt, std::string> || std::is_same_v<tt, std::string_view>;
+
+template <typename tt>
+concept raw_copyable =
+  !string_like<tt> && (std::is_arithmetic_v<tt> || std::is_same_v<tt, const void *> || std::is_same_v<tt, void *> ||
+                        std::is_same_v<tt, std::nullptr_t> ||
+                        (std::is_trivially_copyable_v<tt> && is_deferred_copyable<tt>::value));
+
+// records start 8-byte aligned, so does every object placed in one
+constexpr std::size_t object_align = 8;
+
+template <typename tt>
+concept raw_movable = !string_like<tt> && !raw_copyable<tt> && is_deferred_movable<tt>::value &&
+                      std::is_nothrow_move_constructible_v<tt> && alignof(tt) <= object_align;
+
+template <typename tt>
+concept deferrable = string_like<tt> || raw_copyable<tt> || raw_movable<tt>;
+
+// every argument can be captured without formatting on the caller's thread,
+// otherwise the whole message is formatted eagerly and shipped as text
+template <typename... args_tt>
+inline constexpr bool deferrable_v = (deferrable<std::decay_t<args_tt>> && ...);
+
+// what an argument looks like inside a record: strings become length + bytes, nullptr a null const void*
+// (the bytes of a nullptr_t are unspecified), raw_movable types the object itself, the rest is copied as is
+template <typename tt>
+using wire_t = std::conditional_t<string_like<std::decay_t<tt>>, std::string_view,
+  std::conditional_t<std::is_null_pointer_v<std::decay_t<tt>>, const void *, std::decay_t<tt>>>;
+
+// a raw_movable argument on its way into a record: ref_tt is tt&& for an rvalue, tt for the copy of an lvalue,
+// taken before the record is reserved so a throwing copy leaves nothing half built
+template <typename ref_tt>
+struct object_arg {
+  using type = std::remove_reference_t<ref_tt>;
+  ref_tt value;
+};
+
+template <typename tt>
+inline constexpr bool is_object_arg_v = false;
+
+template <typename ref_tt>
+inline constexpr bool is_object_arg_v<object_arg<ref_tt>> = true;
+
+template <typename tt>
+constexpr auto to_wire(tt &&value) {
+  using value_t = std::remove_cvref_t<tt>;
+  if constexpr (std::is_array_v<value_t>) {
+    return std::string_view{value};
+  } else if constexpr (std::is_same_v<value_t, const char *> || std::is_same_v<value_t, char *>) {
+    return value != nullptr ? std::string_view{value} : std::string_view{};
+  } else if constexpr (raw_movable<value_t>) {
+    if constexpr (std::is_rvalue_reference_v<tt &&> && !std::is_const_v<std::remove_reference_t<tt>>)
+      return object_arg<value_t &&>{std::move(value)};
+    else
+      return object_arg<value_t>{value};
+  } else {
+    return wire_t<value_t>(value);
+  }
+}
+
+constexpr std::size_t align_object(std::size_t offset, std::size_t align) {
+  return (offset + align - 1) & ~(align - 1);
+}
+
+template <typename byte_tt>
+byte_tt *align_object(byte_tt *at, std::size_t align) {
+  const auto address = reinterpret_cast<std::uintptr_t>(at);
+  return at + (align_object(address, align) - address);
+}
+
+// where the argument placed at offset ends, objects are aligned first
+template <typename wire_tt>
+constexpr std::size_t wire_end(std::size_t offset, const wire_tt &value) {
+  if constexpr (is_object_arg_v<wire_tt>) {
+    using object_t = typename wire_tt::type;
+    return align_object(offset, alignof(object_t)) + sizeof(object_t);
+  } else if constexpr (std::is_same_v<wire_tt, std::string_view>) {
+    return offset + sizeof(std::uint32_t) + value.size();
+  } else {
+    return offset + sizeof(wire_tt);
+  }
+}
+
+template <typename wire_tt>
+std::byte *write(std::byte *out, wire_tt &&value) {
+  using value_t = std::remove_cvref_t<wire_tt>;
+  if constexpr (is_object_arg_v<value_t>) {
+    using object_t = typename value_t::type;
+    out = align_object(out, alignof(object_t));
+    ::new (static_cast<void *>(out)) object_t(std::move(value.value));
+    return out + sizeof(object_t);
+  } else if constexpr (std::is_same_v<value_t, std::string_view>) {
+    const auto size = static_cast<std::uint32_t>(value.size());
+    std::memcpy(out, &size, sizeof(size));
+    std::memcpy(out + sizeof(size), value.data(), value.size());
+    return out + sizeof(size) + value.size();
+  } else {
+    std::memcpy(out, &value, sizeof(value_t));
+    return out + sizeof(value_t);
+  }
+}
+
+// objects are read in place, the rest by value
+template <typename wire_tt>
+decltype(auto) read(const std::byte *&in) {
+  if constexpr (raw_movable<wire_tt>) {
+    in = align_object(in, alignof(wire_tt));
+    const auto *object = std::launder(reinterpret_cast<const wire_tt *>(in));
+    in += sizeof(wire_tt);
+    return static_cast<const wire_tt &>(*object);
+  } else if constexpr (std::is_same_v<wire_tt, std::string_view>) {
+    std::uint32_t size;
+    std::memcpy(&size, in, sizeof(size));
+    std::string_view value{reinterpret_cast<const char *>(in + sizeof(size)), size};
+    in += sizeof(size) + size;
+    return value;
+  } else {
+    wire_tt value;
+    std::memcpy(&value, in, sizeof(wire_tt));
+    in += sizeof(wire_tt);
+    return value;
+  }
+}
+
+template <typename wire_tt>
+using read_t = decltype(read<wire_tt>(std::declval<const std::byte *&>()));
+
+template <typename... wire_tt>
+constexpr std::size_t encoded_size(const wire_tt &...values) {
+  std::size_t size = 0;
+  ((size = wire_end(size, values)), ...);
+  return size;
+}
+
+// out is 8-byte aligned when an object is among the values
+template <typename... wire_tt>
+void encode([[maybe_unused]] std::byte *out, wire_tt &&...values) {
+  ((out = write(out, std::forward<wire_tt>(values))), ...);
+}
+
+// destroys the objects of a record once the backend is done with it
+template <typename... wire_tt>
+void release_args([[maybe_unused]] const std::byte *in) {
+  const auto destroy = []<typename read_tt>(read_tt &&value) {
+    using value_t = std::remove_cvref_t<read_tt>;
+    if constexpr (raw_movable<value_t>)
+      const_cast<value_t &>(value).~value_t();
+  };
+  (destroy(read<wire_tt>(in)), ...);
+}
+
+// backend side: rebuild the arguments from a record and format them with the pre-parsed format string
+template <typename... wire_tt>
+void format_to(const format_view &format, std::string_view fmt, [[maybe_unused]] const std::byte *in,
+  spdlog::memory_buf_t &dest) {
+  // braced init keeps the reads in argument order
+  std::tuple<read_t<wire_tt>...> values{read<wire_tt>(in)...};
+  std::apply([&](const auto &...value) { format_compiled(format, fmt, dest, value...); }, values);
+}
+
+// one character per argument type, sized so a record can be decoded from the signature alone
+template <typename tt>
+consteval char type_code() {
+  using value_t = std::decay_t<tt>;
+  if constexpr (string_like<value_t>)
+    return 's';
+  else if constexpr (std::is_same_v<value_t, bool>)
+    return 'b';
+  else if constexpr (std::is_same_v<value_t, char>)
+    return 'c';
+  else if constexpr (std::is_integral_v<value_t>)
+    return "ahilAHIL"[(std::is_signed_v<value_t> ? 0 : 4) + std::bit_width(sizeof(value_t)) - 1];
+  else if constexpr (std::is_same_v<value_t, float>)
+    return 'f';
+  else if constexpr (std::is_same_v<value_t, double>)
+    return 'd';
+  else if constexpr (std::is_floating_point_v<value_t>)
+    return 'e';
+  else if constexpr (std::is_pointer_v<value_t> || std::is_null_pointer_v<value_t>)
+    return 'p';
+  else
+    return 'x';  // opted-in user type, copied or moved in, only its formatter knows the layout
+}
+
+// layout of a record's arguments, a single string when the message was formatted eagerly
+template <typename... args_tt>
+struct signature {
+  static constexpr auto arr = [] {
+    if constexpr (deferrable_v<args_tt...>)
+      return std::array<char, sizeof...(args_tt) + 1>{type_code<args_tt>()..., '\0'};
+    else
+      return std::array<char, 2>{'s', '\0'};
+  }();
+  static constexpr std::string_view sv{arr.data(), arr.size() - 1};
+};
+
+// text already formatted on the caller's thread
+inline void format_text(const log_site &, const std::byte *args, spdlog::memory_buf_t &dest) {
+  const auto text = read<std::string_view>(args);
+  dest.append(text.data(), text.data() + text.size());
+}
+
+template <typename... wire_tt>
+void format_args(const log_site &site, const std::byte *args, spdlog::memory_buf_t &dest) {
+  format_to<wire_tt...>(site.compiled, site.fmt, args, dest);
+}
+
+// STM_* records, every argument is one field written by auto_format_rules
+template <typename... wire_tt>
+void format_fields(const log_site &, [[maybe_unused]] const std::byte *args, spdlog::memory_buf_t &dest) {
+  std::tuple<read_t<wire_tt>...> values{read<wire_tt>(args)...};
+  std::apply([&](const auto &...value) { auto_format_rules::detail::write_args(dest, value...); }, values);
+}
+
+// how the backend rebuilds a LOG_* record of these argument types
+template <typename... args_tt>
+constexpr format_fn formatter_for() {
+  if constexpr (!deferrable_v<args_tt...>)
+    return &format_text;
+  else
+    return &format_args<wire_t<args_tt>...>;
+}
+
+// same for STM_* records
+template <typename... args_tt>
+constexpr format_fn fields_formatter_for() {
+  if constexpr (!deferrable_v<args_tt...>)
+    return &format_text;
+  else
+    return &format_fields<wire_t<args_tt>...>;
+}
+
+// what the backend calls after a record of these argument types, null when it holds no objects
+template <typename... args_tt>
+constexpr release_fn release_for() {
+  if constexpr (!deferrable_v<args_tt...> || !(raw_movable<std::decay_t<args_tt>> || ...))
+    return nullptr;
+  else
+    return &release_args<wire_t<args_tt>...>;
+}
+
+}  // namespace codec
+}  // namespace util::logger
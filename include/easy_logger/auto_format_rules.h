@@ -1,9 +1,17 @@
 #pragma once
 #include <algorithm>
 #include <array>
+#include <charconv>
 #include <cstddef>
+#include <format>
+#include <iterator>
 #include <string>
+#include <string_view>
+#include <tuple>
 #include <type_traits>
+#include <utility>
+
+#include "compiled_format.h"
 
 #ifndef AUTO_FORMAT_LOGGER_MAX_ARGS
 #define AUTO_FORMAT_LOGGER_MAX_ARGS 20
@@ -27,6 +35,11 @@ struct type_format<double> {
   static constexpr const char* value = "{:.2f}";
 };
 
+template <>
+struct type_format<long double> {
+  static constexpr const char* value = "{:.2f}";
+};
+
 template <typename tt>
 concept is_tuple_like = requires { typename std::tuple_size<tt>::type; };
 
@@ -108,6 +121,75 @@ struct type_format_string_placeholders {
   static constexpr auto sv = std::string_view{fmt.first.data(), fmt.second};
 };
 
+// writers picked per type at compile time, the same rules as the format strings above without parsing one
+
+template <typename tt>
+constexpr bool has_custom_format = std::string_view(type_format<tt>::value) != "{}";
+
+// N of a "{:.Nf}" type_format, written with to_chars; -1 for any other spec, which goes through std::format
+template <typename tt>
+consteval int fixed_precision() {
+  constexpr std::string_view spec = type_format<tt>::value;
+  if (spec.size() < 6 || !spec.starts_with("{:.") || !spec.ends_with("f}"))
+    return -1;
+  int precision = 0;
+  for (const char c : spec.substr(3, spec.size() - 5)) {
+    if (c < '0' || c > '9')
+      return -1;
+    precision = precision * 10 + (c - '0');
+  }
+  return precision;
+}
+
+template <typename tt>
+void write_fixed(tt value, int precision, spdlog::memory_buf_t& dest) {
+  char buf[128];
+  const auto result = std::to_chars(buf, buf + sizeof(buf), value, std::chars_format::fixed, precision);
+  if (result.ec == std::errc{})
+    dest.append(buf, result.ptr);
+  else  // too many digits for the stack buffer
+    std::vformat_to(std::back_inserter(dest), "{:.{}f}", std::make_format_args(value, precision));
+}
+
+template <typename tt>
+void write_arg(const tt& value, spdlog::memory_buf_t& dest) {
+  using value_t = std::decay_t<tt>;
+  if constexpr (std::is_floating_point_v<value_t> && fixed_precision<value_t>() >= 0) {
+    write_fixed(value, fixed_precision<value_t>(), dest);
+  } else if constexpr (!std::is_array_v<tt> && (std::is_same_v<value_t, const char*> || std::is_same_v<value_t, char*>)) {
+    if (value != nullptr)
+      util::logger::append(dest, value);
+  } else if constexpr (has_custom_format<value_t>) {
+    std::vformat_to(std::back_inserter(dest), type_format<value_t>::value, std::make_format_args(value));
+  } else {
+    util::logger::write_value(value, dest);  // to_chars for integers, memcpy for strings
+  }
+}
+
+// tuple-likes are flattened, every leaf value is one separated field
+template <char sep_vv, typename tt>
+void write_flat(const tt& value, spdlog::memory_buf_t& dest, bool& first) {
+  using value_t = std::decay_t<tt>;
+  if constexpr (is_tuple_like<value_t>) {
+    [&]<std::size_t... index_vv>(std::index_sequence<index_vv...>) {
+      using std::get;
+      (write_flat<sep_vv>(get<index_vv>(value), dest, first), ...);
+    }(std::make_index_sequence<std::tuple_size_v<value_t>>{});
+  } else {
+    if (!first)
+      dest.push_back(sep_vv);
+    first = false;
+    write_arg(value, dest);
+  }
+}
+
+// same text as std::vformat(type_format_string_placeholders<args_tt...>::sv, args...), in one pass
+template <char sep_vv = ' ', typename... args_tt>
+void write_args(spdlog::memory_buf_t& dest, const args_tt&... args) {
+  [[maybe_unused]] bool first = true;
+  (write_flat<sep_vv>(args, dest, first), ...);
+}
+
 }  // namespace detail
 }  // namespace auto_format_rules
 
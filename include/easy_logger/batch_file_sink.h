@@ -0,0 +1,428 @@
+//
+//  batch_file_sink.h
+//  inlay
+//
+//  daily file sink that gathers formatted records in page aligned chunks and writes a whole batch
+//  with one writev (or io_uring) call, committing on size, count or age thresholds
+//
+
+#pragma once
+
+#include <spdlog/details/null_mutex.h>
+#include <spdlog/details/os.h>
+#include <spdlog/sinks/base_sink.h>
+
+#include <algorithm>
+#include <chrono>
+#include <condition_variable>
+#include <cstddef>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <exception>
+#include <memory>
+#include <mutex>
+#include <new>
+#include <thread>
+#include <type_traits>
+#include <vector>
+
+#ifdef _WIN32
+#include <io.h>
+#else
+#include <fcntl.h>
+#include <sys/uio.h>
+#include <unistd.h>
+
+#include <cerrno>
+#include <climits>
+#endif
+
+// io_uring is opt-in, it needs liburing and a kernel that allows it; writev is used otherwise
+#if defined(EASY_LOGGER_USE_IO_URING) && !defined(_WIN32) && __has_include(<liburing.h>)
+#include <liburing.h>
+#define EASY_LOGGER_HAS_IO_URING 1
+#else
+#define EASY_LOGGER_HAS_IO_URING 0
+#endif
+
+#include "daily_rotation.h"
+
+namespace util::logger {
+
+struct batch_options {
+  std::size_t max_bytes = 1024ull * 1024;    // commit once this much is pending
+  std::size_t max_records = 8192;            // or this many records
+  std::chrono::milliseconds max_delay{200};  // or the oldest pending record is this old, see batch_file_sink
+  std::size_t chunk_size = 1024ull * 64;     // records are copied into page aligned chunks of this size
+  bool sync = false;                         // fdatasync committed data on flush, at most once per max_delay
+  daily_rotation rotation;                   // rotation time, 00:02 as with init()'s daily_file_sink
+};
+
+// sizes and durations of the commits so far, a commit writes one batch
+struct batch_stats {
+  std::uint64_t commits = 0;
+  std::uint64_t records = 0;
+  std::uint64_t bytes = 0;
+  std::uint64_t syncs = 0;
+  std::size_t last_batch_records = 0;
+  std::size_t last_batch_bytes = 0;
+  std::size_t max_batch_bytes = 0;
+  std::chrono::nanoseconds last_commit{0};  // time spent writing (or submitting and reaping) one batch
+  std::chrono::nanoseconds max_commit{0};
+  std::chrono::nanoseconds total_commit{0};
+};
+
+// a batch is committed by the record that crosses max_bytes or max_records, and by a timer thread once its
+// oldest record is max_delay old; batch_file_sink_st has no timer, its records and flushes check the age
+template <typename mutex_tt>
+class batch_file_sink final : public spdlog::sinks::base_sink<mutex_tt> {
+ public:
+  static constexpr std::size_t page_size = 4096;
+
+ private:
+  using clock = std::chrono::steady_clock;
+
+  struct chunk_deleter {
+    void operator()(std::byte *data) const {
+      ::operator delete[](data, std::align_val_t{page_size});
+    }
+  };
+
+  struct chunk {
+    std::unique_ptr<std::byte[], chunk_deleter> data;
+    std::size_t used = 0;
+  };
+
+  spdlog::filename_t _base_filename;
+  spdlog::filename_t _filename;
+  batch_options _options;
+  spdlog::log_clock::time_point _rotation_tp;
+
+  // records are appended to _filling, a commit swaps it with _writing; with io_uring the kernel
+  // writes one set while the next batch fills the other
+  std::vector<chunk> _filling;
+  std::vector<chunk> _writing;
+  std::size_t _current = 0;  // chunk of _filling receiving the next bytes
+  std::size_t _pending_bytes = 0;
+  std::size_t _pending_records = 0;
+  clock::time_point _first_pending;
+  clock::time_point _last_sync;
+  bool _unsynced = false;
+  spdlog::memory_buf_t _formatted;
+  batch_stats _stats;
+
+  // the max_delay timer, armed by the first record of a batch
+  static constexpr bool timed = !std::is_same_v<mutex_tt, spdlog::details::null_mutex>;
+  std::mutex _timer_mutex;
+  std::condition_variable _timer_cv;
+  clock::time_point _deadline = clock::time_point::max();
+  bool _stop = false;
+  std::thread _timer;
+
+#ifdef _WIN32
+  std::FILE *_file = nullptr;
+#else
+  int _fd = -1;
+  std::vector<iovec> _iov;
+#endif
+#if EASY_LOGGER_HAS_IO_URING
+  io_uring _ring{};
+  bool _uring = false;      // ring set up, otherwise writev
+  bool _in_flight = false;  // _writing is submitted and not reaped yet
+  std::size_t _in_flight_bytes = 0;
+#endif
+
+ public:
+  explicit batch_file_sink(spdlog::filename_t base_filename, const batch_options &options = {})
+      : _base_filename(std::move(base_filename)), _options(options) {
+    _options.rotation.validate();
+    _options.chunk_size = (std::max(_options.chunk_size, page_size) + page_size - 1) / page_size * page_size;
+#if EASY_LOGGER_HAS_IO_URING
+    _uring = io_uring_queue_init(4, &_ring, 0) == 0;
+#endif
+    open(spdlog::log_clock::now());
+    if constexpr (timed)
+      _timer = std::thread([this] { run_timer(); });
+  }
+
+  ~batch_file_sink() override {
+    if (_timer.joinable()) {
+      {
+        std::lock_guard lock(_timer_mutex);
+        _stop = true;
+      }
+      _timer_cv.notify_one();
+      _timer.join();
+    }
+    try {
+      commit();
+      wait_writing();
+    } catch (...) {
+    }
+    close();
+#if EASY_LOGGER_HAS_IO_URING
+    if (_uring)
+      io_uring_queue_exit(&_ring);
+#endif
+  }
+
+  batch_file_sink(const batch_file_sink &) = delete;
+  void operator=(const batch_file_sink &) = delete;
+
+  spdlog::filename_t filename() {
+    std::lock_guard<mutex_tt> lock(this->mutex_);
+    return _filename;
+  }
+
+  batch_stats stats() {
+    std::lock_guard<mutex_tt> lock(this->mutex_);
+    return _stats;
+  }
+
+ protected:
+  void sink_it_(const spdlog::details::log_msg &msg) override {
+    if (msg.time >= _rotation_tp) {
+      commit();
+      wait_writing();
+      open(msg.time);
+    }
+
+    _formatted.clear();
+    this->formatter_->format(msg, _formatted);
+    if (_pending_records == 0) {
+      _first_pending = clock::now();
+      arm(_first_pending + _options.max_delay);
+    }
+    append(_formatted.data(), _formatted.size());
+    ++_pending_records;
+
+    if (_pending_bytes >= _options.max_bytes || _pending_records >= _options.max_records ||
+        clock::now() - _first_pending >= _options.max_delay)
+      commit();
+  }
+
+  // flush_on / flush_every end up here: everything pending is written, a sync is coalesced with
+  // the other flushes of the same max_delay window
+  void flush_() override {
+    commit();
+    if (!_options.sync || !_unsynced || clock::now() - _last_sync < _options.max_delay)
+      return;
+    wait_writing();
+    sync();
+    _unsynced = false;
+    _last_sync = clock::now();
+    ++_stats.syncs;
+  }
+
+ private:
+  void open(spdlog::log_clock::time_point time) {
+    close();
+    _filename = daily_rotation::filename(_base_filename, time);
+    spdlog::details::os::create_dir(spdlog::details::os::dir_name(_filename));
+#ifdef _WIN32
+    if (spdlog::details::os::fopen_s(&_file, _filename, SPDLOG_FILENAME_T("ab")))
+      spdlog::throw_spdlog_ex("Failed opening file " + spdlog::details::os::filename_to_str(_filename), errno);
+#else
+    _fd = ::open(_filename.c_str(), O_WRONLY | O_CREAT | O_APPEND | O_CLOEXEC, 0644);
+    if (_fd < 0)
+      spdlog::throw_spdlog_ex("Failed opening file " + spdlog::details::os::filename_to_str(_filename), errno);
+#endif
+    _rotation_tp = _options.rotation.next();
+  }
+
+  void arm(clock::time_point deadline) {
+    if constexpr (timed) {
+      {
+        std::lock_guard lock(_timer_mutex);
+        _deadline = deadline;
+      }
+      _timer_cv.notify_one();
+    }
+  }
+
+  // sleeps until the armed deadline, then commits the batch if it is still the one that armed it;
+  // a batch started meanwhile is re-armed, as its own arm() may have been overwritten
+  void run_timer() {
+    std::unique_lock lock(_timer_mutex);
+    while (!_stop) {
+      if (_deadline == clock::time_point::max()) {
+        _timer_cv.wait(lock);
+        continue;
+      }
+      if (clock::now() < _deadline) {
+        _timer_cv.wait_until(lock, _deadline);
+        continue;
+      }
+      _deadline = clock::time_point::max();
+      lock.unlock();
+      {
+        std::lock_guard<mutex_tt> sink_lock(this->mutex_);
+        try {
+          if (_pending_records != 0 && clock::now() - _first_pending >= _options.max_delay)
+            commit();
+          else if (_pending_records != 0)
+            arm(_first_pending + _options.max_delay);
+        } catch (const std::exception &ex) {
+          std::fprintf(stderr, "*** LOGGER ERROR ***: %s\n", ex.what());
+        }
+      }
+      lock.lock();
+    }
+  }
+
+  void close() {
+#ifdef _WIN32
+    if (_file != nullptr)
+      std::fclose(_file);
+    _file = nullptr;
+#else
+    if (_fd >= 0)
+      ::close(_fd);
+    _fd = -1;
+#endif
+  }
+
+  void sync() {
+#ifdef _WIN32
+    std::fflush(_file);
+    _commit(_fileno(_file));
+#elif defined(__APPLE__)
+    ::fsync(_fd);
+#else
+    ::fdatasync(_fd);
+#endif
+  }
+
+  void append(const char *data, std::size_t size) {
+    _pending_bytes += size;
+    while (size > 0) {
+      if (_current == _filling.size())
+        _filling.push_back({std::unique_ptr<std::byte[], chunk_deleter>(
+          new (std::align_val_t{page_size}) std::byte[_options.chunk_size])});
+      chunk &target = _filling[_current];
+      const std::size_t count = std::min(size, _options.chunk_size - target.used);
+      std::memcpy(target.data.get() + target.used, data, count);
+      target.used += count;
+      data += count;
+      size -= count;
+      if (target.used == _options.chunk_size)
+        ++_current;
+    }
+  }
+
+  void commit() {
+    if (_pending_bytes == 0)
+      return;
+    const auto begin = clock::now();
+    wait_writing();
+    std::swap(_filling, _writing);
+    _current = 0;
+    write_batch();
+
+    const auto elapsed = std::chrono::duration_cast<std::chrono::nanoseconds>(clock::now() - begin);
+    ++_stats.commits;
+    _stats.records += _pending_records;
+    _stats.bytes += _pending_bytes;
+    _stats.last_batch_records = _pending_records;
+    _stats.last_batch_bytes = _pending_bytes;
+    _stats.max_batch_bytes = std::max(_stats.max_batch_bytes, _pending_bytes);
+    _stats.last_commit = elapsed;
+    _stats.max_commit = std::max(_stats.max_commit, elapsed);
+    _stats.total_commit += elapsed;
+    _pending_bytes = 0;
+    _pending_records = 0;
+    _unsynced = true;
+  }
+
+#ifdef _WIN32
+  void write_batch() {
+    for (auto &part : _writing) {
+      if (part.used != 0 && std::fwrite(part.data.get(), 1, part.used, _file) != part.used)
+        spdlog::throw_spdlog_ex("Failed writing to file " + spdlog::details::os::filename_to_str(_filename), errno);
+    }
+    std::fflush(_file);
+    recycle();
+  }
+
+  void wait_writing() {}
+#else
+  void write_batch() {
+    _iov.clear();
+    for (auto &part : _writing) {
+      if (part.used != 0)
+        _iov.push_back({part.data.get(), part.used});
+    }
+#if EASY_LOGGER_HAS_IO_URING
+    if (_uring && _iov.size() <= IOV_MAX) {
+      io_uring_sqe *sqe = io_uring_get_sqe(&_ring);
+      if (sqe != nullptr) {
+        io_uring_prep_writev(sqe, _fd, _iov.data(), static_cast<unsigned>(_iov.size()), -1);
+        if (io_uring_submit(&_ring) == 1) {
+          _in_flight = true;
+          _in_flight_bytes = _pending_bytes;
+          return;
+        }
+      }
+    }
+#endif
+    write_all(0);
+    recycle();
+  }
+
+  // writes the remaining iovecs starting with skip bytes already written
+  void write_all(std::size_t skip) {
+    std::size_t first = 0;
+    while (first < _iov.size()) {
+      while (skip > 0) {
+        if (skip >= _iov[first].iov_len) {
+          skip -= _iov[first++].iov_len;
+        } else {
+          _iov[first].iov_base = static_cast<char *>(_iov[first].iov_base) + skip;
+          _iov[first].iov_len -= skip;
+          skip = 0;
+        }
+      }
+      if (first == _iov.size())
+        break;
+      const int count = static_cast<int>(std::min<std::size_t>(_iov.size() - first, IOV_MAX));
+      const ssize_t written = ::writev(_fd, _iov.data() + first, count);
+      if (written < 0) {
+        if (errno == EINTR)
+          continue;
+        spdlog::throw_spdlog_ex("Failed writing to file " + spdlog::details::os::filename_to_str(_filename), errno);
+      }
+      skip = static_cast<std::size_t>(written);
+    }
+  }
+
+  void wait_writing() {
+#if EASY_LOGGER_HAS_IO_URING
+    if (!_in_flight)
+      return;
+    _in_flight = false;
+    io_uring_cqe *cqe = nullptr;
+    int result = io_uring_wait_cqe(&_ring, &cqe);
+    if (result == 0) {
+      result = cqe->res;
+      io_uring_cqe_seen(&_ring, cqe);
+    }
+    // short or failed asynchronous writes are finished synchronously
+    const std::size_t done = result > 0 ? static_cast<std::size_t>(result) : 0;
+    if (done < _in_flight_bytes)
+      write_all(done);
+    recycle();
+#endif
+  }
+#endif
+
+  void recycle() {
+    for (auto &part : _writing)
+      part.used = 0;
+  }
+};
+
+using batch_file_sink_mt = batch_file_sink<std::mutex>;
+using batch_file_sink_st = batch_file_sink<spdlog::details::null_mutex>;
+
+}  // namespace util::logger
@@ -0,0 +1,542 @@
+//
+//  binary_log.h
+//  inlay
+//
+//  compact on-disk format of the deferred backend: a dictionary of call sites plus records that only carry
+//  the site id, the time delta, the thread id and the packed arguments; easy_logger_decode turns it back
+//  into text
+//
+//  file   := magic version frame*
+//  frame  := site | record | time
+//  site   := 0x01 id:varint level:u8 kind:u8 file:str line:varint function:str fmt:str signature:str keys
+//  keys   := count:varint str*     (layout kv only, fmt is then the message)
+//  record := 0x02 id:varint delta_ns:zigzag thread:varint size:varint arguments[size]
+//  time   := 0x03 time_ns:varint       (absolute base of the following deltas, written first in every file)
+//  str    := size:varint bytes
+//
+
+#pragma once
+
+#include <spdlog/common.h>
+#include <spdlog/details/os.h>
+
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <optional>
+#include <string>
+#include <string_view>
+#include <utility>
+#include <vector>
+
+#include "arg_codec.h"
+#include "daily_rotation.h"
+#include "site.h"
+
+namespace util::logger::binary {
+
+constexpr char magic[8] = {'E', 'Z', 'L', 'O', 'G', 'B', 'I', 'N'};
+constexpr std::uint8_t version = 1;
+
+enum class frame : std::uint8_t {
+  site = 1,
+  record = 2,
+  time = 3,
+};
+
+// how the decoder rebuilds the message of a site's records
+enum class layout : std::uint8_t {
+  format = 0,  // LOG_*: std::format string over the arguments
+  fields = 1,  // STM_*: the arguments written one by one as by auto_format_rules
+  text = 2,    // a single string argument holding the finished message
+  kv = 3,      // KV_*: fmt is the message, the site's keys name the arguments
+};
+
+// the put/pack helpers take any buffer with push_back and append(first, last), the flight recorder
+// passes one that never allocates
+template <typename buffer_tt>
+void put_varint(buffer_tt &out, std::uint64_t value) {
+  while (value >= 0x80) {
+    out.push_back(static_cast<char>(value | 0x80));
+    value >>= 7;
+  }
+  out.push_back(static_cast<char>(value));
+}
+
+inline bool get_varint(const char *&in, const char *end, std::uint64_t &value) {
+  value = 0;
+  for (unsigned shift = 0; in != end && shift < 64; shift += 7) {
+    const auto byte = static_cast<std::uint8_t>(*in++);
+    value |= static_cast<std::uint64_t>(byte & 0x7f) << shift;
+    if ((byte & 0x80) == 0)
+      return true;
+  }
+  return false;
+}
+
+constexpr std::uint64_t zigzag(std::int64_t value) {
+  return (static_cast<std::uint64_t>(value) << 1) ^ static_cast<std::uint64_t>(value >> 63);
+}
+
+constexpr std::int64_t unzigzag(std::uint64_t value) {
+  return static_cast<std::int64_t>(value >> 1) ^ -static_cast<std::int64_t>(value & 1);
+}
+
+template <typename buffer_tt>
+void put_string(buffer_tt &out, std::string_view text) {
+  put_varint(out, text.size());
+  out.append(text.data(), text.data() + text.size());
+}
+
+inline bool get_string(const char *&in, const char *end, std::string_view &text) {
+  std::uint64_t size;
+  if (!get_varint(in, end, size) || size > static_cast<std::uint64_t>(end - in))
+    return false;
+  text = {in, static_cast<std::size_t>(size)};
+  in += size;
+  return true;
+}
+
+template <typename tt>
+tt load(const std::byte *&in) {
+  tt value;
+  std::memcpy(&value, in, sizeof(tt));
+  in += sizeof(tt);
+  return value;
+}
+
+template <typename tt, typename buffer_tt>
+void store(buffer_tt &out, tt value) {
+  char bytes[sizeof(tt)];
+  std::memcpy(bytes, &value, sizeof(tt));
+  out.append(bytes, bytes + sizeof(tt));
+}
+
+// deferred record arguments (see codec::type_code) to their packed form: integers as varints,
+// floats as is, long double narrowed to double, strings as str
+template <typename buffer_tt>
+void pack(std::string_view signature, const std::byte *in, buffer_tt &out) {
+  for (char code : signature) {
+    switch (code) {
+      case 's': {
+        const auto size = load<std::uint32_t>(in);
+        put_string(out, {reinterpret_cast<const char *>(in), size});
+        in += size;
+        break;
+      }
+      case 'b':
+      case 'c':
+      case 'a':
+      case 'A':
+        out.push_back(static_cast<char>(load<std::uint8_t>(in)));
+        break;
+      case 'h':
+        put_varint(out, zigzag(load<std::int16_t>(in)));
+        break;
+      case 'i':
+        put_varint(out, zigzag(load<std::int32_t>(in)));
+        break;
+      case 'l':
+        put_varint(out, zigzag(load<std::int64_t>(in)));
+        break;
+      case 'H':
+        put_varint(out, load<std::uint16_t>(in));
+        break;
+      case 'I':
+        put_varint(out, load<std::uint32_t>(in));
+        break;
+      case 'L':
+        put_varint(out, load<std::uint64_t>(in));
+        break;
+      case 'f':
+        store<float>(out, load<float>(in));
+        break;
+      case 'd':
+        store<double>(out, load<double>(in));
+        break;
+      case 'e':
+        store<double>(out, static_cast<double>(load<long double>(in)));
+        break;
+      case 'p':
+        put_varint(out, reinterpret_cast<std::uintptr_t>(load<const void *>(in)));
+        break;
+    }
+  }
+}
+
+// whether the arguments of signature, encoded by codec::encode, lie within [in, end)
+inline bool encoded_fits(std::string_view signature, const std::byte *in, const std::byte *end) {
+  for (char code : signature) {
+    std::size_t size;
+    switch (code) {
+      case 's':
+        if (end - in < 4)
+          return false;
+        size = load<std::uint32_t>(in);
+        break;
+      case 'b':
+      case 'c':
+      case 'a':
+      case 'A':
+        size = 1;
+        break;
+      case 'h':
+      case 'H':
+        size = 2;
+        break;
+      case 'i':
+      case 'I':
+      case 'f':
+        size = 4;
+        break;
+      case 'l':
+      case 'L':
+      case 'd':
+        size = 8;
+        break;
+      case 'e':
+        size = sizeof(long double);
+        break;
+      case 'p':
+        size = sizeof(const void *);
+        break;
+      default:
+        return false;
+    }
+    if (static_cast<std::size_t>(end - in) < size)
+      return false;
+    in += size;
+  }
+  return true;
+}
+
+// records formatted on the caller's thread, and opted-in user types only their formatter can read,
+// are stored as their text
+inline bool text_layout(const site_info &info) {
+  return info.format == &codec::format_text || info.signature.find('x') != std::string_view::npos;
+}
+
+template <typename buffer_tt>
+void put_site(buffer_tt &out, std::uint32_t site_id, const site_info &info) {
+  const log_site &site = *info.site;
+  const bool text = text_layout(info);
+  out.push_back(static_cast<char>(frame::site));
+  put_varint(out, site_id);
+  out.push_back(static_cast<char>(site.level));
+  out.push_back(static_cast<char>(text                          ? layout::text
+                                  : site.kind == site_kind::stm ? layout::fields
+                                  : site.kind == site_kind::kv  ? layout::kv
+                                                                : layout::format));
+  put_string(out, site.file);
+  put_varint(out, site.line);
+  put_string(out, site.function);
+  put_string(out, site.fmt);
+  put_string(out, text ? "s" : info.signature);
+  if (!text && site.kind == site_kind::kv) {
+    put_varint(out, site.keys.size());
+    for (auto key : site.keys)
+      put_string(out, key);
+  }
+}
+
+// one packed argument as read back by the decoder
+struct value {
+  char code;
+  union {
+    std::int64_t i;
+    std::uint64_t u;
+    double d;
+    float f;
+  };
+  std::string_view s;
+};
+
+inline bool unpack(std::string_view signature, const char *in, const char *end, std::vector<value> &values) {
+  values.clear();
+  for (char code : signature) {
+    value &v = values.emplace_back();
+    v.code = code;
+    v.u = 0;
+    std::uint64_t raw;
+    switch (code) {
+      case 's':
+        if (!get_string(in, end, v.s))
+          return false;
+        break;
+      case 'b':
+      case 'c':
+      case 'A':
+        if (in == end)
+          return false;
+        v.u = static_cast<std::uint8_t>(*in++);
+        break;
+      case 'a':
+        if (in == end)
+          return false;
+        v.i = static_cast<std::int8_t>(*in++);
+        break;
+      case 'h':
+      case 'i':
+      case 'l':
+        if (!get_varint(in, end, raw))
+          return false;
+        v.i = unzigzag(raw);
+        break;
+      case 'H':
+      case 'I':
+      case 'L':
+      case 'p':
+        if (!get_varint(in, end, v.u))
+          return false;
+        break;
+      case 'f':
+        if (end - in < 4)
+          return false;
+        std::memcpy(&v.f, in, 4);
+        in += 4;
+        break;
+      case 'd':
+      case 'e':
+        if (end - in < 8)
+          return false;
+        std::memcpy(&v.d, in, 8);
+        in += 8;
+        v.code = 'd';
+        break;
+      default:
+        return false;
+    }
+  }
+  return in == end;
+}
+
+// a site frame as read back
+struct site_description {
+  spdlog::level::level_enum level;
+  binary::layout layout;
+  std::string file;
+  std::uint32_t line;
+  std::string function;
+  std::string fmt;
+  std::string signature;
+  std::vector<std::string> keys;  // layout kv
+};
+
+// splits a binary log, fed in pieces of any size, back into its frames; each record goes to
+// on_record(site, site_id, time_ns, thread_id, args, args_end) with its packed arguments, see unpack
+class reader {
+ private:
+  std::vector<std::optional<site_description>> _sites;
+  std::int64_t _time = 0;
+  std::string _pending;  // bytes of a frame not complete yet
+
+ public:
+  // decodes every complete frame, false once the data is corrupt
+  template <typename fn_tt>
+  bool feed(const char *data, std::size_t size, fn_tt &&on_record) {
+    _pending.append(data, size);
+    const char *in = _pending.data();
+    const char *end = in + _pending.size();
+    while (in != end) {
+      const char *frame = in;
+      const int result = decode(in, end, on_record);
+      if (result < 0)
+        return false;
+      if (result == 0) {
+        in = frame;
+        break;
+      }
+    }
+    _pending.erase(0, static_cast<std::size_t>(in - _pending.data()));
+    return true;
+  }
+
+  // bytes of a frame cut off by a crash, or still being written
+  std::size_t pending() const {
+    return _pending.size();
+  }
+
+ private:
+  // 1 for a frame, 0 when it is incomplete, -1 when it is corrupt
+  template <typename fn_tt>
+  int decode(const char *&in, const char *end, fn_tt &on_record) {
+    if (*in == magic[0]) {
+      // a file header, also found mid-file when a file was reopened
+      if (static_cast<std::size_t>(end - in) < sizeof(magic) + 1)
+        return 0;
+      if (std::memcmp(in, magic, sizeof(magic)) != 0 || static_cast<std::uint8_t>(in[sizeof(magic)]) != version)
+        return -1;
+      in += sizeof(magic) + 1;
+      _sites.clear();
+      return 1;
+    }
+
+    std::uint64_t id;
+    switch (static_cast<frame>(*in++)) {
+      case frame::time: {
+        std::uint64_t time;
+        if (!get_varint(in, end, time))
+          return 0;
+        _time = static_cast<std::int64_t>(time);
+        return 1;
+      }
+      case frame::site: {
+        std::uint64_t line;
+        std::string_view file, function, fmt, signature;
+        if (!get_varint(in, end, id) || end - in < 2)
+          return 0;
+        const auto level = static_cast<spdlog::level::level_enum>(*in++);
+        const auto kind = static_cast<binary::layout>(*in++);
+        if (!get_string(in, end, file) || !get_varint(in, end, line) || !get_string(in, end, function) ||
+            !get_string(in, end, fmt) || !get_string(in, end, signature))
+          return 0;
+        std::vector<std::string> keys;
+        if (kind == layout::kv) {
+          std::uint64_t count;
+          std::string_view key;
+          if (!get_varint(in, end, count))
+            return 0;
+          for (std::uint64_t i = 0; i < count; ++i) {
+            if (!get_string(in, end, key))
+              return 0;
+            keys.emplace_back(key);
+          }
+        }
+        if (id >= site_registry::max_sites)
+          return -1;
+        if (id >= _sites.size())
+          _sites.resize(id + 1);
+        _sites[id] = site_description{level, kind, std::string(file), static_cast<std::uint32_t>(line),
+          std::string(function), std::string(fmt), std::string(signature), std::move(keys)};
+        return 1;
+      }
+      case frame::record: {
+        std::uint64_t delta, thread, size;
+        if (!get_varint(in, end, id) || !get_varint(in, end, delta) || !get_varint(in, end, thread) ||
+            !get_varint(in, end, size))
+          return 0;
+        if (size > static_cast<std::uint64_t>(end - in))
+          return 0;
+        const char *args = in;
+        in += size;
+        _time += unzigzag(delta);
+        if (id >= _sites.size() || !_sites[id])
+          return -1;
+        on_record(*_sites[id], id, _time, thread, args, in);
+        return 1;
+      }
+      default:
+        return -1;
+    }
+  }
+};
+
+// appends records of the deferred backend to the day's binary file, sites are described the first
+// time they appear in a file; writes go through a buffer that is flushed when the backend idles;
+// unsynchronized, the backend thread is its only caller
+class writer {
+ private:
+  spdlog::filename_t _base_filename;
+  daily_rotation _rotation;
+  spdlog::log_clock::time_point _rotation_tp;
+  std::FILE *_file = nullptr;
+  std::vector<bool> _described;
+  std::int64_t _last_time = 0;
+  spdlog::memory_buf_t _buffer;
+  spdlog::memory_buf_t _arguments;
+  spdlog::memory_buf_t _text;
+
+ public:
+  static constexpr std::size_t buffer_size = 1024ull * 64;
+
+  explicit writer(spdlog::filename_t base_filename, const daily_rotation &rotation = {})
+      : _base_filename(std::move(base_filename)), _rotation(rotation) {
+    _rotation.validate();
+    open(spdlog::log_clock::now());
+  }
+
+  ~writer() {
+    flush();
+    if (_file != nullptr)
+      std::fclose(_file);
+  }
+
+  writer(const writer &) = delete;
+  void operator=(const writer &) = delete;
+
+  // args points at the record's arguments as encoded by codec::encode
+  void write(const site_info &info, std::uint32_t site_id, spdlog::log_clock::time_point time, std::size_t thread_id,
+    const std::byte *args) {
+    if (time >= _rotation_tp) {
+      flush_buffer();
+      open(time);
+    }
+
+    const bool text = text_layout(info);
+    if (site_id >= _described.size())
+      _described.resize(site_id + 1);
+    if (!_described[site_id]) {
+      _described[site_id] = true;
+      put_site(_buffer, site_id, info);
+    }
+
+    _arguments.clear();
+    if (!text) {
+      pack(info.signature, args, _arguments);
+    } else if (info.format == &codec::format_text) {
+      pack("s", args, _arguments);
+    } else {
+      _text.clear();
+      info.format(*info.site, args, _text);
+      put_string(_arguments, std::string_view(_text.data(), _text.size()));
+    }
+
+    const auto now = std::chrono::duration_cast<std::chrono::nanoseconds>(time.time_since_epoch()).count();
+    _buffer.push_back(static_cast<char>(frame::record));
+    put_varint(_buffer, site_id);
+    put_varint(_buffer, zigzag(now - _last_time));
+    put_varint(_buffer, thread_id);
+    put_varint(_buffer, _arguments.size());
+    _buffer.append(_arguments.data(), _arguments.data() + _arguments.size());
+    _last_time = now;
+
+    if (_buffer.size() >= buffer_size)
+      flush_buffer();
+  }
+
+  void flush() {
+    flush_buffer();
+    if (_file != nullptr)
+      std::fflush(_file);
+  }
+
+ private:
+  void open(spdlog::log_clock::time_point time) {
+    if (_file != nullptr)
+      std::fclose(_file);
+    const auto filename = daily_rotation::filename(_base_filename, time);
+    spdlog::details::os::create_dir(spdlog::details::os::dir_name(filename));
+    if (spdlog::details::os::fopen_s(&_file, filename, SPDLOG_FILENAME_T("ab")))
+      spdlog::throw_spdlog_ex("Failed opening file " + spdlog::details::os::filename_to_str(filename), errno);
+
+    // a file reopened on the same day gets a second header, the decoder accepts it anywhere
+    _buffer.append(magic, magic + sizeof(magic));
+    _buffer.push_back(static_cast<char>(version));
+    _last_time = std::chrono::duration_cast<std::chrono::nanoseconds>(time.time_since_epoch()).count();
+    _buffer.push_back(static_cast<char>(frame::time));
+    put_varint(_buffer, static_cast<std::uint64_t>(_last_time));
+    _described.assign(_described.size(), false);
+    _rotation_tp = _rotation.next();
+  }
+
+  void flush_buffer() {
+    if (_buffer.size() == 0 || _file == nullptr)
+      return;
+    std::fwrite(_buffer.data(), 1, _buffer.size(), _file);
+    _buffer.clear();
+  }
+};
+
+}  // namespace util::logger::binary
@@ -0,0 +1,170 @@
+//
+//  channel.h
+//  inlay
+//
+//  named channels for LOG_*_CH: each one a logger of its own with its level, sinks and queue, so a burst
+//  on one channel never waits behind another's mutex, file or queue; sites resolve their channel once
+//
+
+#pragma once
+
+#include <spdlog/async.h>
+#include <spdlog/details/periodic_worker.h>
+#include <spdlog/logger.h>
+
+#include <atomic>
+#include <chrono>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <string_view>
+#include <vector>
+
+namespace util::logger {
+
+class channel {
+ private:
+  std::string _name;
+  std::atomic<spdlog::logger *> _logger{nullptr};  // null until configured, records then go the LOG_* way
+  std::atomic<spdlog::level::level_enum> _level{spdlog::level::info};
+
+ public:
+  explicit channel(std::string name) : _name(std::move(name)) {}
+
+  channel(const channel &) = delete;
+  void operator=(const channel &) = delete;
+
+  const std::string &name() const {
+    return _name;
+  }
+
+  spdlog::logger *logger() const {
+    return _logger.load(std::memory_order_acquire);
+  }
+
+  bool configured() const {
+    return logger() != nullptr;
+  }
+
+  spdlog::level::level_enum level() const {
+    return _level.load(std::memory_order_relaxed);
+  }
+
+  void set_level(spdlog::level::level_enum level) {
+    _level.store(level, std::memory_order_relaxed);
+  }
+
+  bool should_log(spdlog::level::level_enum level) const {
+    return level >= _level.load(std::memory_order_relaxed);
+  }
+
+ private:
+  friend class channel_registry;
+
+  void set_logger(spdlog::logger *logger) {
+    _logger.store(logger, std::memory_order_release);
+  }
+};
+
+// channels are created on first use and never go away, sites keep pointers to them; a replaced logger
+// stays alive until clear() as a site may still be writing to it
+class channel_registry {
+ public:
+  static constexpr std::chrono::seconds flush_interval{3};  // like init()'s flush_every
+
+ private:
+  struct configuration {
+    std::shared_ptr<spdlog::logger> logger;
+    std::shared_ptr<spdlog::details::thread_pool> pool;  // async channels: the queue and its workers
+  };
+
+  std::mutex _mutex;
+  std::vector<std::unique_ptr<channel>> _channels;
+  std::vector<configuration> _configurations;
+  std::unique_ptr<spdlog::details::periodic_worker> _flusher;
+
+ public:
+  static channel_registry &get() {
+    static channel_registry instance;
+    return instance;
+  }
+
+  channel &resolve(std::string_view name) {
+    std::lock_guard lock(_mutex);
+    for (const auto &channel : _channels) {
+      if (channel->name() == name)
+        return *channel;
+    }
+    return *_channels.emplace_back(std::make_unique<channel>(std::string(name)));
+  }
+
+  // logger filters nothing itself, the channel's level is checked before a record is built
+  void configure(channel &target, std::shared_ptr<spdlog::logger> logger,
+    std::shared_ptr<spdlog::details::thread_pool> pool, spdlog::level::level_enum level) {
+    logger->set_level(spdlog::level::trace);
+    std::lock_guard lock(_mutex);
+    target.set_level(level);
+    target.set_logger(logger.get());
+    _configurations.push_back({std::move(logger), std::move(pool)});
+    if (!_flusher)
+      _flusher = std::make_unique<spdlog::details::periodic_worker>([this] { flush(); }, flush_interval);
+  }
+
+  void flush() {
+    std::lock_guard lock(_mutex);
+    for (const auto &channel : _channels) {
+      if (auto *logger = channel->logger())
+        logger->flush();
+    }
+  }
+
+  // back to unconfigured, queues drained and files closed; no channel may be logging to
+  void clear() {
+    std::unique_ptr<spdlog::details::periodic_worker> flusher;
+    std::vector<configuration> configurations;
+    {
+      std::lock_guard lock(_mutex);
+      for (const auto &channel : _channels)
+        channel->set_logger(nullptr);
+      flusher = std::move(_flusher);
+      configurations = std::move(_configurations);
+    }
+    flusher.reset();
+    for (auto &configuration : configurations) {
+      configuration.logger->flush();
+      configuration.logger.reset();
+    }
+    // a pool drains its queue before its workers exit
+    configurations.clear();
+  }
+
+ private:
+  channel_registry() = default;
+  ~channel_registry() {
+    clear();
+  }
+
+  channel_registry(const channel_registry &) = delete;
+  void operator=(const channel_registry &) = delete;
+};
+
+// the channel of one LOG_*_CH site, constant initialized and looked up on the first call
+class channel_handle {
+ private:
+  const char *_name;
+  std::atomic<channel *> _channel{nullptr};
+
+ public:
+  constexpr explicit channel_handle(const char *name) : _name(name) {}
+
+  channel &get() {
+    auto *resolved = _channel.load(std::memory_order_acquire);
+    if (resolved == nullptr) {
+      resolved = &channel_registry::get().resolve(_name);
+      _channel.store(resolved, std::memory_order_release);
+    }
+    return *resolved;
+  }
+};
+
+}  // namespace util::logger
@@ -0,0 +1,286 @@
+//
+//  compiled_format.h
+//  inlay
+//
+//  format strings split at compile time into literal pieces and argument slots,
+//  so formatting a record only appends pieces and never scans for braces
+//
+
+#pragma once
+
+#include <spdlog/common.h>
+
+#include <array>
+#include <charconv>
+#include <cstddef>
+#include <cstdint>
+#include <format>
+#include <iterator>
+#include <string>
+#include <string_view>
+#include <type_traits>
+
+namespace util::logger {
+
+struct format_segment {
+  std::uint32_t offset;  // into the compiled chars
+  std::uint32_t size;
+  std::int32_t arg;  // -1 for a literal, otherwise the argument index
+};
+
+// literal segments hold unescaped text, argument segments hold "{:spec}" or nothing for plain "{}"
+struct format_view {
+  const format_segment *segments = nullptr;
+  std::size_t count = 0;
+  const char *chars = nullptr;
+  bool dynamic = true;  // not pre-parsed (nested replacement fields, printf strings), use std::vformat_to
+};
+
+namespace detail {
+
+// walks a format string, reporting literal characters and replacement fields to out_tt
+template <typename out_tt>
+constexpr bool parse_format(std::string_view fmt, out_tt &out) {
+  std::int32_t next_arg = 0;
+  std::size_t i = 0;
+  while (i < fmt.size()) {
+    const char c = fmt[i];
+    if (c == '}') {
+      if (i + 1 >= fmt.size() || fmt[i + 1] != '}')
+        return false;
+      out.literal('}');
+      i += 2;
+    } else if (c != '{') {
+      out.literal(c);
+      ++i;
+    } else if (i + 1 < fmt.size() && fmt[i + 1] == '{') {
+      out.literal('{');
+      i += 2;
+    } else {
+      std::size_t j = i + 1;
+      std::int32_t arg = -1;
+      while (j < fmt.size() && fmt[j] >= '0' && fmt[j] <= '9')
+        arg = (arg < 0 ? 0 : arg * 10) + (fmt[j++] - '0');
+      if (arg < 0)
+        arg = next_arg++;
+
+      std::string_view spec;
+      if (j < fmt.size() && fmt[j] == ':') {
+        const std::size_t end = fmt.find_first_of("{}", j + 1);
+        if (end == std::string_view::npos || fmt[end] == '{')
+          return false;  // nested fields take extra arguments, leave those to std::format
+        spec = fmt.substr(j + 1, end - j - 1);
+        j = end;
+      }
+      if (j >= fmt.size() || fmt[j] != '}')
+        return false;
+      out.field(arg, spec);
+      i = j + 1;
+    }
+  }
+  return true;
+}
+
+struct format_measure {
+  std::size_t segments = 0;
+  std::size_t chars = 0;
+  bool in_literal = false;
+
+  constexpr void literal(char) {
+    segments += in_literal ? 0 : 1;
+    in_literal = true;
+    ++chars;
+  }
+
+  constexpr void field(std::int32_t, std::string_view spec) {
+    ++segments;
+    in_literal = false;
+    chars += spec.empty() ? 0 : spec.size() + 3;
+  }
+};
+
+template <std::size_t segments_vv, std::size_t chars_vv>
+struct format_writer {
+  std::array<format_segment, segments_vv> &segments;
+  std::array<char, chars_vv> &chars;
+  std::size_t segment = 0;
+  std::size_t pos = 0;
+  bool in_literal = false;
+
+  constexpr void literal(char c) {
+    if (!in_literal)
+      segments[segment++] = {static_cast<std::uint32_t>(pos), 0, -1};
+    in_literal = true;
+    ++segments[segment - 1].size;
+    chars[pos++] = c;
+  }
+
+  constexpr void field(std::int32_t arg, std::string_view spec) {
+    in_literal = false;
+    const auto size = static_cast<std::uint32_t>(spec.empty() ? 0 : spec.size() + 3);
+    segments[segment++] = {static_cast<std::uint32_t>(pos), size, arg};
+    if (spec.empty())
+      return;
+    chars[pos++] = '{';
+    chars[pos++] = ':';
+    for (char c : spec)
+      chars[pos++] = c;
+    chars[pos++] = '}';
+  }
+};
+
+}  // namespace detail
+
+struct format_shape {
+  std::size_t segments = 0;
+  std::size_t chars = 0;
+};
+
+consteval format_shape measure_format(std::string_view fmt) {
+  detail::format_measure measure;
+  if (!detail::parse_format(fmt, measure))
+    return {};
+  return {measure.segments, measure.chars};
+}
+
+template <std::size_t segments_vv, std::size_t chars_vv>
+struct compiled_format {
+  std::array<format_segment, segments_vv> segments{};
+  std::array<char, chars_vv> chars{};
+  bool dynamic = false;
+
+  constexpr format_view view() const {
+    return {segments.data(), segments_vv, chars.data(), dynamic};
+  }
+};
+
+// sizes come from measure_format(fmt), an unparsable string compiles to a dynamic view
+template <std::size_t segments_vv, std::size_t chars_vv>
+consteval auto compile_format(std::string_view fmt) {
+  compiled_format<segments_vv, chars_vv> result;
+  detail::format_writer<segments_vv, chars_vv> writer{result.segments, result.chars};
+  if (segments_vv == 0 && !fmt.empty())
+    result.dynamic = true;
+  else
+    result.dynamic = !detail::parse_format(fmt, writer);
+  return result;
+}
+
+inline void append(spdlog::memory_buf_t &dest, std::string_view text) {
+  dest.append(text.data(), text.data() + text.size());
+}
+
+// per-thread buffer for text built on the caller's thread, so a message costs no allocation once
+// the buffer has grown; a nested use (a formatter that logs itself) gets a buffer of its own
+class scratch_buffer {
+ public:
+  static constexpr std::size_t max_retained = 1024ull * 64;  // give back the memory of an occasional huge message
+
+ private:
+  struct local {
+    spdlog::memory_buf_t buffer;
+    bool busy = false;
+  };
+
+  static local &shared() {
+    static thread_local local instance;
+    return instance;
+  }
+
+  local &_shared;
+  bool _nested;
+  spdlog::memory_buf_t _own;
+
+ public:
+  scratch_buffer() : _shared(shared()), _nested(_shared.busy) {
+    _shared.busy = true;
+    if (!_nested && _shared.buffer.capacity() > max_retained)
+      _shared.buffer = spdlog::memory_buf_t();
+    get().clear();
+  }
+
+  ~scratch_buffer() {
+    if (!_nested)
+      _shared.busy = false;
+  }
+
+  scratch_buffer(const scratch_buffer &) = delete;
+  void operator=(const scratch_buffer &) = delete;
+
+  spdlog::memory_buf_t &get() {
+    return _nested ? _own : _shared.buffer;
+  }
+};
+
+namespace detail {
+
+// a pointer, not an array; a null one is written as nothing, as the deferred backend writes it
+template <typename tt>
+inline constexpr bool is_c_string_v = std::is_same_v<tt, const char *> || std::is_same_v<tt, char *>;
+
+template <typename tt>
+std::string_view c_string(const tt &value) {
+  return value != nullptr ? std::string_view(value) : std::string_view();
+}
+
+}  // namespace detail
+
+// "{}" formatting of the common types without going through std::format's parser
+template <typename tt>
+void write_value(const tt &value, spdlog::memory_buf_t &dest) {
+  using value_t = std::decay_t<tt>;
+  if constexpr (detail::is_c_string_v<tt>) {
+    append(dest, detail::c_string(value));
+  } else if constexpr (std::is_same_v<value_t, bool>) {
+    append(dest, value ? "true" : "false");
+  } else if constexpr (std::is_same_v<value_t, char>) {
+    dest.push_back(value);
+  } else if constexpr (std::is_arithmetic_v<value_t>) {
+    char buf[64];
+    const auto result = std::to_chars(buf, buf + sizeof(buf), value);
+    dest.append(buf, result.ptr);
+  } else if constexpr (!std::is_null_pointer_v<value_t> && std::is_convertible_v<const tt &, std::string_view>) {
+    append(dest, std::string_view(value));
+  } else {
+    std::vformat_to(std::back_inserter(dest), "{}", std::make_format_args(value));
+  }
+}
+
+namespace detail {
+
+template <typename tt>
+void write_field(const format_view &format, const format_segment &segment, const tt &value,
+  spdlog::memory_buf_t &dest) {
+  const std::string_view spec(format.chars + segment.offset, segment.size);
+  if (segment.size == 0) {
+    write_value(value, dest);
+  } else if constexpr (is_c_string_v<tt>) {
+    const auto text = c_string(value);
+    std::vformat_to(std::back_inserter(dest), spec, std::make_format_args(text));
+  } else {
+    std::vformat_to(std::back_inserter(dest), spec, std::make_format_args(value));
+  }
+}
+
+}  // namespace detail
+
+// fmt is only read for dynamic views
+template <typename... args_tt>
+void format_compiled(
+  const format_view &format, std::string_view fmt, spdlog::memory_buf_t &dest, const args_tt &...args) {
+  if (format.dynamic) {
+    std::vformat_to(std::back_inserter(dest), fmt, std::make_format_args(args...));
+    return;
+  }
+  for (std::size_t i = 0; i < format.count; ++i) {
+    const format_segment &segment = format.segments[i];
+    if (segment.arg < 0) {
+      dest.append(format.chars + segment.offset, format.chars + segment.offset + segment.size);
+      continue;
+    }
+    [[maybe_unused]] std::int32_t index = 0;
+    ((index++ == segment.arg ? detail::write_field(format, segment, args, dest) : void()), ...);
+  }
+}
+
+}  // namespace util::logger
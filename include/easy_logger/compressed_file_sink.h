@@ -0,0 +1,416 @@
+//
+//  compressed_file_sink.h
+//  inlay
+//
+//  daily file sink that cuts the formatted text into blocks and compresses each into an independent
+//  zstd or LZ4 frame on a helper thread; "<file>.idx" maps the blocks' time ranges to file offsets
+//
+
+#pragma once
+
+#include <spdlog/common.h>
+#include <spdlog/details/null_mutex.h>
+#include <spdlog/details/os.h>
+#include <spdlog/sinks/base_sink.h>
+
+#include <algorithm>
+#include <cerrno>
+#include <chrono>
+#include <condition_variable>
+#include <cstddef>
+#include <cstdint>
+#include <cstdio>
+#include <deque>
+#include <exception>
+#include <functional>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+// each codec is opt-in, it needs the library to be linked; blocks are stored uncompressed otherwise
+#if defined(EASY_LOGGER_USE_ZSTD) && __has_include(<zstd.h>)
+#include <zstd.h>
+#define EASY_LOGGER_HAS_ZSTD 1
+#else
+#define EASY_LOGGER_HAS_ZSTD 0
+#endif
+#if defined(EASY_LOGGER_USE_LZ4) && __has_include(<lz4frame.h>)
+#include <lz4frame.h>
+#define EASY_LOGGER_HAS_LZ4 1
+#else
+#define EASY_LOGGER_HAS_LZ4 0
+#endif
+
+#include "daily_rotation.h"
+
+namespace util::logger {
+
+enum class compression : std::uint8_t {
+  none = 0,  // blocks stored as is, the file is plain text
+  lz4 = 1,
+  zstd = 2,
+};
+
+// one compressed block, handed to compressed_options::on_block
+struct block_report {
+  compression codec = compression::none;
+  std::size_t records = 0;
+  std::size_t raw_bytes = 0;
+  std::size_t compressed_bytes = 0;
+  std::chrono::nanoseconds time{0};  // spent compressing
+
+  double ratio() const {
+    return compressed_bytes != 0 ? static_cast<double>(raw_bytes) / compressed_bytes : 0;
+  }
+};
+
+struct compression_stats {
+  std::uint64_t blocks = 0;
+  std::uint64_t raw_bytes = 0;
+  std::uint64_t compressed_bytes = 0;
+  std::chrono::nanoseconds total_time{0};
+  std::chrono::nanoseconds max_time{0};
+  block_report last;
+
+  double ratio() const {
+    return compressed_bytes != 0 ? static_cast<double>(raw_bytes) / compressed_bytes : 0;
+  }
+};
+
+struct compressed_options {
+  compression codec = compression::zstd;       // the other codec, then none, when this one is not compiled in
+  int level = 3;                               // zstd compression level
+  std::size_t block_size = 1024ull * 1024;     // raw bytes per frame, a block ends after the record crossing it
+  std::chrono::milliseconds max_delay{10000};  // a partial block this old is cut on the next record or flush
+  spdlog::level::level_enum flush_level = spdlog::level::warn;  // a flush cuts a block holding a record this high
+  std::size_t max_queued = 4;                  // blocks waiting for the helper thread before the writer waits
+  daily_rotation rotation;                     // rotation time, 00:02 as with init()'s daily_file_sink
+  std::function<void(const block_report &)> on_block;  // called on the helper thread after each block
+};
+
+// "<file>.idx" holds one entry per block, appended once the block is in the file
+struct block_entry {
+  std::int64_t first_time;  // ns since the epoch, of the block's first and last record
+  std::int64_t last_time;
+  std::uint64_t offset;  // of the frame in the file
+  std::uint32_t compressed_size;
+  std::uint32_t raw_size;
+  compression codec;
+  std::uint8_t reserved[7];
+};
+static_assert(sizeof(block_entry) == 40);
+
+inline spdlog::filename_t index_filename(const spdlog::filename_t &filename) {
+  return filename + SPDLOG_FILENAME_T(".idx");
+}
+
+inline compression available_compression(compression wanted) {
+  if (wanted == compression::none)
+    return compression::none;
+  if ((wanted == compression::zstd || !EASY_LOGGER_HAS_LZ4) && EASY_LOGGER_HAS_ZSTD)
+    return compression::zstd;
+  return EASY_LOGGER_HAS_LZ4 ? compression::lz4 : compression::none;
+}
+
+inline std::vector<block_entry> read_index(const spdlog::filename_t &filename) {
+  std::vector<block_entry> entries;
+  std::FILE *file = nullptr;
+  if (spdlog::details::os::fopen_s(&file, index_filename(filename), SPDLOG_FILENAME_T("rb")))
+    return entries;
+  block_entry entry;
+  while (std::fread(&entry, sizeof(entry), 1, file) == 1)
+    entries.push_back(entry);
+  std::fclose(file);
+  return entries;
+}
+
+// first block that can hold records at or after time; blocks are in write order, so with an async
+// logger a record may sit one block later than its timestamp suggests
+inline std::size_t seek_block(const std::vector<block_entry> &entries, spdlog::log_clock::time_point time) {
+  const auto ns = std::chrono::duration_cast<std::chrono::nanoseconds>(time.time_since_epoch()).count();
+  const auto it = std::partition_point(
+    entries.begin(), entries.end(), [&](const block_entry &entry) { return entry.last_time < ns; });
+  return static_cast<std::size_t>(it - entries.begin());
+}
+
+// the raw text of one block, false when it cannot be decoded with the codecs compiled in
+inline bool decompress_block(const block_entry &entry, const char *data, std::string &out) {
+  out.resize(entry.raw_size);
+  switch (entry.codec) {
+    case compression::none:
+      if (entry.compressed_size != entry.raw_size)
+        return false;
+      std::copy(data, data + entry.raw_size, out.data());
+      return true;
+#if EASY_LOGGER_HAS_ZSTD
+    case compression::zstd:
+      return ZSTD_decompress(out.data(), out.size(), data, entry.compressed_size) == entry.raw_size;
+#endif
+#if EASY_LOGGER_HAS_LZ4
+    case compression::lz4: {
+      LZ4F_dctx *context = nullptr;
+      if (LZ4F_isError(LZ4F_createDecompressionContext(&context, LZ4F_VERSION)))
+        return false;
+      std::size_t out_size = out.size();
+      std::size_t in_size = entry.compressed_size;
+      const std::size_t result = LZ4F_decompress(context, out.data(), &out_size, data, &in_size, nullptr);
+      LZ4F_freeDecompressionContext(context);
+      return result == 0 && out_size == entry.raw_size;
+    }
+#endif
+    default:
+      return false;
+  }
+}
+
+// records are formatted into the current block on the logging thread (the backend thread with the async
+// or deferred logger), full blocks are queued to a helper thread that compresses them and appends the
+// frame and its index entry; a crash loses the block being filled and the queued ones
+template <typename mutex_tt>
+class compressed_file_sink final : public spdlog::sinks::base_sink<mutex_tt> {
+ private:
+  using clock = std::chrono::steady_clock;
+
+  struct block {
+    spdlog::filename_t filename;
+    std::string raw;
+    std::size_t records = 0;
+    std::int64_t first_time = 0;
+    std::int64_t last_time = 0;
+    bool flush_due = false;  // holds a record at or above flush_level
+  };
+
+  spdlog::filename_t _base_filename;
+  spdlog::filename_t _filename;
+  compressed_options _options;
+  compression _codec;
+  spdlog::log_clock::time_point _rotation_tp;
+  block _current;
+  clock::time_point _first_pending;
+  spdlog::memory_buf_t _formatted;
+
+  // shared with the helper thread
+  std::mutex _queue_mutex;
+  std::condition_variable _queue_cv;  // a block was queued, or the sink is closing
+  std::condition_variable _space_cv;  // a block was written
+  std::deque<block> _queue;
+  std::vector<std::string> _spare;  // raw buffers of written blocks, reused for the next ones
+  compression_stats _stats;
+  bool _closing = false;
+  std::thread _worker;
+
+ public:
+  explicit compressed_file_sink(spdlog::filename_t base_filename, const compressed_options &options = {})
+      : _base_filename(std::move(base_filename)), _options(options), _codec(available_compression(options.codec)) {
+    _options.rotation.validate();
+    _options.block_size = std::max<std::size_t>(_options.block_size, 4096);
+    _options.max_queued = std::max<std::size_t>(_options.max_queued, 1);
+    rotate(spdlog::log_clock::now());
+    _worker = std::thread([this] { run(); });
+  }
+
+  ~compressed_file_sink() override {
+    {
+      std::lock_guard<mutex_tt> lock(this->mutex_);
+      cut();
+    }
+    {
+      std::lock_guard lock(_queue_mutex);
+      _closing = true;
+    }
+    _queue_cv.notify_one();
+    _worker.join();
+  }
+
+  compressed_file_sink(const compressed_file_sink &) = delete;
+  void operator=(const compressed_file_sink &) = delete;
+
+  // the file being written, the index is index_filename() of it
+  spdlog::filename_t filename() {
+    std::lock_guard<mutex_tt> lock(this->mutex_);
+    return _filename;
+  }
+
+  compression codec() const {
+    return _codec;
+  }
+
+  compression_stats stats() {
+    std::lock_guard lock(_queue_mutex);
+    return _stats;
+  }
+
+ protected:
+  void sink_it_(const spdlog::details::log_msg &msg) override {
+    if (msg.time >= _rotation_tp) {
+      cut();
+      rotate(msg.time);
+    }
+
+    _formatted.clear();
+    this->formatter_->format(msg, _formatted);
+    const auto time = std::chrono::duration_cast<std::chrono::nanoseconds>(msg.time.time_since_epoch()).count();
+    if (_current.records == 0) {
+      _current.first_time = time;
+      _first_pending = clock::now();
+    }
+    _current.raw.append(_formatted.data(), _formatted.size());
+    _current.last_time = std::max(_current.last_time, time);
+    _current.flush_due |= msg.level >= _options.flush_level;
+    ++_current.records;
+
+    if (_current.raw.size() >= _options.block_size || clock::now() - _first_pending >= _options.max_delay)
+      cut();
+  }
+
+  // flush_every only cuts a block that is max_delay old, small frames compress poorly; the flush after a
+  // record at or above the logger's flush_on level (flush_level here) cuts it right away
+  void flush_() override {
+    if (_current.records != 0 && (_current.flush_due || clock::now() - _first_pending >= _options.max_delay))
+      cut();
+  }
+
+ private:
+  void rotate(spdlog::log_clock::time_point time) {
+    _filename = daily_rotation::filename(_base_filename, time);
+    if (_codec == compression::zstd)
+      _filename += SPDLOG_FILENAME_T(".zst");
+    else if (_codec == compression::lz4)
+      _filename += SPDLOG_FILENAME_T(".lz4");
+    _rotation_tp = _options.rotation.next(time);
+  }
+
+  // hands the current block to the helper thread, waiting while max_queued blocks are ahead of it
+  void cut() {
+    if (_current.records == 0)
+      return;
+    _current.filename = _filename;
+    std::string next;
+    {
+      std::unique_lock lock(_queue_mutex);
+      _space_cv.wait(lock, [this] { return _queue.size() < _options.max_queued; });
+      _queue.push_back(std::move(_current));
+      if (!_spare.empty()) {
+        next = std::move(_spare.back());
+        _spare.pop_back();
+      }
+    }
+    _queue_cv.notify_one();
+    _current = block{};
+    _current.raw = std::move(next);
+    _current.raw.clear();
+    _current.raw.reserve(_options.block_size + _options.block_size / 8);
+  }
+
+  void run() {
+    std::FILE *file = nullptr;
+    std::FILE *index = nullptr;
+    spdlog::filename_t open_filename;
+    std::string compressed;
+    while (true) {
+      block current;
+      {
+        std::unique_lock lock(_queue_mutex);
+        _queue_cv.wait(lock, [this] { return _closing || !_queue.empty(); });
+        if (_queue.empty())
+          break;
+        current = std::move(_queue.front());
+      }
+
+      try {
+        if (current.filename != open_filename) {
+          close(file, index);
+          open(current.filename, file, index);
+          open_filename = current.filename;
+        }
+        write(current, file, index, compressed);
+      } catch (const std::exception &ex) {
+        std::fprintf(stderr, "*** LOGGER ERROR ***: %s\n", ex.what());
+        close(file, index);
+        open_filename.clear();
+      }
+
+      {
+        std::lock_guard lock(_queue_mutex);
+        _queue.pop_front();
+        if (_spare.size() < _options.max_queued)
+          _spare.push_back(std::move(current.raw));
+      }
+      _space_cv.notify_one();
+    }
+    close(file, index);
+  }
+
+  static void open(const spdlog::filename_t &filename, std::FILE *&file, std::FILE *&index) {
+    spdlog::details::os::create_dir(spdlog::details::os::dir_name(filename));
+    if (spdlog::details::os::fopen_s(&file, filename, SPDLOG_FILENAME_T("ab")) ||
+        spdlog::details::os::fopen_s(&index, index_filename(filename), SPDLOG_FILENAME_T("ab")))
+      spdlog::throw_spdlog_ex("Failed opening file " + spdlog::details::os::filename_to_str(filename), errno);
+    std::fseek(file, 0, SEEK_END);
+  }
+
+  static void close(std::FILE *&file, std::FILE *&index) {
+    if (file != nullptr)
+      std::fclose(file);
+    if (index != nullptr)
+      std::fclose(index);
+    file = nullptr;
+    index = nullptr;
+  }
+
+  void write(const block &current, std::FILE *file, std::FILE *index, std::string &compressed) {
+    const auto begin = clock::now();
+    const std::size_t size = compress(current.raw, compressed);
+    block_report report{size != 0 ? _codec : compression::none, current.records, current.raw.size()};
+    const std::string &frame = size != 0 ? compressed : current.raw;
+    report.compressed_bytes = size != 0 ? size : current.raw.size();
+    report.time = std::chrono::duration_cast<std::chrono::nanoseconds>(clock::now() - begin);
+
+    block_entry entry{current.first_time, current.last_time, static_cast<std::uint64_t>(std::ftell(file)),
+      static_cast<std::uint32_t>(report.compressed_bytes), static_cast<std::uint32_t>(report.raw_bytes), report.codec,
+      {}};
+    if (std::fwrite(frame.data(), 1, report.compressed_bytes, file) != report.compressed_bytes ||
+        std::fflush(file) != 0)
+      spdlog::throw_spdlog_ex("Failed writing to file " + spdlog::details::os::filename_to_str(current.filename), errno);
+    // the entry follows its frame, so the index never points past the data
+    std::fwrite(&entry, sizeof(entry), 1, index);
+    std::fflush(index);
+
+    {
+      std::lock_guard lock(_queue_mutex);
+      ++_stats.blocks;
+      _stats.raw_bytes += report.raw_bytes;
+      _stats.compressed_bytes += report.compressed_bytes;
+      _stats.total_time += report.time;
+      _stats.max_time = std::max(_stats.max_time, report.time);
+      _stats.last = report;
+    }
+    if (_options.on_block)
+      _options.on_block(report);
+  }
+
+  // size of the frame written to out, 0 to store the block uncompressed
+  std::size_t compress([[maybe_unused]] const std::string &raw, [[maybe_unused]] std::string &out) const {
+#if EASY_LOGGER_HAS_ZSTD
+    if (_codec == compression::zstd) {
+      out.resize(ZSTD_compressBound(raw.size()));
+      const std::size_t size = ZSTD_compress(out.data(), out.size(), raw.data(), raw.size(), _options.level);
+      return ZSTD_isError(size) ? 0 : size;
+    }
+#endif
+#if EASY_LOGGER_HAS_LZ4
+    if (_codec == compression::lz4) {
+      out.resize(LZ4F_compressFrameBound(raw.size(), nullptr));
+      const std::size_t size = LZ4F_compressFrame(out.data(), out.size(), raw.data(), raw.size(), nullptr);
+      return LZ4F_isError(size) ? 0 : size;
+    }
+#endif
+    return 0;
+  }
+};
+
+using compressed_file_sink_mt = compressed_file_sink<std::mutex>;
+using compressed_file_sink_st = compressed_file_sink<spdlog::details::null_mutex>;
+
+}  // namespace util::logger
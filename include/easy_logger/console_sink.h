@@ -0,0 +1,189 @@
+//
+//  console_sink.h
+//  inlay
+//
+//  stdout off the hot path: records are formatted into a bounded batch in memory under a short lock and a
+//  writer thread hands each batch to stdout in one write, so a slow pipe (journald, a container runtime)
+//  holds back neither the callers nor the other sinks
+//
+
+#pragma once
+
+#include <spdlog/details/log_msg.h>
+#include <spdlog/details/os.h>
+#include <spdlog/pattern_formatter.h>
+#include <spdlog/sinks/sink.h>
+
+#include <algorithm>
+#include <atomic>
+#include <condition_variable>
+#include <cstddef>
+#include <cstdint>
+#include <cstdio>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <string_view>
+#include <thread>
+
+#include "default_formatter.h"
+
+namespace util::logger {
+
+enum class console_color : std::uint8_t {
+  automatic,  // when stdout is a terminal that takes colors
+  always,
+  never,
+};
+
+struct console_options {
+  bool enabled = true;
+  spdlog::level::level_enum level = spdlog::level::warn;
+  std::size_t buffer_size = 1024ull * 256;  // bytes waiting for stdout, the most one write hands over
+  bool block = false;  // full buffer: callers wait for the writer, otherwise the record is dropped and counted
+  console_color color = console_color::automatic;
+};
+
+class async_console_sink final : public spdlog::sinks::sink {
+ private:
+  std::FILE *_file;
+  std::size_t _capacity;
+  bool _block;
+  bool _color;
+  std::mutex _mutex;
+  std::condition_variable _ready;  // the writer waits for records
+  std::condition_variable _room;   // blocked callers wait for the writer
+  std::unique_ptr<spdlog::formatter> _formatter = std::make_unique<default_formatter>();
+  spdlog::memory_buf_t _pending;  // filled by log(), taken by the writer as a whole
+  std::atomic<std::size_t> _dropped{0};
+  bool _stop = false;
+  std::thread _writer;
+
+ public:
+  explicit async_console_sink(const console_options &options = {}, std::FILE *file = stdout)
+      : _file(file), _capacity(std::max<std::size_t>(options.buffer_size, 1)), _block(options.block) {
+#ifdef _WIN32
+    // the console only takes ANSI sequences once virtual terminal processing is switched on
+    const bool terminal = false;
+#else
+    const bool terminal =
+      spdlog::details::os::in_terminal(_file) && spdlog::details::os::is_color_terminal();
+#endif
+    _color = options.color == console_color::always || (options.color == console_color::automatic && terminal);
+    set_level(options.level);
+    _pending.reserve(_capacity);
+    _writer = std::thread([this] { run(); });
+  }
+
+  ~async_console_sink() override {
+    {
+      std::lock_guard lock(_mutex);
+      _stop = true;
+    }
+    _ready.notify_one();
+    _room.notify_all();
+    _writer.join();
+  }
+
+  async_console_sink(const async_console_sink &) = delete;
+  void operator=(const async_console_sink &) = delete;
+
+  void log(const spdlog::details::log_msg &msg) override {
+    static thread_local spdlog::memory_buf_t record;
+    std::unique_lock lock(_mutex);
+    record.clear();
+    _formatter->format(msg, record);
+    const bool color = _color && msg.color_range_end > msg.color_range_start;
+    const std::size_t size = record.size() + (color ? color_code(msg.level).size() + reset.size() : 0);
+    if (_pending.size() + size > _capacity) {
+      if (!_block || size > _capacity) {
+        _dropped.fetch_add(1, std::memory_order_relaxed);
+        return;
+      }
+      _room.wait(lock, [&] { return _pending.size() + size <= _capacity || _stop; });
+    }
+
+    const bool idle = _pending.size() == 0;
+    if (color) {
+      const char *text = record.data();
+      _pending.append(text, text + msg.color_range_start);
+      append(color_code(msg.level));
+      _pending.append(text + msg.color_range_start, text + msg.color_range_end);
+      append(reset);
+      _pending.append(text + msg.color_range_end, text + record.size());
+    } else {
+      _pending.append(record.data(), record.data() + record.size());
+    }
+    if (idle)
+      _ready.notify_one();
+  }
+
+  // the writer is woken by every first record of a batch, flushing never waits for stdout
+  void flush() override {}
+
+  void set_pattern(const std::string &pattern) override {
+    set_formatter(std::make_unique<spdlog::pattern_formatter>(pattern));
+  }
+
+  void set_formatter(std::unique_ptr<spdlog::formatter> formatter) override {
+    std::lock_guard lock(_mutex);
+    _formatter = std::move(formatter);
+  }
+
+  bool colored() const {
+    return _color;
+  }
+
+  // records that found the buffer full
+  std::size_t dropped_count() const {
+    return _dropped.load(std::memory_order_relaxed);
+  }
+
+ private:
+  static constexpr std::string_view reset = "\033[m";
+
+  // spdlog's ansicolor_sink colors
+  static std::string_view color_code(spdlog::level::level_enum level) {
+    switch (level) {
+      case spdlog::level::trace:
+        return "\033[37m";
+      case spdlog::level::debug:
+        return "\033[36m";
+      case spdlog::level::info:
+        return "\033[32m";
+      case spdlog::level::warn:
+        return "\033[33m\033[1m";
+      case spdlog::level::err:
+        return "\033[31m\033[1m";
+      case spdlog::level::critical:
+        return "\033[1m\033[41m";
+      default:
+        return "";
+    }
+  }
+
+  void append(std::string_view text) {
+    _pending.append(text.data(), text.data() + text.size());
+  }
+
+  // takes everything queued so far and writes it with one fwrite, the lock is released meanwhile
+  void run() {
+    spdlog::memory_buf_t batch;
+    batch.reserve(_capacity);
+    std::unique_lock lock(_mutex);
+    while (true) {
+      _ready.wait(lock, [&] { return _pending.size() != 0 || _stop; });
+      if (_pending.size() == 0)
+        return;
+      std::swap(batch, _pending);
+      _room.notify_all();
+      lock.unlock();
+      std::fwrite(batch.data(), 1, batch.size(), _file);
+      std::fflush(_file);
+      batch.clear();
+      lock.lock();
+    }
+  }
+};
+
+}  // namespace util::logger
@@ -0,0 +1,46 @@
+//
+//  daily_rotation.h
+//  inlay
+//
+//  file naming and rotation time of the daily log files, the same as spdlog's daily_file_sink
+//
+
+#pragma once
+
+#include <spdlog/details/os.h>
+#include <spdlog/sinks/daily_file_sink.h>
+
+#include <chrono>
+#include <ctime>
+
+namespace util::logger {
+
+struct daily_rotation {
+  int hour = 0;  // 00:02, as init() sets up daily_file_sink
+  int minute = 2;
+
+  void validate() const {
+    if (hour < 0 || hour > 23 || minute < 0 || minute > 59)
+      spdlog::throw_spdlog_ex("daily_rotation: Invalid rotation time");
+  }
+
+  static tm local_tm(spdlog::log_clock::time_point tp) {
+    return spdlog::details::os::localtime(spdlog::log_clock::to_time_t(tp));
+  }
+
+  // base "logs/app.log" becomes "logs/app_2025-04-25.log" for records of that day
+  static spdlog::filename_t filename(const spdlog::filename_t &base, spdlog::log_clock::time_point time) {
+    return spdlog::sinks::daily_filename_calculator::calc_filename(base, local_tm(time));
+  }
+
+  spdlog::log_clock::time_point next(spdlog::log_clock::time_point now = spdlog::log_clock::now()) const {
+    tm date = local_tm(now);
+    date.tm_hour = hour;
+    date.tm_min = minute;
+    date.tm_sec = 0;
+    const auto rotation_time = spdlog::log_clock::from_time_t(std::mktime(&date));
+    return rotation_time > now ? rotation_time : rotation_time + std::chrono::hours(24);
+  }
+};
+
+}  // namespace util::logger
@@ -0,0 +1,142 @@
+//
+//  default_formatter.h
+//  inlay
+//
+//  spdlog formatter hardwired to init()'s pattern "%^[%Y-%m-%d %T.%e][%l][%@][%t]:%v%$": the date is
+//  rendered once per second, thread ids once per thread and "file:line" once per call site
+//
+
+#pragma once
+
+#include <spdlog/details/log_msg.h>
+#include <spdlog/details/os.h>
+#include <spdlog/formatter.h>
+
+#include <array>
+#include <charconv>
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <ctime>
+#include <memory>
+#include <string>
+#include <string_view>
+#include <unordered_map>
+
+namespace util::logger {
+
+// every record costs a few memcpys; like spdlog's async path it expects source_loc strings to outlive
+// the formatter, call sites are cached by the address of their file name
+class default_formatter final : public spdlog::formatter {
+ public:
+  static constexpr std::string_view pattern = "%^[%Y-%m-%d %T.%e][%l][%@][%t]:%v%$";
+  static constexpr std::size_t max_sites = 1024ull * 16;  // cached call sites before the cache starts over
+
+ private:
+  struct thread_slot {
+    std::size_t id = ~std::size_t{0};
+    std::uint8_t size = 0;
+    char chars[23];
+  };
+
+  struct site_key {
+    const char *file;
+    int line;
+
+    bool operator==(const site_key &) const = default;
+  };
+
+  struct site_hash {
+    std::size_t operator()(const site_key &key) const {
+      return std::hash<const char *>()(key.file) ^ (static_cast<std::size_t>(key.line) * 0x9e3779b97f4a7c15ull);
+    }
+  };
+
+  std::time_t _second = -1;
+  char _date[21];  // "[YYYY-MM-DD HH:MM:SS." of _second
+  std::array<thread_slot, 64> _threads{};  // direct mapped by id
+  std::unordered_map<site_key, std::string, site_hash> _sites;  // "file:line"
+
+ public:
+  void format(const spdlog::details::log_msg &msg, spdlog::memory_buf_t &dest) override {
+    using namespace std::chrono;
+    const auto since_epoch = msg.time.time_since_epoch();
+    const auto second = duration_cast<seconds>(since_epoch);
+    if (second.count() != _second)
+      render_date(second.count());
+    const auto millis = static_cast<unsigned>(duration_cast<milliseconds>(since_epoch - second).count());
+
+    msg.color_range_start = dest.size();
+    append(dest, _date, sizeof(_date));
+    const char fraction[] = {static_cast<char>('0' + millis / 100), static_cast<char>('0' + millis / 10 % 10),
+      static_cast<char>('0' + millis % 10), ']', '['};
+    append(dest, fraction, sizeof(fraction));
+
+    const auto level = spdlog::level::to_string_view(msg.level);
+    append(dest, level.data(), level.size());
+    append(dest, "][", 2);
+
+    if (!msg.source.empty()) {
+      const std::string &site = render_site(msg.source);
+      append(dest, site.data(), site.size());
+    }
+    append(dest, "][", 2);
+
+    const thread_slot &thread = render_thread(msg.thread_id);
+    append(dest, thread.chars, thread.size);
+    append(dest, "]:", 2);
+
+    append(dest, msg.payload.data(), msg.payload.size());
+    msg.color_range_end = dest.size();
+    append(dest, spdlog::details::os::default_eol, std::char_traits<char>::length(spdlog::details::os::default_eol));
+  }
+
+  std::unique_ptr<spdlog::formatter> clone() const override {
+    return std::make_unique<default_formatter>();
+  }
+
+ private:
+  static void append(spdlog::memory_buf_t &dest, const char *data, std::size_t size) {
+    dest.append(data, data + size);
+  }
+
+  void render_date(std::time_t second) {
+    const std::tm tm = spdlog::details::os::localtime(second);
+    const auto put = [](char *out, int value, int digits) {
+      for (int i = digits - 1; i >= 0; --i, value /= 10)
+        out[i] = static_cast<char>('0' + value % 10);
+    };
+    std::memcpy(_date, "[0000-00-00 00:00:00.", sizeof(_date));
+    put(_date + 1, tm.tm_year + 1900, 4);
+    put(_date + 6, tm.tm_mon + 1, 2);
+    put(_date + 9, tm.tm_mday, 2);
+    put(_date + 12, tm.tm_hour, 2);
+    put(_date + 15, tm.tm_min, 2);
+    put(_date + 18, tm.tm_sec, 2);
+    _second = second;
+  }
+
+  const thread_slot &render_thread(std::size_t id) {
+    thread_slot &slot = _threads[id % _threads.size()];
+    if (slot.id != id) {
+      slot.id = id;
+      slot.size = static_cast<std::uint8_t>(std::to_chars(slot.chars, slot.chars + sizeof(slot.chars), id).ptr -
+                                            slot.chars);
+    }
+    return slot;
+  }
+
+  const std::string &render_site(const spdlog::source_loc &source) {
+    const site_key key{source.filename, source.line};
+    auto it = _sites.find(key);
+    if (it == _sites.end()) {
+      if (_sites.size() >= max_sites)
+        _sites.clear();
+      it = _sites.emplace(key, std::string(source.filename) + ':' + std::to_string(source.line)).first;
+    }
+    return it->second;
+  }
+};
+
+}  // namespace util::logger
@@ -0,0 +1,446 @@
+//
+//  deferred.h
+//  inlay
+//
+//  deferred formatting: callers copy the site id and raw arguments into a
+//  per-thread ring buffer, a single backend thread formats and writes them
+//
+
+#pragma once
+
+#include <spdlog/details/log_msg.h>
+#include <spdlog/details/os.h>
+#include <spdlog/logger.h>
+
+#include <algorithm>
+#include <atomic>
+#include <bit>
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <exception>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <string_view>
+#include <thread>
+#include <vector>
+
+#include "arg_codec.h"
+#include "binary_log.h"
+#include "site.h"
+#include "spsc_ring.h"
+#include "telemetry.h"
+#include "tsc_clock.h"
+
+namespace util::logger::deferred {
+
+struct record_header {
+  std::uint32_t size;  // header + arguments, aligned, 0 is the ring's wrap marker
+  std::uint32_t site_id;
+  std::int64_t time;  // tsc_clock stamp
+  std::size_t thread_id;
+};
+
+static_assert(alignof(record_header) <= spsc_ring::record_align);
+
+// a record too large for the ring, or of a site the registry had no room for, waits on the heap; the ring
+// holds a record of this site id whose argument is the indirect_record pointer, so the backend still writes
+// it in timestamp order
+constexpr std::uint32_t indirect_site_id = invalid_site_id - 1;
+
+struct indirect_record {
+  site_info info;
+  std::unique_ptr<std::byte[]> record;  // header and arguments, as they would be in the ring
+};
+
+static_assert(site_registry::max_sites < indirect_site_id);
+static_assert(sizeof(record_header) % codec::object_align == 0 && spsc_ring::record_align % codec::object_align == 0,
+  "objects in a record's arguments are aligned from its start");
+
+// what the backend does when every ring is empty
+enum class idle_strategy : uint8_t {
+  spin,   // busy poll, lowest latency, burns a core
+  yield,  // give up the time slice between polls
+  sleep,  // yield for a few rounds, then sleep for idle_sleep
+};
+
+struct backend_options {
+  std::size_t thread_buffer_size = 1024ull * 256;  // per producer thread, rounded up to a power of two
+  idle_strategy idle = idle_strategy::sleep;
+  std::chrono::microseconds idle_sleep{100};
+  bool tsc = true;  // stamp records with the CPU's tick counter when it is invariant, see tsc_clock.h
+  std::chrono::milliseconds calibration_interval{1000};  // how often the backend recalibrates ticks to wall time
+};
+
+class backend {
+ private:
+  std::mutex _mutex;
+  std::vector<std::shared_ptr<spsc_ring>> _buffers;
+  std::atomic<std::size_t> _buffers_version{0};
+  std::shared_ptr<spdlog::logger> _logger;
+  std::shared_ptr<binary::writer> _binary;
+  std::thread _thread;
+  std::atomic_bool _running{false};  // producers may push
+  std::atomic_bool _stopping{false};  // the thread exits once the rings are drained
+  backend_options _options;
+  bool _block = true;
+  std::atomic<std::size_t> _dropped{0};
+
+  // closes the ring when its thread exits, the backend drains and frees it afterwards
+  struct buffer_holder {
+    std::shared_ptr<spsc_ring> ring;
+
+    ~buffer_holder() {
+      if (ring)
+        ring->close();
+    }
+  };
+
+ public:
+  static backend &get() {
+    static backend instance;
+    return instance;
+  }
+
+  // block: callers wait for room when their ring is full, otherwise the message is dropped and counted;
+  // with a binary writer every record is also stored in binary form, the logger's sinks still get the text
+  void start(std::shared_ptr<spdlog::logger> logger, const backend_options &options, bool block,
+    std::shared_ptr<binary::writer> binary = nullptr) {
+    if (_running.exchange(true))
+      return;
+    _logger = std::move(logger);
+    _binary = std::move(binary);
+    _options = options;
+    _block = block;
+    _stopping.store(false, std::memory_order_relaxed);
+    tsc_clock::get().enable(options.tsc);
+    _thread = std::thread([this] { run(); });
+  }
+
+  // drains every buffer before returning; pushes that saw the backend running are waited for and written,
+  // later ones are dropped
+  void stop() {
+    if (!_running.exchange(false))
+      return;
+    std::vector<std::shared_ptr<spsc_ring>> buffers;
+    {
+      std::lock_guard lock(_mutex);
+      buffers = _buffers;
+    }
+    // the backend keeps consuming meanwhile, a producer waiting for room gets it
+    for (const auto &ring : buffers) {
+      while (ring->busy())
+        std::this_thread::yield();
+    }
+    _stopping.store(true, std::memory_order_release);
+    if (_thread.joinable())
+      _thread.join();
+    _logger.reset();
+    _binary.reset();
+  }
+
+  // sequentially consistent, see spsc_ring::enter
+  bool running() const {
+    return _running.load();
+  }
+
+  bool block() const {
+    return _block;
+  }
+
+  // bytes per producer ring, as spsc_ring rounds it
+  std::size_t buffer_capacity() const {
+    return std::max<std::size_t>(std::bit_ceil(_options.thread_buffer_size), 64);
+  }
+
+  std::size_t dropped_count() const {
+    return _dropped.load(std::memory_order_relaxed);
+  }
+
+  void add_dropped() {
+    _dropped.fetch_add(1, std::memory_order_relaxed);
+  }
+
+  // calls fn(header, args, end) for every record still queued, oldest first per ring; meant for crash dumps,
+  // so it gives up when the ring list is locked instead of waiting
+  template <typename fn_tt>
+  bool visit_pending(fn_tt &&fn) {
+    std::unique_lock lock(_mutex, std::try_to_lock);
+    if (!lock.owns_lock())
+      return false;
+    for (const auto &ring : _buffers) {
+      ring->peek([&](const std::byte *record, std::size_t size) {
+        if (size >= sizeof(record_header))
+          fn(*reinterpret_cast<const record_header *>(record), record + sizeof(record_header), record + size);
+      });
+    }
+    return true;
+  }
+
+  // lazily created on the first deferred log call of each thread
+  spsc_ring &local_buffer() {
+    static thread_local buffer_holder holder;
+    if (!holder.ring) {
+      holder.ring = std::make_shared<spsc_ring>(_options.thread_buffer_size);
+      std::lock_guard lock(_mutex);
+      _buffers.push_back(holder.ring);
+      _buffers_version.fetch_add(1, std::memory_order_release);
+    }
+    return *holder.ring;
+  }
+
+  // formats one record and hands it to the logger's sinks
+  void write(const site_info &info, const record_header &header, spdlog::memory_buf_t &payload) {
+    const log_site &site = *info.site;
+    const auto *args = reinterpret_cast<const std::byte *>(&header + 1);
+    const auto time = tsc_clock::get().to_time(header.time);
+    if (_binary && header.site_id != invalid_site_id) {
+      try {
+        _binary->write(info, header.site_id, time, header.thread_id, args);
+        if (site.level >= _logger->flush_level())
+          _binary->flush();
+      } catch (const std::exception &ex) {
+        std::fprintf(stderr, "*** LOGGER ERROR ***: %s\n", ex.what());
+      }
+    }
+
+    const auto &sinks = _logger->sinks();
+    if (std::none_of(sinks.begin(), sinks.end(), [&](auto &sink) { return sink->should_log(site.level); }))
+      return;
+
+    payload.clear();
+    try {
+      info.format(site, args, payload);
+    } catch (const std::exception &ex) {
+      payload.clear();
+      constexpr std::string_view prefix = "*** LOGGER ERROR ***: ";
+      payload.append(prefix.data(), prefix.data() + prefix.size());
+      payload.append(ex.what(), ex.what() + std::strlen(ex.what()));
+    }
+
+    spdlog::details::log_msg msg(
+      time, site.loc(), _logger->name(), site.level, spdlog::string_view_t(payload.data(), payload.size()));
+    msg.thread_id = header.thread_id;
+    // a throwing sink must not end the backend thread, the other sinks still get the record
+    for (auto &sink : sinks) {
+      if (sink->should_log(msg.level))
+        guarded([&] { sink->log(msg); });
+    }
+    if (msg.level >= _logger->flush_level()) {
+      for (auto &sink : sinks)
+        guarded([&] { sink->flush(); });
+    }
+  }
+
+ private:
+  backend() = default;
+  ~backend() {
+    stop();
+  }
+
+  backend(const backend &) = delete;
+  void operator=(const backend &) = delete;
+
+  template <typename fn_tt>
+  static void guarded(fn_tt &&fn) {
+    try {
+      fn();
+    } catch (const std::exception &ex) {
+      std::fprintf(stderr, "*** LOGGER ERROR ***: %s\n", ex.what());
+    } catch (...) {
+      std::fprintf(stderr, "*** LOGGER ERROR ***: unknown sink exception\n");
+    }
+  }
+
+  struct pending {
+    std::int64_t time;
+    spsc_ring *ring;
+
+    bool operator>(const pending &other) const {
+      return time > other.time;
+    }
+  };
+
+  static const record_header *front(spsc_ring &ring) {
+    return reinterpret_cast<const record_header *>(ring.front());
+  }
+
+  // merges the heads of all rings in timestamp order, records newer than the start of the
+  // round wait for the next one so a busy producer cannot starve the others
+  std::size_t poll(std::vector<std::shared_ptr<spsc_ring>> &buffers, std::vector<pending> &heap,
+    spdlog::memory_buf_t &payload) {
+    const auto &sites = site_registry::get();
+    const auto cutoff = tsc_clock::get().now();
+    heap.clear();
+    for (auto &buffer : buffers) {
+      if (const auto *header = front(*buffer); header && header->time <= cutoff)
+        heap.push_back({header->time, buffer.get()});
+    }
+    std::make_heap(heap.begin(), heap.end(), std::greater<>{});
+
+    std::size_t count = 0;
+    while (!heap.empty()) {
+      std::pop_heap(heap.begin(), heap.end(), std::greater<>{});
+      spsc_ring &ring = *heap.back().ring;
+      heap.pop_back();
+
+      const auto *header = front(ring);
+      if (header->site_id == indirect_site_id) {
+        indirect_record *indirect;
+        std::memcpy(&indirect, header + 1, sizeof(indirect));
+        const std::unique_ptr<indirect_record> owned(indirect);
+        consume(owned->info, *reinterpret_cast<const record_header *>(owned->record.get()), payload);
+      } else {
+        consume(sites[header->site_id], *header, payload);
+      }
+      ring.pop(header->size);
+      ++count;
+
+      if (const auto *next = front(ring); next && next->time <= cutoff) {
+        heap.push_back({next->time, &ring});
+        std::push_heap(heap.begin(), heap.end(), std::greater<>{});
+      }
+    }
+    return count;
+  }
+
+  void consume(const site_info &info, const record_header &header, spdlog::memory_buf_t &payload) {
+    write(info, header, payload);
+    if (info.release)
+      info.release(reinterpret_cast<const std::byte *>(&header + 1));
+  }
+
+  // frees the rings of exited threads once they are drained
+  void reclaim(std::vector<std::shared_ptr<spsc_ring>> &buffers) {
+    const auto done = [](const std::shared_ptr<spsc_ring> &ring) { return ring->closed() && !ring->front(); };
+    if (std::none_of(buffers.begin(), buffers.end(), done))
+      return;
+    std::lock_guard lock(_mutex);
+    std::erase_if(_buffers, done);
+    buffers = _buffers;
+    _buffers_version.fetch_add(1, std::memory_order_release);
+  }
+
+  void idle(std::size_t &rounds) const {
+    switch (_options.idle) {
+      case idle_strategy::spin:
+        break;
+      case idle_strategy::yield:
+        std::this_thread::yield();
+        break;
+      case idle_strategy::sleep:
+        if (++rounds < 64)
+          std::this_thread::yield();
+        else
+          std::this_thread::sleep_for(_options.idle_sleep);
+        break;
+    }
+  }
+
+  void run() {
+    std::vector<std::shared_ptr<spsc_ring>> buffers;
+    std::vector<pending> heap;
+    std::size_t version = ~std::size_t{0};
+    std::size_t idle_rounds = 0;
+    bool unflushed = false;
+    auto next_calibration = std::chrono::steady_clock::now() + _options.calibration_interval;
+    spdlog::memory_buf_t payload;
+    while (true) {
+      const bool running = !_stopping.load(std::memory_order_acquire);
+      if (const auto current = _buffers_version.load(std::memory_order_acquire); current != version) {
+        std::lock_guard lock(_mutex);
+        buffers = _buffers;
+        version = current;
+      }
+      if (const auto now = std::chrono::steady_clock::now(); now >= next_calibration) {
+        tsc_clock::get().calibrate();
+        next_calibration = now + _options.calibration_interval;
+      }
+      if (poll(buffers, heap, payload) != 0) {
+        idle_rounds = 0;
+        unflushed = true;
+        continue;
+      }
+      if (unflushed && _binary) {
+        // the binary file is written in large chunks, hand them to the OS whenever the backend catches up
+        guarded([&] { _binary->flush(); });
+        unflushed = false;
+      }
+      reclaim(buffers);
+      if (!running) {
+        // the cutoff may have held back records stamped during the last round
+        if (std::none_of(buffers.begin(), buffers.end(), [](auto &ring) { return ring->front() != nullptr; }))
+          break;
+        continue;
+      }
+      idle(idle_rounds);
+    }
+  }
+};
+
+// the record's size, 0 when it was dropped; objects among the values are moved into the record
+template <typename... wire_tt>
+std::size_t push(site_slot &slot, std::string_view signature, format_fn format, release_fn release,
+  wire_tt &&...values) {
+  auto &instance = backend::get();
+  auto &buffer = instance.local_buffer();
+  buffer.enter();
+  const struct leave_guard {
+    spsc_ring &ring;
+    ~leave_guard() {
+      ring.leave();
+    }
+  } guard{buffer};
+  if (!instance.running()) {
+    instance.add_dropped();
+    return 0;
+  }
+
+  const std::size_t size = spsc_ring::align_up(sizeof(record_header) + codec::encoded_size(values...));
+  const record_header header{static_cast<std::uint32_t>(size), site_id(slot, signature, format, release),
+    tsc_clock::get().now(), spdlog::details::os::thread_id()};
+  const bool indirect = size > buffer.capacity() / 2 || header.site_id == invalid_site_id;
+  const std::size_t slot_size =
+    indirect ? spsc_ring::align_up(sizeof(record_header) + sizeof(indirect_record *)) : size;
+
+  std::byte *out;
+  while ((out = buffer.prepare(slot_size)) == nullptr) {
+    if (!instance.block() || !instance.running()) {
+      instance.add_dropped();
+      return 0;
+    }
+    std::this_thread::yield();
+  }
+
+  if (indirect) {
+    auto record = std::make_unique<indirect_record>(
+      indirect_record{{&slot.site, signature, format, release}, std::make_unique<std::byte[]>(size)});
+    std::memcpy(record->record.get(), &header, sizeof(header));
+    codec::encode(record->record.get() + sizeof(header), std::forward<wire_tt>(values)...);
+    const record_header marker{static_cast<std::uint32_t>(slot_size), indirect_site_id, header.time, header.thread_id};
+    indirect_record *pointer = record.release();
+    std::memcpy(out, &marker, sizeof(marker));
+    std::memcpy(out + sizeof(marker), &pointer, sizeof(pointer));
+  } else {
+    std::memcpy(out, &header, sizeof(header));
+    codec::encode(out + sizeof(header), std::forward<wire_tt>(values)...);
+  }
+  buffer.commit(slot_size);
+  // the ring's fill reads the consumer's cache line, it is sampled every 16th record and only for telemetry
+  if (telemetry::collector::enabled()) {
+    static thread_local std::uint32_t pushed = 0;
+    if (++pushed % 16 == 0)
+      telemetry::queue_depth(buffer.size());
+  }
+  return size;
+}
+
+// PRINT_*, the finished message; LOG_*, STM_* and KV_* records are pushed by easy_logger::emit
+inline std::size_t log_text(site_slot &slot, std::string_view text) {
+  return push(slot, codec::signature<std::string_view>::sv, &codec::format_text, nullptr, text);
+}
+
+}  // namespace util::logger::deferred
@@ -0,0 +1,535 @@
+//
+//  flight_recorder.h
+//  inlay
+//
+//  in-memory history of the sites the log level hides: every thread keeps overwriting a fixed ring of small
+//  binary records, dumped in the binary log format (read with easy_logger_decode) on a fatal signal,
+//  a critical record or request
+//
+
+#pragma once
+
+#include <spdlog/common.h>
+#include <spdlog/details/os.h>
+
+#include <algorithm>
+#include <array>
+#include <atomic>
+#include <cerrno>
+#include <chrono>
+#include <csignal>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <string_view>
+#include <type_traits>
+
+#ifdef _WIN32
+#include <fcntl.h>
+#include <io.h>
+#include <sys/stat.h>
+#else
+#include <fcntl.h>
+#include <unistd.h>
+#endif
+
+#include "arg_codec.h"
+#include "binary_log.h"
+#include "deferred.h"
+#include "kv_encoding.h"
+#include "site.h"
+#include "tsc_clock.h"
+
+namespace util::logger {
+
+struct flight_options {
+  bool enabled = false;
+  // sites at or above it are recorded, shown or not; at or below the log level, the rings also hold what an
+  // async (not deferred) logger still has queued, the dump cannot read spdlog's queue itself
+  spdlog::level::level_enum level = spdlog::level::trace;
+  std::size_t records_per_thread = 1024;  // ring size, rounded up to a power of two, 256 bytes per record
+  std::string path;             // dumps are appended here, empty: "<log filename>.flight"
+  bool dump_on_signal = true;   // SIGSEGV, SIGBUS, SIGFPE, SIGILL and SIGABRT, then the previous handler runs
+  bool dump_on_critical = true;  // after each critical LOG_*/PRINT_*/STM_* record
+};
+
+namespace flight {
+
+// written by its thread only; the sequence is odd while the slot is written, so a dump taken
+// meanwhile skips it rather than reading half a record
+struct slot {
+  static constexpr std::size_t size = 256;
+
+  std::atomic<std::uint64_t> sequence{0};
+  deferred::record_header header{};
+  alignas(8) std::byte args[size - 8 - sizeof(deferred::record_header)];
+};
+
+static_assert(sizeof(slot) == slot::size);
+
+namespace detail {
+
+template <typename wire_tt>
+wire_tt clip(const wire_tt &value, [[maybe_unused]] std::size_t limit) {
+  if constexpr (std::is_same_v<wire_tt, std::string_view>)
+    return value.substr(0, limit);
+  else
+    return value;
+}
+
+// the dump's buffer, never allocates: written to fd when full, or marked as overflowed without one
+class fixed_buffer {
+ private:
+  char *_data;
+  std::size_t _capacity;
+  int _fd;
+  std::size_t _size = 0;
+  bool _overflow = false;
+
+ public:
+  fixed_buffer(char *data, std::size_t capacity, int fd = -1) : _data(data), _capacity(capacity), _fd(fd) {}
+
+  const char *data() const {
+    return _data;
+  }
+
+  std::size_t size() const {
+    return _size;
+  }
+
+  bool overflow() const {
+    return _overflow;
+  }
+
+  void push_back(char c) {
+    append(&c, &c + 1);
+  }
+
+  void append(const char *first, const char *last) {
+    while (first != last) {
+      if (_size == _capacity) {
+        if (_fd < 0) {
+          _overflow = true;
+          return;
+        }
+        flush();
+      }
+      const auto count = std::min<std::size_t>(static_cast<std::size_t>(last - first), _capacity - _size);
+      std::memcpy(_data + _size, first, count);
+      _size += count;
+      first += count;
+    }
+  }
+
+  // write(2) only, safe in a signal handler
+  void flush() {
+    for (std::size_t done = 0; done < _size;) {
+#ifdef _WIN32
+      const auto count = ::_write(_fd, _data + done, static_cast<unsigned>(_size - done));
+#else
+      const auto count = ::write(_fd, _data + done, _size - done);
+#endif
+      if (count < 0 && errno == EINTR)
+        continue;
+      if (count <= 0)
+        break;
+      done += static_cast<std::size_t>(count);
+    }
+    _size = 0;
+  }
+};
+
+inline int open_append(const char *path) {
+#ifdef _WIN32
+  return ::_open(path, _O_WRONLY | _O_CREAT | _O_APPEND | _O_BINARY, _S_IREAD | _S_IWRITE);
+#else
+  return ::open(path, O_WRONLY | O_CREAT | O_APPEND | O_CLOEXEC, 0644);
+#endif
+}
+
+inline void close_fd(int fd) {
+#ifdef _WIN32
+  ::_close(fd);
+#else
+  ::close(fd);
+#endif
+}
+
+}  // namespace detail
+
+class ring {
+ private:
+  std::unique_ptr<slot[]> _slots;
+  std::size_t _mask;
+  std::atomic<std::uint64_t> _next{0};
+
+ public:
+  std::atomic_bool owned{true};  // a thread writes it, released when the thread exits
+
+  explicit ring(std::size_t records) {
+    std::size_t capacity = 2;
+    while (capacity < records)
+      capacity <<= 1;
+    _slots = std::make_unique<slot[]>(capacity);
+    _mask = capacity - 1;
+  }
+
+  ring(const ring &) = delete;
+  void operator=(const ring &) = delete;
+
+  // strings are cut short when the arguments do not fit a slot
+  template <typename... wire_tt>
+  void push(std::uint32_t site_id, const wire_tt &...values) {
+    constexpr std::size_t capacity = sizeof(slot::args);
+    constexpr std::size_t strings = (std::size_t{0} + ... + std::is_same_v<wire_tt, std::string_view>);
+    std::size_t size = codec::encoded_size(values...);
+    [[maybe_unused]] std::size_t limit = SIZE_MAX;
+    if (size > capacity) {
+      const std::size_t fixed = codec::encoded_size(detail::clip(values, 0)...);
+      if (strings == 0 || fixed > capacity)
+        return;
+      limit = (capacity - fixed) / strings;
+      size = codec::encoded_size(detail::clip(values, limit)...);
+    }
+
+    const std::uint64_t index = _next.load(std::memory_order_relaxed);
+    slot &target = _slots[index & _mask];
+    target.sequence.store(index * 2 + 1, std::memory_order_relaxed);
+    std::atomic_thread_fence(std::memory_order_release);
+    target.header = {static_cast<std::uint32_t>(sizeof(deferred::record_header) + size), site_id,
+      tsc_clock::get().now(), spdlog::details::os::thread_id()};
+    codec::encode(target.args, detail::clip(values, limit)...);
+    target.sequence.store(index * 2 + 2, std::memory_order_release);
+    _next.store(index + 1, std::memory_order_release);
+  }
+
+  // calls fn(header, args, end) for the records in the ring, oldest first; each is copied out and checked
+  // against its sequence afterwards, slots rewritten meanwhile are skipped
+  template <typename fn_tt>
+  void visit(fn_tt &&fn) const {
+    const std::uint64_t next = _next.load(std::memory_order_acquire);
+    const std::uint64_t capacity = _mask + 1;
+    deferred::record_header header;
+    alignas(8) std::byte args[sizeof(slot::args)];
+    for (std::uint64_t index = next > capacity ? next - capacity : 0; index < next; ++index) {
+      const slot &source = _slots[index & _mask];
+      const auto sequence = source.sequence.load(std::memory_order_acquire);
+      if (sequence != index * 2 + 2)
+        continue;
+      std::memcpy(&header, &source.header, sizeof(header));
+      std::memcpy(args, source.args, sizeof(args));
+      std::atomic_thread_fence(std::memory_order_acquire);
+      if (source.sequence.load(std::memory_order_relaxed) != sequence || header.size < sizeof(header) ||
+          header.size - sizeof(header) > sizeof(args))
+        continue;
+      fn(header, static_cast<const std::byte *>(args), args + (header.size - sizeof(header)));
+    }
+  }
+};
+
+class recorder {
+ public:
+  static constexpr std::size_t max_threads = 1024;  // rings, reused after their threads exit
+  static constexpr std::size_t buffer_size = 1024ull * 64;
+#ifdef _WIN32
+  static constexpr std::array<int, 4> signals{SIGSEGV, SIGFPE, SIGILL, SIGABRT};
+#else
+  static constexpr std::array<int, 5> signals{SIGSEGV, SIGBUS, SIGFPE, SIGILL, SIGABRT};
+#endif
+
+ private:
+  static inline std::atomic<spdlog::level::level_enum> _threshold{spdlog::level::off};
+  static inline std::atomic_bool _dump_on_critical{false};
+
+  std::mutex _mutex;
+  std::array<std::atomic<ring *>, max_threads> _rings{};
+  std::atomic<std::size_t> _ring_count{0};
+  std::size_t _records = 1024;
+  std::string _path;
+  // allocated up front, a signal handler cannot
+  std::unique_ptr<char[]> _out;
+  std::unique_ptr<char[]> _packed;
+  std::atomic_flag _dumping;
+  bool _handlers = false;
+#ifdef _WIN32
+  std::array<void (*)(int), signals.size()> _previous{};
+#else
+  std::array<struct sigaction, signals.size()> _previous{};
+#endif
+
+  struct ring_holder {
+    ring *value = nullptr;
+    bool full = false;  // no ring left for this thread
+
+    ~ring_holder() {
+      if (value != nullptr)
+        value->owned.store(false, std::memory_order_release);
+    }
+  };
+
+ public:
+  static recorder &get() {
+    static recorder instance;
+    return instance;
+  }
+
+  // the macros' check, a relaxed load
+  static bool records(spdlog::level::level_enum lvl) {
+    return lvl >= _threshold.load(std::memory_order_relaxed);
+  }
+
+  static spdlog::level::level_enum level() {
+    return _threshold.load(std::memory_order_relaxed);
+  }
+
+  void start(const flight_options &options, std::string path) {
+    std::lock_guard lock(_mutex);
+    _records = std::max<std::size_t>(options.records_per_thread, 2);
+    _path = std::move(path);
+    if (!_out) {
+      _out = std::make_unique<char[]>(buffer_size);
+      _packed = std::make_unique<char[]>(buffer_size);
+    }
+    if (options.dump_on_signal && !_handlers)
+      install();
+    _dump_on_critical.store(options.dump_on_critical, std::memory_order_relaxed);
+    _threshold.store(options.level, std::memory_order_relaxed);
+  }
+
+  // recording stops and the previous signal handlers come back, the rings are kept
+  void stop() {
+    std::lock_guard lock(_mutex);
+    _threshold.store(spdlog::level::off, std::memory_order_relaxed);
+    _dump_on_critical.store(false, std::memory_order_relaxed);
+    if (_handlers) {
+      for (std::size_t i = 0; i < signals.size(); ++i)
+        restore(i);
+      _handlers = false;
+    }
+  }
+
+  // release as for the deferred backend's records of the site, this ring never holds objects
+  template <typename... wire_tt>
+  void record(site_slot &slot, std::string_view signature, format_fn format, release_fn release,
+    const wire_tt &...values) {
+    const auto id = site_id(slot, signature, format, release);
+    if (id == invalid_site_id)
+      return;
+    if (ring *local = local_ring())
+      local->push(id, values...);
+  }
+
+  void on_critical() {
+    if (_dump_on_critical.load(std::memory_order_relaxed))
+      dump();
+  }
+
+  // appends the rings, oldest record first per thread, then the records the deferred backend has not written
+  // yet that the rings lack (spdlog's async queue is not read, see flight_options::level); async-signal-safe:
+  // fixed buffers, open/write/close and no locks but a try_lock of the backend's ring list; false while another
+  // dump runs or when the file cannot be opened
+  bool dump() {
+    if (!_out || _dumping.test_and_set(std::memory_order_acquire))
+      return false;
+    const int fd = detail::open_append(_path.c_str());
+    if (fd < 0) {
+      _dumping.clear(std::memory_order_release);
+      return false;
+    }
+
+    detail::fixed_buffer out(_out.get(), buffer_size, fd);
+    out.append(binary::magic, binary::magic + sizeof(binary::magic));
+    out.push_back(static_cast<char>(binary::version));
+    out.push_back(static_cast<char>(binary::frame::time));
+    binary::put_varint(out, 0);
+
+    const auto &sites = site_registry::get();
+    const std::uint32_t site_count = sites.size();
+    for (std::uint32_t id = 0; id < site_count; ++id) {
+      if (sites[id].site != nullptr)
+        binary::put_site(out, id, sites[id]);
+    }
+
+    std::int64_t last = 0;
+    const auto write = [&](const deferred::record_header &header, const std::byte *args, const std::byte *end,
+                         bool queued) {
+      if (header.site_id >= site_count || sites[header.site_id].site == nullptr)
+        return;
+      const site_info &info = sites[header.site_id];
+      // queued records the rings hold as well are written once
+      if (queued && records(info.site->level))
+        return;
+      const bool text = binary::text_layout(info);
+      // a queued record of a user type holds its raw bytes, only its formatter can read them
+      if (queued && text && info.format != &codec::format_text)
+        return;
+      const std::string_view signature = text ? "s" : info.signature;
+      if (!binary::encoded_fits(signature, args, end))
+        return;
+      detail::fixed_buffer packed(_packed.get(), buffer_size);
+      binary::pack(signature, args, packed);
+      if (packed.overflow())
+        return;
+
+      const auto time = std::chrono::duration_cast<std::chrono::nanoseconds>(
+        tsc_clock::get().to_time(header.time).time_since_epoch()).count();
+      out.push_back(static_cast<char>(binary::frame::record));
+      binary::put_varint(out, header.site_id);
+      binary::put_varint(out, binary::zigzag(time - last));
+      binary::put_varint(out, header.thread_id);
+      binary::put_varint(out, packed.size());
+      out.append(packed.data(), packed.data() + packed.size());
+      last = time;
+    };
+
+    const auto count = _ring_count.load(std::memory_order_acquire);
+    for (std::size_t i = 0; i < count; ++i) {
+      _rings[i].load(std::memory_order_acquire)->visit(
+        [&](const auto &header, const std::byte *args, const std::byte *end) { write(header, args, end, false); });
+    }
+    deferred::backend::get().visit_pending(
+      [&](const auto &header, const std::byte *args, const std::byte *end) { write(header, args, end, true); });
+
+    out.flush();
+    detail::close_fd(fd);
+    _dumping.clear(std::memory_order_release);
+    return true;
+  }
+
+ private:
+  recorder() = default;
+  ~recorder() = default;
+
+  recorder(const recorder &) = delete;
+  void operator=(const recorder &) = delete;
+
+  ring *local_ring() {
+    static thread_local ring_holder holder;
+    if (holder.value == nullptr && !holder.full) {
+      holder.value = acquire_ring();
+      holder.full = holder.value == nullptr;
+    }
+    return holder.value;
+  }
+
+  ring *acquire_ring() {
+    const auto count = _ring_count.load(std::memory_order_acquire);
+    for (std::size_t i = 0; i < count; ++i) {
+      ring *candidate = _rings[i].load(std::memory_order_acquire);
+      bool owned = false;
+      if (candidate->owned.compare_exchange_strong(owned, true, std::memory_order_acquire))
+        return candidate;
+    }
+    std::lock_guard lock(_mutex);
+    const auto index = _ring_count.load(std::memory_order_relaxed);
+    if (index >= max_threads)
+      return nullptr;
+    // never freed, a dump may read any ring at any time
+    auto *created = new ring(_records);
+    _rings[index].store(created, std::memory_order_release);
+    _ring_count.store(index + 1, std::memory_order_release);
+    return created;
+  }
+
+#ifdef _WIN32
+  static void on_signal(int signal) {
+#else
+  static void on_signal(int signal, siginfo_t *, void *) {
+#endif
+    auto &self = get();
+    self.dump();
+    for (std::size_t i = 0; i < signals.size(); ++i) {
+      if (signals[i] == signal)
+        self.restore(i);
+    }
+    std::raise(signal);
+  }
+
+  void install() {
+    for (std::size_t i = 0; i < signals.size(); ++i) {
+#ifdef _WIN32
+      _previous[i] = std::signal(signals[i], &on_signal);
+#else
+      struct sigaction action {};
+      action.sa_sigaction = &on_signal;
+      action.sa_flags = SA_SIGINFO;
+      sigemptyset(&action.sa_mask);
+      sigaction(signals[i], &action, &_previous[i]);
+#endif
+    }
+    _handlers = true;
+  }
+
+  void restore(std::size_t index) {
+#ifdef _WIN32
+    std::signal(signals[index], _previous[index] != SIG_ERR ? _previous[index] : SIG_DFL);
+#else
+    sigaction(signals[index], &_previous[index], nullptr);
+#endif
+  }
+};
+
+// whether the ring keeps the arguments themselves rather than the message
+template <typename... args_tt>
+inline constexpr bool captures_raw_v =
+  codec::deferrable_v<args_tt...> && codec::signature<args_tt...>::sv.find('x') == std::string_view::npos;
+
+// LOG_*: raw arguments like the deferred backend, formatted now when a type cannot be captured
+// or only its formatter can read it
+template <typename... args_tt>
+void log(site_slot &slot, const args_tt &...args) {
+  constexpr auto signature = codec::signature<args_tt...>::sv;
+  constexpr auto format = codec::formatter_for<args_tt...>();
+  constexpr auto release = codec::release_for<args_tt...>();
+  if constexpr (captures_raw_v<args_tt...>) {
+    recorder::get().record(slot, signature, format, release, codec::to_wire(args)...);
+  } else {
+    scratch_buffer text;
+    format_compiled(slot.site.compiled, slot.site.fmt, text.get(), args...);
+    recorder::get().record(
+      slot, signature, format, release, std::string_view(text.get().data(), text.get().size()));
+  }
+}
+
+// STM_*
+template <typename... args_tt>
+void log_fields(site_slot &slot, const args_tt &...args) {
+  constexpr auto signature = codec::signature<args_tt...>::sv;
+  constexpr auto format = codec::fields_formatter_for<args_tt...>();
+  constexpr auto release = codec::release_for<args_tt...>();
+  if constexpr (captures_raw_v<args_tt...>) {
+    recorder::get().record(slot, signature, format, release, codec::to_wire(args)...);
+  } else {
+    scratch_buffer text;
+    auto_format_rules::detail::write_args(text.get(), args...);
+    recorder::get().record(
+      slot, signature, format, release, std::string_view(text.get().data(), text.get().size()));
+  }
+}
+
+// KV_*
+template <typename... args_tt>
+void log_kv(site_slot &slot, const args_tt &...args) {
+  constexpr auto signature = codec::signature<args_tt...>::sv;
+  constexpr auto format = kv::formatter_for<args_tt...>();
+  constexpr auto release = codec::release_for<args_tt...>();
+  if constexpr (captures_raw_v<args_tt...>) {
+    recorder::get().record(slot, signature, format, release, codec::to_wire(args)...);
+  } else {
+    scratch_buffer text;
+    kv::write(text.get(), slot.site, args...);
+    recorder::get().record(
+      slot, signature, format, release, std::string_view(text.get().data(), text.get().size()));
+  }
+}
+
+// PRINT_*, the finished message
+inline void log_text(site_slot &slot, std::string_view text) {
+  recorder::get().record(slot, codec::signature<std::string_view>::sv, &codec::format_text, nullptr, text);
+}
+
+}  // namespace flight
+}  // namespace util::logger
@@ -0,0 +1,235 @@
+//
+//  kv_encoding.h
+//  inlay
+//
+//  KV_* records: a message and typed key/value fields written straight into the record's buffer as logfmt
+//  or JSON, the keys fixed per call site at compile time; json_formatter turns every line into a JSON object
+//
+
+#pragma once
+
+#include <spdlog/details/log_msg.h>
+#include <spdlog/details/os.h>
+#include <spdlog/formatter.h>
+
+#include <array>
+#include <atomic>
+#include <charconv>
+#include <chrono>
+#include <cmath>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <ctime>
+#include <memory>
+#include <span>
+#include <string_view>
+#include <tuple>
+#include <type_traits>
+
+#include "arg_codec.h"
+#include "compiled_format.h"
+#include "sanitize.h"
+#include "site.h"
+
+namespace util::logger {
+
+// how KV_* records are written
+enum class kv_format : std::uint8_t {
+  logfmt,      // msg="..." key=value ..., after init()'s usual line prefix
+  json,        // {"msg":"...","key":value}, after init()'s usual line prefix
+  json_lines,  // every line one JSON object, see json_formatter
+};
+
+namespace kv {
+
+inline std::atomic<kv_format> current_format{kv_format::logfmt};
+
+// a json_lines KV_* message starts with it, followed by its fields as JSON members
+constexpr char fields_mark = '\x1e';
+
+constexpr bool valid_key(std::string_view key) {
+  if (key.empty())
+    return false;
+  for (char c : key) {
+    if (!((c >= 'a' && c <= 'z') || (c >= 'A' && c <= 'Z') || (c >= '0' && c <= '9') || c == '_' || c == '.' ||
+          c == '-'))
+      return false;
+  }
+  return key != "msg";
+}
+
+// keys need no escaping in either format
+template <std::size_t count_vv>
+constexpr bool valid_keys(const std::array<std::string_view, count_vv> &keys) {
+  for (auto key : keys) {
+    if (!valid_key(key))
+      return false;
+  }
+  return true;
+}
+
+template <typename... keys_tt>
+constexpr auto make_keys(const keys_tt &...keys) {
+  return std::array<std::string_view, sizeof...(keys_tt)>{std::string_view(keys)...};
+}
+
+inline void write_json_string(spdlog::memory_buf_t &dest, std::string_view text) {
+  dest.push_back('"');
+  sanitize::escape_json(dest, text);
+  dest.push_back('"');
+}
+
+// bare unless it needs quoting, see sanitize::needs_quoting
+inline void write_logfmt_string(spdlog::memory_buf_t &dest, std::string_view text) {
+  if (sanitize::needs_quoting(text))
+    write_json_string(dest, text);
+  else
+    append(dest, text);
+}
+
+// numbers and booleans bare, strings quoted, null pointers as null, other types formatted with "{}" and quoted
+template <typename tt>
+void write_value(spdlog::memory_buf_t &dest, const tt &value, bool json) {
+  using value_t = std::decay_t<tt>;
+  const auto string = json ? &write_json_string : &write_logfmt_string;
+  if constexpr (std::is_null_pointer_v<value_t>) {
+    append(dest, "null");
+  } else if constexpr (std::is_convertible_v<const tt &, std::string_view>) {
+    if constexpr (std::is_pointer_v<value_t> && !std::is_array_v<tt>) {
+      if (value == nullptr) {
+        append(dest, "null");
+        return;
+      }
+    }
+    string(dest, std::string_view(value));
+  } else if constexpr (std::is_same_v<value_t, char>) {
+    string(dest, std::string_view(&value, 1));
+  } else if constexpr (std::is_floating_point_v<value_t>) {
+    // JSON has no inf or nan
+    if (json && !std::isfinite(value))
+      dest.push_back('"');
+    util::logger::write_value(value, dest);
+    if (json && !std::isfinite(value))
+      dest.push_back('"');
+  } else if constexpr (std::is_arithmetic_v<value_t>) {
+    util::logger::write_value(value, dest);
+  } else {
+    scratch_buffer text;
+    util::logger::write_value(value, text.get());
+    string(dest, std::string_view(text.get().data(), text.get().size()));
+  }
+}
+
+// site.fmt is the message, site.keys name the values
+template <typename... values_tt>
+void write(spdlog::memory_buf_t &dest, const log_site &site, const values_tt &...values) {
+  const kv_format format = current_format.load(std::memory_order_relaxed);
+  [[maybe_unused]] const bool json = format != kv_format::logfmt;
+  [[maybe_unused]] std::size_t index = 0;
+  if (format == kv_format::logfmt) {
+    append(dest, "msg=");
+    write_logfmt_string(dest, site.fmt);
+    ((dest.push_back(' '), append(dest, site.keys[index++]), dest.push_back('='), write_value(dest, values, false)),
+      ...);
+    return;
+  }
+  if (format == kv_format::json_lines)
+    dest.push_back(fields_mark);
+  else
+    dest.push_back('{');
+  append(dest, "\"msg\":");
+  write_json_string(dest, site.fmt);
+  ((append(dest, ",\""), append(dest, site.keys[index++]), append(dest, "\":"), write_value(dest, values, json)), ...);
+  if (format != kv_format::json_lines)
+    dest.push_back('}');
+}
+
+// how the deferred backend rebuilds a KV_* record from its wire values
+template <typename... wire_tt>
+void format_fields(const log_site &site, [[maybe_unused]] const std::byte *args, spdlog::memory_buf_t &dest) {
+  std::tuple<codec::read_t<wire_tt>...> values{codec::read<wire_tt>(args)...};
+  std::apply([&](const auto &...value) { write(dest, site, value...); }, values);
+}
+
+template <typename... args_tt>
+constexpr format_fn formatter_for() {
+  if constexpr (!codec::deferrable_v<args_tt...>)
+    return &codec::format_text;
+  else
+    return &format_fields<codec::wire_t<args_tt>...>;
+}
+
+}  // namespace kv
+
+// kv_format::json_lines: {"time":"2024-07-15 11:15:54.345","level":"info","src":"main.cpp:216","thread":210852,
+// "msg":"..."} per record, a KV_* record's fields taking the place of "msg"
+class json_formatter final : public spdlog::formatter {
+ private:
+  std::time_t _second = -1;
+  char _date[29];  // {"time":"YYYY-MM-DD HH:MM:SS. of _second
+  spdlog::memory_buf_t _src;
+
+ public:
+  void format(const spdlog::details::log_msg &msg, spdlog::memory_buf_t &dest) override {
+    using namespace std::chrono;
+    const auto since_epoch = msg.time.time_since_epoch();
+    const auto second = duration_cast<seconds>(since_epoch);
+    if (second.count() != _second)
+      render_date(second.count());
+    const auto millis = static_cast<unsigned>(duration_cast<milliseconds>(since_epoch - second).count());
+
+    dest.append(_date, _date + sizeof(_date));
+    const char fraction[] = {static_cast<char>('0' + millis / 100), static_cast<char>('0' + millis / 10 % 10),
+      static_cast<char>('0' + millis % 10), '"'};
+    dest.append(fraction, fraction + sizeof(fraction));
+    append(dest, ",\"level\":\"");
+    const auto level = spdlog::level::to_string_view(msg.level);
+    dest.append(level.data(), level.data() + level.size());
+    dest.push_back('"');
+    if (!msg.source.empty()) {
+      append(dest, ",\"src\":");
+      _src.clear();
+      append(_src, msg.source.filename);
+      _src.push_back(':');
+      util::logger::write_value(msg.source.line, _src);
+      kv::write_json_string(dest, std::string_view(_src.data(), _src.size()));
+    }
+    append(dest, ",\"thread\":");
+    util::logger::write_value(msg.thread_id, dest);
+
+    const std::string_view payload(msg.payload.data(), msg.payload.size());
+    if (!payload.empty() && payload.front() == kv::fields_mark) {
+      dest.push_back(',');
+      append(dest, payload.substr(1));
+    } else {
+      append(dest, ",\"msg\":");
+      kv::write_json_string(dest, payload);
+    }
+    dest.push_back('}');
+    append(dest, spdlog::details::os::default_eol);
+  }
+
+  std::unique_ptr<spdlog::formatter> clone() const override {
+    return std::make_unique<json_formatter>();
+  }
+
+ private:
+  void render_date(std::time_t second) {
+    const std::tm tm = spdlog::details::os::localtime(second);
+    const auto put = [](char *out, int value, int digits) {
+      for (int i = digits - 1; i >= 0; --i, value /= 10)
+        out[i] = static_cast<char>('0' + value % 10);
+    };
+    std::memcpy(_date, "{\"time\":\"0000-00-00 00:00:00.", sizeof(_date));
+    put(_date + 9, tm.tm_year + 1900, 4);
+    put(_date + 14, tm.tm_mon + 1, 2);
+    put(_date + 17, tm.tm_mday, 2);
+    put(_date + 20, tm.tm_hour, 2);
+    put(_date + 23, tm.tm_min, 2);
+    put(_date + 26, tm.tm_sec, 2);
+    _second = second;
+  }
+};
+
+}  // namespace util::logger
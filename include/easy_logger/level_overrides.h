@@ -0,0 +1,230 @@
+//
+//  level_overrides.h
+//  inlay
+//
+//  runtime levels of single files, directories or functions on top of the global level; each site
+//  resolves its level once and caches it in its site_slot until a change bumps the generation
+//
+
+#pragma once
+
+#include <spdlog/common.h>
+
+#include <algorithm>
+#include <atomic>
+#include <cctype>
+#include <cstdint>
+#include <istream>
+#include <mutex>
+#include <optional>
+#include <string>
+#include <string_view>
+#include <vector>
+
+#include "site.h"
+
+namespace util::logger {
+
+// what a rule's pattern is matched against, in rising precedence
+enum class override_scope : std::uint8_t {
+  prefix,    // start of the site's relative path, e.g. "net/", the longest match wins
+  file,      // the relative path, or its tail after a '/', e.g. "net/socket.cpp"
+  function,  // a function name, optionally qualified, e.g. "accept" or "server::accept"
+};
+
+struct level_override {
+  override_scope scope = override_scope::file;
+  std::string pattern;
+  spdlog::level::level_enum level = spdlog::level::trace;
+};
+
+// the contents of a level file, see parse_level_config
+struct level_config {
+  std::optional<spdlog::level::level_enum> base;  // "default = level"
+  std::vector<level_override> rules;
+};
+
+namespace detail {
+
+inline std::string_view trim(std::string_view text) {
+  while (!text.empty() && std::isspace(static_cast<unsigned char>(text.front())))
+    text.remove_prefix(1);
+  while (!text.empty() && std::isspace(static_cast<unsigned char>(text.back())))
+    text.remove_suffix(1);
+  return text;
+}
+
+// spdlog's names, plus "warn" and "err"
+inline std::optional<spdlog::level::level_enum> parse_level(std::string_view name) {
+  const auto level = spdlog::level::from_str(std::string(name));
+  if (level == spdlog::level::off && name != "off")
+    return std::nullopt;
+  return level;
+}
+
+inline bool is_identifier_char(char c) {
+  return std::isalnum(static_cast<unsigned char>(c)) || c == '_';
+}
+
+}  // namespace detail
+
+// one rule per line, '#' starts a comment:
+//   default = info
+//   prefix net/ = debug
+//   file net/socket.cpp = trace
+//   function server::accept = trace
+inline bool parse_level_config(std::istream &in, level_config &config, std::string &error) {
+  config = {};
+  std::string line;
+  for (int number = 1; std::getline(in, line); ++number) {
+    std::string_view text = line;
+    text = detail::trim(text.substr(0, text.find('#')));
+    if (text.empty())
+      continue;
+
+    const auto equals = text.rfind('=');
+    const auto level = equals == std::string_view::npos ? std::nullopt
+                                                        : detail::parse_level(detail::trim(text.substr(equals + 1)));
+    if (!level) {
+      error = "line " + std::to_string(number) + ": expected \"<scope> <pattern> = <level>\"";
+      return false;
+    }
+    const auto key = detail::trim(text.substr(0, equals));
+    if (key == "default") {
+      config.base = level;
+      continue;
+    }
+
+    const auto space = key.find_first_of(" \t");
+    const auto scope = key.substr(0, space);
+    const auto pattern = space == std::string_view::npos ? std::string_view() : detail::trim(key.substr(space));
+    level_override rule{override_scope::file, std::string(pattern), *level};
+    if (scope == "prefix")
+      rule.scope = override_scope::prefix;
+    else if (scope == "function")
+      rule.scope = override_scope::function;
+    else if (scope != "file" || pattern.empty()) {
+      error = "line " + std::to_string(number) + ": unknown scope or empty pattern \"" + std::string(key) + "\"";
+      return false;
+    }
+    config.rules.push_back(std::move(rule));
+  }
+  return true;
+}
+
+// the global level and the rules; every change bumps the generation, which sends each site back
+// through resolve() on its next call
+class level_overrides {
+ private:
+  mutable std::mutex _mutex;
+  spdlog::level::level_enum _base = spdlog::level::info;
+  std::vector<level_override> _rules;
+  std::atomic<std::uint64_t> _generation{1};  // 0 is the unresolved slot's value
+
+ public:
+  static level_overrides &get() {
+    static level_overrides instance;
+    return instance;
+  }
+
+  // a disabled site's level is compared against the cached one, a site of a stale generation resolves again
+  bool enabled(site_slot &slot) {
+    const auto cached = slot.level.load(std::memory_order_relaxed);
+    if ((cached >> 8) != _generation.load(std::memory_order_relaxed)) [[unlikely]]
+      return slot.site.level >= resolve(slot);
+    return slot.site.level >= static_cast<spdlog::level::level_enum>(cached & 0xff);
+  }
+
+  spdlog::level::level_enum base() const {
+    std::lock_guard lock(_mutex);
+    return _base;
+  }
+
+  // the lowest level any site can have, the macros' first check
+  spdlog::level::level_enum gate() const {
+    std::lock_guard lock(_mutex);
+    auto gate = _base;
+    for (const auto &rule : _rules)
+      gate = std::min(gate, rule.level);
+    return gate;
+  }
+
+  void set_base(spdlog::level::level_enum level) {
+    std::lock_guard lock(_mutex);
+    _base = level;
+    _generation.fetch_add(1, std::memory_order_relaxed);
+  }
+
+  void set(std::vector<level_override> rules) {
+    std::lock_guard lock(_mutex);
+    _rules = std::move(rules);
+    _generation.fetch_add(1, std::memory_order_relaxed);
+  }
+
+  std::vector<level_override> rules() const {
+    std::lock_guard lock(_mutex);
+    return _rules;
+  }
+
+  // the most specific matching rule's level, or the global one
+  spdlog::level::level_enum level_of(const log_site &site) const {
+    std::lock_guard lock(_mutex);
+    return match(site);
+  }
+
+  static bool matches(const level_override &rule, const log_site &site) {
+    const std::string_view pattern = rule.pattern;
+    switch (rule.scope) {
+      case override_scope::prefix:
+        return std::string_view(site.file).starts_with(pattern);
+      case override_scope::file: {
+        const std::string_view file = site.file;
+        if (!file.ends_with(pattern) || pattern.empty())
+          return false;
+        return file.size() == pattern.size() || file[file.size() - pattern.size() - 1] == '/' ||
+               file[file.size() - pattern.size() - 1] == '\\';
+      }
+      case override_scope::function: {
+        // the name as it appears in the compiler's signature, e.g. "void net::server::accept(int)"
+        const std::string_view function = site.function != nullptr ? site.function : "";
+        for (auto pos = function.find(pattern); pos != std::string_view::npos && !pattern.empty();
+             pos = function.find(pattern, pos + 1)) {
+          const auto end = pos + pattern.size();
+          if ((pos == 0 || !detail::is_identifier_char(function[pos - 1])) &&
+              (end == function.size() || function[end] == '(' || function[end] == '<'))
+            return true;
+        }
+        return false;
+      }
+    }
+    return false;
+  }
+
+ private:
+  level_overrides() = default;
+  ~level_overrides() = default;
+
+  level_overrides(const level_overrides &) = delete;
+  void operator=(const level_overrides &) = delete;
+
+  spdlog::level::level_enum match(const log_site &site) const {
+    const level_override *best = nullptr;
+    for (const auto &rule : _rules) {
+      if (matches(rule, site) && (best == nullptr || rule.scope > best->scope ||
+                                   (rule.scope == best->scope && rule.pattern.size() >= best->pattern.size())))
+        best = &rule;
+    }
+    return best != nullptr ? best->level : _base;
+  }
+
+  // stores the generation read under the lock, a change racing with this store makes the slot stale again
+  spdlog::level::level_enum resolve(site_slot &slot) {
+    std::lock_guard lock(_mutex);
+    const auto level = match(slot.site);
+    slot.level.store(_generation.load(std::memory_order_relaxed) << 8 | static_cast<std::uint64_t>(level),
+      std::memory_order_relaxed);
+    return level;
+  }
+};
+
+}  // namespace util::logger
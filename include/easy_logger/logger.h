@@ -16,17 +16,34 @@
 #include <spdlog/fmt/bundled/printf.h>
 #include <spdlog/sinks/daily_file_sink.h>
 #include <spdlog/sinks/msvc_sink.h>
-#include <spdlog/sinks/stdout_color_sinks.h>
 #include <spdlog/sinks/stdout_sinks.h>
 #include <spdlog/spdlog.h>
 
+#include <algorithm>
+#include <atomic>
+#include <cstdint>
 #include <memory>
 #include <thread>
 #include <format>
+#include <fstream>
 #include <iostream>
 #include <filesystem>
 
-// #include "auto_format_rules.h"
+#include "auto_format_rules.h"
+#include "batch_file_sink.h"
+#include "channel.h"
+#include "compressed_file_sink.h"
+#include "console_sink.h"
+#include "default_formatter.h"
+#include "deferred.h"
+#include "flight_recorder.h"
+#include "kv_encoding.h"
+#include "level_overrides.h"
+#include "mmap_file_sink.h"
+#include "rate_limit.h"
+#include "sanitize.h"
+#include "site.h"
+#include "telemetry.h"
 
 #ifdef __cpp_lib_source_location
 #include <source_location>
@@ -39,29 +56,305 @@ using logger_source_location = nostd::source_location;
 /// spdlog wrap class
 namespace util::logger {
 
+// what an async logger does when its queue is full
+enum class overflow_policy : uint8_t {
+  block,           // caller waits for a free slot, nothing is lost
+  overrun_oldest,  // oldest queued message is overwritten
+  drop_newest,     // new message is discarded and counted
+};
+
+// what init() writes the log file with, all of them rotate daily at 00:02
+enum class file_sink_kind : uint8_t {
+  daily,       // spdlog's daily_file_sink, one fwrite per record
+  batch,       // batch_file_sink, records are written in batches, see batch_options
+  mmap,        // mmap_file_sink, lock-free copies into a mapped file, see mmap_options (daily on Windows)
+  compressed,  // compressed_file_sink, zstd/LZ4 blocks compressed on a helper thread, see compressed_options
+};
+
+struct init_options {
+  bool async = true;                          // false: format and write on the caller's thread
+  std::size_t queue_capacity = 1024ull * 32;  // async queue size, in messages
+  std::size_t worker_count = 1;               // backend threads, 1 keeps output ordered
+  // deferred: overrun_oldest acts as drop_newest, a producer cannot take back records the backend may be reading
+  overflow_policy policy = overflow_policy::block;
+  bool deferred = false;  // LOG_*/STM_* copy raw arguments into a per-thread buffer, formatting runs on the backend
+  deferred::backend_options backend;  // per-thread buffer size and idle strategy of the deferred backend
+  file_sink_kind file_sink = file_sink_kind::daily;
+  batch_options batch;  // commit thresholds of file_sink_kind::batch
+#ifndef _WIN32
+  mmap_options mmap;  // segment size of file_sink_kind::mmap
+#endif
+  compressed_options compressed;  // codec and block size of file_sink_kind::compressed
+  bool binary = false;  // implies deferred: the file holds binary records (binary_log.h), read with easy_logger_decode
+  flight_options flight;  // in-memory history of the sites below the level, dumped on a crash, see flight_recorder.h
+  kv_format kv = kv_format::logfmt;  // how KV_* fields are written, json_lines makes every line a JSON object
+  console_options console;       // stdout, written by a thread of its own, warn and above by default
+  bool sanitize_console = true;  // console payloads get control characters escaped and invalid UTF-8 replaced
+  telemetry_options telemetry;    // the logger's own counters and latencies, see telemetry.h
+};
+
+// a LOG_*_CH channel, see easy_logger::add_channel
+struct channel_options {
+  spdlog::level::level_enum level = spdlog::level::info;
+  std::vector<spdlog::sink_ptr> sinks;  // empty: a daily file like init()'s
+  std::string filename;                 // of that file, "<channel>.log" when empty
+  bool async = true;                    // a queue and worker thread of its own
+  std::size_t queue_capacity = 1024ull * 8;
+  std::size_t worker_count = 1;
+  overflow_policy policy = overflow_policy::block;  // async drop_newest needs spdlog >= 1.13, rejected before
+  std::shared_ptr<spdlog::details::thread_pool> pool;  // set to share one queue and its workers between channels
+  spdlog::level::level_enum flush_level = spdlog::level::warn;
+};
+
+// spdlog < 1.13 has no discard_new: the last sink of init()'s async logger sees every record leave the queue
+// and keeps our count of queued records, so drop_newest callers check an atomic instead of the registry's and
+// the queue's locks; every 1024 records the count is set from the queue itself, off the callers' path
+class queue_counter_sink final : public spdlog::sinks::sink {
+ private:
+  std::atomic<std::size_t> &_queued;
+  std::weak_ptr<spdlog::details::thread_pool> _pool;
+  std::atomic<std::uint32_t> _seen{0};
+
+ public:
+  queue_counter_sink(std::atomic<std::size_t> &queued, std::weak_ptr<spdlog::details::thread_pool> pool)
+      : _queued(queued), _pool(std::move(pool)) {
+    set_level(spdlog::level::trace);
+  }
+
+  void log(const spdlog::details::log_msg &) override {
+    std::size_t queued = _queued.load(std::memory_order_relaxed);
+    while (queued != 0 && !_queued.compare_exchange_weak(queued, queued - 1, std::memory_order_relaxed)) {
+    }
+    if (_seen.fetch_add(1, std::memory_order_relaxed) % 1024 == 1023) {
+      if (auto pool = _pool.lock())
+        _queued.store(pool->queue_size(), std::memory_order_relaxed);
+    }
+  }
+
+  void flush() override {}
+  void set_pattern(const std::string &) override {}
+  void set_formatter(std::unique_ptr<spdlog::formatter>) override {}
+};
+
+// the macros' runtime gate, kept apart from spdlog's logger so a disabled site costs a single relaxed load
+struct alignas(cache_line_size) cached_level {
+  std::atomic<spdlog::level::level_enum> value{spdlog::level::info};
+  std::atomic<spdlog::level::level_enum> base{spdlog::level::info};  // without the overrides
+};
+
 class easy_logger_static {
+ protected:
+  static inline cached_level _level;
+  static inline overflow_policy _policy = overflow_policy::block;
+  static inline std::size_t _queue_capacity = 0;
+  static inline std::atomic<std::size_t> _dropped{0};
+  static inline std::mutex _level_mutex;  // keeps the gate in step with the overrides it is computed from
+  static inline std::weak_ptr<async_console_sink> _console;
+  static inline std::shared_ptr<spdlog::details::thread_pool> _pool;  // spdlog::thread_pool() locks the registry
+  static inline std::atomic<std::size_t> _queued{0};  // see queue_counter_sink
+
  public:
-  static void init() {
-    constexpr std::size_t log_buffer_size = 1024ull * 32;  // 32kb
-    spdlog::init_thread_pool(log_buffer_size, std::thread::hardware_concurrency());
+  static void init(const init_options &options = {}) {
+    _policy = options.policy;
+    _queue_capacity = std::max<std::size_t>(options.queue_capacity, 1);
+    spdlog::init_thread_pool(_queue_capacity, std::max<std::size_t>(options.worker_count, 1));
+    _pool = spdlog::thread_pool();
+    _queued.store(0, std::memory_order_relaxed);
+  }
+
+  static spdlog::async_overflow_policy to_spdlog_policy(overflow_policy policy) {
+    switch (policy) {
+      case overflow_policy::overrun_oldest:
+        return spdlog::async_overflow_policy::overrun_oldest;
+#if SPDLOG_VERSION >= 11300
+      case overflow_policy::drop_newest:
+        return spdlog::async_overflow_policy::discard_new;
+#endif
+      default:
+        return spdlog::async_overflow_policy::block;
+    }
+  }
+
+  // messages lost to a full async queue, either dropped (drop_newest) or overwritten (overrun_oldest),
+  // or to a full console buffer
+  static std::size_t dropped_count() {
+    std::size_t count = _dropped.load(std::memory_order_relaxed) + deferred::backend::get().dropped_count();
+    if (auto console = _console.lock())
+      count += console->dropped_count();
+    if (auto tp = _pool) {
+      count += tp->overrun_counter();
+#if SPDLOG_VERSION >= 11300
+      count += tp->discard_counter();
+#endif
+    }
+    return count;
+  }
+
+  // the logger's own counters, aggregated over all threads; empty unless options.telemetry.enabled
+  static telemetry_snapshot telemetry() {
+    auto snapshot = telemetry::collector::get().snapshot();
+    snapshot.dropped = dropped_count();
+    snapshot.queue_capacity = deferred_enabled() ? deferred::backend::get().buffer_capacity() : _queue_capacity;
+    return snapshot;
+  }
+
+  // error of the deferred backend's tick timestamps against the system clock, see tsc_clock.h
+  static clock_drift timestamp_drift() {
+    return tsc_clock::get().drift();
+  }
+
+  // spdlog < 1.13 has no discard_new policy, so drop_newest takes a place in the queue before enqueue;
+  // records the logger filters out (flight recorder only) never reach the queue and take none
+  static bool admit(spdlog::level::level_enum lvl) {
+#if SPDLOG_VERSION < 11300
+    if (_policy == overflow_policy::drop_newest && _queue_capacity != 0 &&
+        spdlog::default_logger_raw()->should_log(lvl)) {
+      if (_queued.fetch_add(1, std::memory_order_relaxed) >= _queue_capacity) {
+        _queued.fetch_sub(1, std::memory_order_relaxed);
+        _dropped.fetch_add(1, std::memory_order_relaxed);
+        return false;
+      }
+    }
+#endif
+    return true;
+  }
+
+  // a record handed to spdlog on the caller's thread; the async queue's depth is sampled every 16th record
+  // as reading it takes the queue's lock
+  static void count_sent(const telemetry::call_timer &timer, const site_slot &slot, std::size_t bytes) {
+    if (!timer.timing())
+      return;
+    timer.done(slot, bytes);
+    static thread_local std::uint32_t sent = 0;
+    if (_queue_capacity != 0 && ++sent % 16 == 0) {
+      if (auto tp = _pool)
+        telemetry::queue_depth(tp->queue_size());
+    }
+  }
+
+  static bool deferred_enabled() {
+    return deferred::backend::get().running();
+  }
+
+  // appends the flight recorder's history to its file, see flight_options
+  static bool dump_flight_recorder() {
+    return flight::recorder::get().dump();
   }
 
   // will drop all register logger and shutdown
   static void shutdown() {
+    telemetry::reporter::get().stop();
+    flight::recorder::get().stop();
+    deferred::backend::get().stop();
+    channel_registry::get().clear();
     spdlog::shutdown();
+    _pool.reset();
+    _queue_capacity = 0;
   }
 
   // spdlog static globally
   static auto level() -> decltype(spdlog::get_level()) {
-    return spdlog::get_level();
+    return level_overrides::get().base();
   }
 
+  // set the level here rather than through spdlog::set_level, the macros only read the cached copy
   static void set_level(spdlog::level::level_enum lvl) {
-    spdlog::set_level(lvl);
+    std::lock_guard lock(_level_mutex);
+    level_overrides::get().set_base(lvl);
+    apply_gate();
+  }
+
+  // replaces the per-file/prefix/function levels, see level_overrides.h; sites pick them up on their next call
+  static void set_level_overrides(std::vector<level_override> rules) {
+    std::lock_guard lock(_level_mutex);
+    level_overrides::get().set(std::move(rules));
+    apply_gate();
   }
 
+  static void clear_level_overrides() {
+    set_level_overrides({});
+  }
+
+  // reads a level file (format in parse_level_config) and applies it as a whole, a bad file changes nothing;
+  // call it again to reload, e.g. on SIGHUP from a thread that is allowed to log
+  static bool load_level_overrides(const std::string &path) {
+    std::ifstream in(path);
+    level_config config;
+    std::string error = "cannot open file";
+    if (!in || !parse_level_config(in, config, error)) {
+      std::cerr << "easy_logger: level file " << path << ": " << error << '\n';
+      return false;
+    }
+    std::lock_guard lock(_level_mutex);
+    if (config.base)
+      level_overrides::get().set_base(*config.base);
+    level_overrides::get().set(std::move(config.rules));
+    apply_gate();
+    return true;
+  }
+
+  // the lowest level any site is enabled or recorded at, overrides included
   static bool should_log(spdlog::level::level_enum lvl) {
-    return spdlog::should_log(lvl);
+    return lvl >= _level.value.load(std::memory_order_relaxed);
+  }
+
+  // a site past should_log: its own level, resolved against the overrides once per change
+  static bool should_log(site_slot &slot) {
+    return level_overrides::get().enabled(slot);
+  }
+
+  // calls given a source_loc rather than a site: no override can name them, only the base level applies
+  static bool should_log_base(spdlog::level::level_enum lvl) {
+    return lvl >= _level.base.load(std::memory_order_relaxed);
+  }
+
+  // LOG_*_CH: a configured channel's own level, otherwise the same gate as LOG_*
+  static bool should_log(const channel &ch, spdlog::level::level_enum lvl) {
+    return ch.configured() ? ch.should_log(lvl) : should_log(lvl);
+  }
+
+  // gives LOG_*_CH(name, ...) a logger of its own: sinks, level and queue (or a pool shared with other
+  // channels); calling it again replaces them. LOG_*_CH sites of a channel never added log like LOG_*
+  static bool add_channel(std::string_view name, const channel_options &options) {
+#if SPDLOG_VERSION < 11300
+    if (options.async && options.policy == overflow_policy::drop_newest) {
+      std::cerr << "easy_logger: channel " << name << ": drop_newest needs spdlog >= 1.13" << '\n';
+      return false;
+    }
+#endif
+    try {
+      auto sinks = options.sinks;
+      if (sinks.empty()) {
+        const auto filename = options.filename.empty() ? std::string(name) + ".log" : options.filename;
+        sinks.push_back(std::make_shared<spdlog::sinks::daily_file_sink_mt>(filename, 0, 2));
+      }
+      if (telemetry::collector::enabled()) {
+        for (auto &sink : sinks)
+          sink = std::make_shared<telemetry::timed_sink>(sink);
+      }
+      auto pool = options.pool;
+      if (options.async && !pool)
+        pool = std::make_shared<spdlog::details::thread_pool>(
+          std::max<std::size_t>(options.queue_capacity, 1), std::max<std::size_t>(options.worker_count, 1));
+      std::shared_ptr<spdlog::logger> logger;
+      if (pool)
+        logger = std::make_shared<spdlog::async_logger>(
+          std::string(name), sinks.begin(), sinks.end(), pool, to_spdlog_policy(options.policy));
+      else
+        logger = std::make_shared<spdlog::logger>(std::string(name), sinks.begin(), sinks.end());
+      logger->set_formatter(std::make_unique<default_formatter>());
+      logger->flush_on(options.flush_level);
+      auto &registry = channel_registry::get();
+      registry.configure(registry.resolve(name), std::move(logger), std::move(pool), options.level);
+    } catch (const spdlog::spdlog_ex &ex) {
+      std::cerr << "easy_logger: channel " << name << ": " << ex.what() << '\n';
+      return false;
+    }
+    return true;
+  }
+
+  static void set_channel_level(std::string_view name, spdlog::level::level_enum lvl) {
+    channel_registry::get().resolve(name).set_level(lvl);
   }
 
   static void set_flush_on(spdlog::level::level_enum lvl) {
@@ -88,6 +381,16 @@ class easy_logger_static {
     }
     return full_path;
   }
+
+ private:
+  // spdlog's logger filters too, so it is opened as far as the most verbose override;
+  // the flight recorder's sites only need to get past the macros
+  static void apply_gate() {
+    const auto gate = level_overrides::get().gate();
+    spdlog::set_level(gate);
+    _level.value.store(std::min(gate, flight::recorder::level()), std::memory_order_relaxed);
+    _level.base.store(level_overrides::get().base(), std::memory_order_relaxed);
+  }
 };
 
 class easy_logger final : public easy_logger_static {
@@ -101,21 +404,39 @@ class easy_logger final : public easy_logger_static {
     return easy_logger;
   }
 
-  bool init(std::string_view filename) {
+  bool init(std::string_view filename, const init_options &options = {}) {
     if (_inited.load())
       return true;
 
     try {
       // initialize spdlog
       std::vector<spdlog::sink_ptr> sinks;
+      const bool deferred = options.deferred || options.binary;
 
-      sinks.push_back(std::make_shared<spdlog::sinks::daily_file_sink_mt>(filename.data(), 0, 2));
+      // a binary log is written by the deferred backend itself
+      if (options.binary) {
+      } else if (options.file_sink == file_sink_kind::batch) {
+        sinks.push_back(std::make_shared<batch_file_sink_mt>(filename.data(), options.batch));
+#ifndef _WIN32
+      } else if (options.file_sink == file_sink_kind::mmap) {
+        sinks.push_back(std::make_shared<mmap_file_sink>(filename.data(), options.mmap));
+#endif
+      } else if (options.file_sink == file_sink_kind::compressed) {
+        sinks.push_back(std::make_shared<compressed_file_sink_mt>(filename.data(), options.compressed));
+      } else {
+        sinks.push_back(std::make_shared<spdlog::sinks::daily_file_sink_mt>(filename.data(), 0, 2));
+      }
 
       // constexpr std::size_t max_file_size = 1024l * 1024 * 1024; // 1G
       // sinks.push_back(std::make_shared<spdlog::sinks::rotating_file_sink_mt>(
       //     filename.data(), max_file_size, 1024));
 
-      sinks.push_back(std::make_shared<spdlog::sinks::stdout_color_sink_mt>());
+      std::shared_ptr<async_console_sink> console;
+      if (options.console.enabled) {
+        console = std::make_shared<async_console_sink>(options.console);
+        sinks.push_back(console);
+      }
+      _console = console;
       // sinks.push_back(std::make_shared<spdlog::sinks::stderr_color_sink_mt>());
 #if !defined(WIN32) && !defined(NO_CONSOLE_LOG)
 #endif
@@ -124,20 +445,64 @@ class easy_logger final : public easy_logger_static {
       sinks.push_back(std::make_shared<spdlog::sinks::msvc_sink_mt>());
 #endif  //  _DEBUG
 
-      // register logger
-      spdlog::set_default_logger(std::make_shared<spdlog::logger>("", sinks.begin(), sinks.end()));
+      telemetry::collector::get().enable(options.telemetry.enabled);
+      if (options.telemetry.enabled) {
+        for (auto &sink : sinks)
+          sink = std::make_shared<telemetry::timed_sink>(sink);
+      }
+
+      // register logger, async ones only enqueue on the caller's thread
+      if (deferred) {
+        // the deferred backend thread is the only writer, the logger itself stays synchronous
+        _policy = options.policy;
+        spdlog::set_default_logger(std::make_shared<spdlog::logger>("", sinks.begin(), sinks.end()));
+      } else if (options.async) {
+        easy_logger_static::init(options);
+#if SPDLOG_VERSION < 11300
+        if (options.policy == overflow_policy::drop_newest)
+          sinks.push_back(std::make_shared<queue_counter_sink>(_queued, _pool));
+#endif
+        spdlog::set_default_logger(std::make_shared<spdlog::async_logger>(
+          "", sinks.begin(), sinks.end(), _pool, to_spdlog_policy(options.policy)));
+      } else {
+        spdlog::set_default_logger(std::make_shared<spdlog::logger>("", sinks.begin(), sinks.end()));
+      }
 
       // https://github.com/gabime/spdlog/wiki/3.-Custom-formatting#pattern-flags
       // eg. [2024-07-15 11:15:54.345][debug][main.cpp:216][210852]:DEBUG log,
       // 1, 1, 2
-      spdlog::set_pattern("%^[%Y-%m-%d %T.%e][%l][%@][%t]:%v%$");
+      // default_formatter renders default_formatter::pattern "%^[%Y-%m-%d %T.%e][%l][%@][%t]:%v%$" with cached pieces
+      kv::current_format.store(options.kv, std::memory_order_relaxed);
+      if (options.kv == kv_format::json_lines)
+        spdlog::set_formatter(std::make_unique<json_formatter>());
+      else
+        spdlog::set_formatter(std::make_unique<default_formatter>());
+      // json_lines payloads are escaped by json_formatter already
+      if (console && options.sanitize_console && options.kv != kv_format::json_lines)
+        console->set_formatter(std::make_unique<sanitizing_formatter>(std::make_unique<default_formatter>()));
       spdlog::flush_on(spdlog::level::warn);
-      spdlog::set_level(spdlog::level::trace);
+      if (options.flight.enabled)
+        flight::recorder::get().start(
+          options.flight, options.flight.path.empty() ? std::string(filename) + ".flight" : options.flight.path);
+      set_level(spdlog::level::trace);
       spdlog::flush_every(std::chrono::seconds(3));
 
       spdlog::set_error_handler(
         [](const std::string &msg) { spdlog::log(spdlog::level::critical, "*** LOGGER ERROR ***: {}", msg); });
 
+      if (deferred)
+        deferred::backend::get().start(spdlog::default_logger(), options.backend,
+          options.policy == overflow_policy::block,
+          options.binary ? std::make_shared<binary::writer>(filename.data()) : nullptr);
+
+      if (options.telemetry.enabled && options.telemetry.summary_interval.count() > 0)
+        telemetry::reporter::get().start(options.telemetry.summary_interval,
+          [previous = telemetry()]() mutable {
+            auto current = telemetry();
+            log_telemetry(current.since(previous));
+            previous = std::move(current);
+          });
+
     } catch (const spdlog::spdlog_ex &ex) {
       std::cerr << "spdlog initialization failed: " << ex.what() << '\n';
       return false;
@@ -151,6 +516,12 @@ class easy_logger final : public easy_logger_static {
     return true;
   }
 
+  // shutdown() above, init() sets the logger up again afterwards
+  static void shutdown() {
+    easy_logger_static::shutdown();
+    get()._inited.store(false);
+  }
+
   /*
    * fmt 类型从 const char* 修改为 const std::format_string<args_tt...>
    * https://en.cppreference.com/w/cpp/utility/format/format
@@ -161,21 +532,184 @@ class easy_logger final : public easy_logger_static {
    * be a compile-time constant, or the compile-time check needs to be avoided,
    * use std::vformat or std::runtime_format on fmt(since C++26) instead.
    */
-  // template <class... args_tt>
-  // static void log(const spdlog::source_loc &loc, spdlog::level::level_enum lvl,
-  //   const std::format_string<args_tt...> fmt, args_tt &&...args) {
-  //   spdlog::log(loc, lvl, fmt, std::forward<args_tt>(args)...);
-  // }
   template <class... args_tt>
   static void log(const spdlog::source_loc &loc, spdlog::level::level_enum lvl,
-    const char *fmt, args_tt &&...args) {
+    const std::format_string<args_tt...> fmt, args_tt &&...args) {
+    if (!should_log_base(lvl) || !admit(lvl))
+      return;
     spdlog::log(loc, lvl, fmt, std::forward<args_tt>(args)...);
   }
 
+  // the format string is only checked here, LOG_* formats with the site's pre-parsed copy
+  template <class... args_tt>
+  static void log(site_slot &slot, const std::format_string<args_tt...>, args_tt &&...args) {
+    log_at(slot, std::forward<args_tt>(args)...);
+  }
+
+  // LOG_*_CH: formatted here and handed to the channel's logger, whose queue and sinks are its own
+  template <class... args_tt>
+  static void log_channel(channel &ch, site_slot &slot, const std::format_string<args_tt...>, args_tt &&...args) {
+    spdlog::logger *logger = ch.logger();
+    if (logger == nullptr) {
+      if (should_log(slot))
+        log_at(slot, args...);
+      return;
+    }
+    const telemetry::call_timer timer;
+    site_id(slot, codec::signature<args_tt...>::sv, codec::formatter_for<args_tt...>(),
+      codec::release_for<args_tt...>());
+    scratch_buffer text;
+    format_compiled(slot.site.compiled, slot.site.fmt, text.get(), args...);
+    logger->log(slot.site.loc(), slot.site.level, spdlog::string_view_t(text.get().data(), text.get().size()));
+    timer.done(slot, text.get().size());
+    if (slot.site.level == spdlog::level::critical)
+      flight::recorder::get().on_critical();
+  }
+
+  // LOG_*_ONCE/_EVERY_N/_RATE/_DEDUP: the site's limiter decides, a summary of the records it held back
+  // goes out first on a second site at the same location
+  template <class... args_tt>
+  static void log_limited(site_limiter &limiter, const log_limit &limit, site_slot &summary, site_slot &slot,
+    const std::format_string<args_tt...>, args_tt &&...args) {
+    std::uint64_t held;
+    if (!limiter.admit(limit, held, args...))
+      return;
+    if (held != 0)
+      log_at(summary, held);
+    log_at(slot, std::forward<args_tt>(args)...);
+  }
+
+  // a LOG_* site whose format string was checked where the site was built, rvalues may be moved into
+  // a deferred record
+  template <class... args_tt>
+  static void log_at(site_slot &slot, args_tt &&...args) {
+    emit<site_kind::log>(slot, std::forward<args_tt>(args)...);
+  }
+
+  template <site_kind kind_vv, typename... args_tt>
+  static constexpr format_fn formatter_for() {
+    if constexpr (kind_vv == site_kind::log)
+      return codec::formatter_for<args_tt...>();
+    else if constexpr (kind_vv == site_kind::stm)
+      return codec::fields_formatter_for<args_tt...>();
+    else
+      return kv::formatter_for<args_tt...>();
+  }
+
+  template <site_kind kind_vv, typename... args_tt>
+  static void write_message(spdlog::memory_buf_t &out, const log_site &site, const args_tt &...args) {
+    if constexpr (kind_vv == site_kind::log)
+      format_compiled(site.compiled, site.fmt, out, args...);
+    else if constexpr (kind_vv == site_kind::stm)
+      auto_format_rules::detail::write_args(out, args...);
+    else
+      kv::write(out, site, args...);
+  }
+
+  // LOG_*, STM_* and KV_* alike: the flight ring, then the deferred or the sync path; a message either of them
+  // needs formatted on this thread is formatted once and handed to both
+  template <site_kind kind_vv, typename... args_tt>
+  static void emit(site_slot &slot, args_tt &&...args) {
+    constexpr auto signature = codec::signature<args_tt...>::sv;
+    constexpr auto format = formatter_for<kind_vv, args_tt...>();
+    constexpr auto release = codec::release_for<args_tt...>();
+    constexpr bool flight_raw = flight::captures_raw_v<args_tt...>;
+    constexpr bool deferred_raw = codec::deferrable_v<args_tt...>;
+    const telemetry::call_timer timer;
+    const bool flight = flight::recorder::records(slot.site.level);
+    const bool deferred = deferred_enabled();
+    const bool sync = !deferred && admit(slot.site.level);
+    scratch_buffer text;
+    if ((flight && !flight_raw) || (deferred && !deferred_raw) || sync)
+      write_message<kind_vv>(text.get(), slot.site, args...);
+    const std::string_view message(text.get().data(), text.get().size());
+
+    if (flight) {
+      if constexpr (flight_raw)
+        flight::recorder::get().record(slot, signature, format, release, codec::to_wire(args)...);
+      else
+        flight::recorder::get().record(slot, signature, format, release, message);
+    }
+    if (deferred) {
+      std::size_t size;
+      if constexpr (deferred_raw)
+        size = deferred::push(slot, signature, format, release, codec::to_wire(std::forward<args_tt>(args))...);
+      else
+        size = deferred::push(slot, signature, format, nullptr, message);
+      if (size)
+        timer.done(slot, size);
+    } else if (sync) {
+      site_id(slot, signature, format, release);
+      spdlog::log(slot.site.loc(), slot.site.level, spdlog::string_view_t(message.data(), message.size()));
+      count_sent(timer, slot, message.size());
+    }
+    if (slot.site.level == spdlog::level::critical)
+      flight::recorder::get().on_critical();
+  }
+
+  // a site below its level that the flight recorder keeps
+  template <site_kind kind_vv, typename... args_tt>
+  static void record(site_slot &slot, const args_tt &...args) {
+    if constexpr (kind_vv == site_kind::log)
+      flight::log(slot, args...);
+    else if constexpr (kind_vv == site_kind::stm)
+      flight::log_fields(slot, args...);
+    else if constexpr (kind_vv == site_kind::kv)
+      flight::log_kv(slot, args...);
+    else
+      flight::log_text(slot, sprintf_view(slot.site.fmt.data(), args...));
+  }
+
+  // same for LOG_*_ONCE and friends, records the limiter holds back are not kept either
+  template <typename... args_tt>
+  static void record_limited(site_limiter &limiter, const log_limit &limit, site_slot &slot, const args_tt &...args) {
+    std::uint64_t held;
+    if (limiter.admit(limit, held, args...))
+      flight::log(slot, args...);
+  }
+
+  // printf-style text goes into a per-thread buffer and is handed to spdlog as the finished message,
+  // so it is neither copied into a std::string nor parsed again as a format string
+  template <typename... args_tt>
+  static std::string_view sprintf_view(const char *fmt, const args_tt &...args) {
+    constexpr std::size_t max_retained = 1024ull * 64;  // give back the memory of an occasional huge message
+    static thread_local fmt::memory_buffer buffer;
+    if (buffer.capacity() > max_retained)
+      buffer = fmt::memory_buffer();
+    buffer.clear();
+    fmt::detail::vprintf(buffer, fmt::string_view(fmt), fmt::printf_args(fmt::make_printf_args(args...)));
+    return {buffer.data(), buffer.size()};
+  }
+
   template <typename... args_tt>
   static void print(
     const spdlog::source_loc &loc, spdlog::level::level_enum lvl, const char *fmt, const args_tt &...args) {
-    spdlog::log(loc, lvl, fmt::sprintf(fmt, args...).c_str());
+    if (!should_log_base(lvl) || !admit(lvl))
+      return;
+    const auto text = sprintf_view(fmt, args...);
+    spdlog::log(loc, lvl, spdlog::string_view_t(text.data(), text.size()));
+  }
+
+  template <typename... args_tt>
+  static void print(site_slot &slot, const args_tt &...args) {
+    const telemetry::call_timer timer;
+    const bool flight = flight::recorder::records(slot.site.level);
+    const bool deferred = deferred_enabled();
+    const bool sync = !deferred && admit(slot.site.level);
+    // formatted once for the flight ring and the record alike
+    const auto text = flight || deferred || sync ? sprintf_view(slot.site.fmt.data(), args...) : std::string_view();
+    if (flight)
+      flight::log_text(slot, text);
+    if (deferred) {
+      if (const auto size = deferred::log_text(slot, text))
+        timer.done(slot, size);
+    } else if (sync) {
+      site_id(slot, codec::signature<std::string_view>::sv, &codec::format_text);
+      spdlog::log(slot.site.loc(), slot.site.level, spdlog::string_view_t(text.data(), text.size()));
+      count_sent(timer, slot, text.size());
+    }
+    if (slot.site.level == spdlog::level::critical)
+      flight::recorder::get().on_critical();
   }
 
   // via: https://stackoverflow.com/a/76429895/21686566
@@ -192,19 +726,32 @@ class easy_logger final : public easy_logger_static {
     static constexpr auto sv = std::string_view{std::data(arr), count_vv > 0 ? count_vv * 3 - 1 : 0};
   };
 
+  // one field per argument, each written by the auto_format_rules writer of its type (tuple-likes flattened),
+  // straight into the per-thread buffer without building or parsing a format string
   template <typename... args_tt>
   static void stm(const spdlog::source_loc &loc, spdlog::level::level_enum lvl, args_tt &&...args) {
-    spdlog::log(loc, lvl, std::format(format_string_placeholders<sizeof...(args)>::sv, std::forward<args_tt>(args)...));
+    if (!should_log_base(lvl) || !admit(lvl))
+      return;
+    scratch_buffer text;
+    auto_format_rules::detail::write_args(text.get(), args...);
     // example:using | as separator
-    // spdlog::log(loc, lvl, std::format(format_string_placeholders<sizeof...(args), '|'>::sv, std::forward<args_tt>(args)...));
+    // auto_format_rules::detail::write_args<'|'>(text.get(), args...);
+    spdlog::log(loc, lvl, spdlog::string_view_t(text.get().data(), text.get().size()));
   }
 
-  // template <typename... args_tt>
-  // static void stm_test(const spdlog::source_loc &loc, spdlog::level::level_enum lvl, args_tt &&...args) {
-  //   spdlog::log(loc, lvl,
-  //     std::format(
-  //       auto_format_rules::detail::type_format_string_placeholders<args_tt...>::sv, std::forward<args_tt>(args)...));
-  // }
+  template <typename... args_tt>
+  static void stm(site_slot &slot, args_tt &&...args) {
+    emit<site_kind::stm>(slot, std::forward<args_tt>(args)...);
+  }
+
+  // one KV_INFO line summing up an interval's snapshot, see telemetry_options::summary_interval
+  static void log_telemetry(const telemetry_snapshot &interval);
+
+  // KV_*: the site holds the message and the keys, the values are encoded by type as kv_format says
+  template <typename... args_tt>
+  static void kv(site_slot &slot, args_tt &&...args) {
+    emit<site_kind::kv>(slot, std::forward<args_tt>(args)...);
+  }
 
  private:
   easy_logger() = default;
@@ -215,172 +762,332 @@ class easy_logger final : public easy_logger_static {
 };
 }  // namespace util::logger
 
-// default
-// use fmt lib, e.g. LOG_TRACE("warn log, {1}, {1}, {2}", 1, 2);
-#define LOG_TRACE(msg, ...)                                                                                  \
-  {                                                                                                          \
-    if (util::logger::easy_logger_static::should_log(spdlog::level::trace)) {                                \
-      constexpr auto lg_sl = logger_source_location::current();                                              \
-      constexpr auto lg_rfn = util::logger::easy_logger_static::get_relative_path(lg_sl.file_name());        \
-      util::logger::easy_logger::log(                                                                        \
-        {lg_rfn.data(), lg_sl.line(), lg_sl.function_name()}, spdlog::level::trace, msg, ##__VA_ARGS__);     \
-    }                                                                                                        \
-  }
-#define LOG_DEBUG(msg, ...)                                                                                  \
-  {                                                                                                          \
-    if (util::logger::easy_logger_static::should_log(spdlog::level::debug)) {                                \
-      constexpr auto lg_sl = logger_source_location::current();                                              \
-      constexpr auto lg_rfn = util::logger::easy_logger_static::get_relative_path(lg_sl.file_name());        \
-      util::logger::easy_logger::log(                                                                        \
-        {lg_rfn.data(), lg_sl.line(), lg_sl.function_name()}, spdlog::level::debug, msg, ##__VA_ARGS__);     \
-    }                                                                                                        \
-  }
-#define LOG_INFO(msg, ...)                                                                                  \
-  {                                                                                                         \
-    if (util::logger::easy_logger_static::should_log(spdlog::level::info)) {                                \
-      constexpr auto lg_sl = logger_source_location::current();                                             \
-      constexpr auto lg_rfn = util::logger::easy_logger_static::get_relative_path(lg_sl.file_name());       \
-      util::logger::easy_logger::log(                                                                       \
-        {lg_rfn.data(), lg_sl.line(), lg_sl.function_name()}, spdlog::level::info, msg, ##__VA_ARGS__);     \
-    }                                                                                                       \
-  }
-#define LOG_WARN(msg, ...)                                                                                  \
-  {                                                                                                         \
-    if (util::logger::easy_logger_static::should_log(spdlog::level::warn)) {                                \
-      constexpr auto lg_sl = logger_source_location::current();                                             \
-      constexpr auto lg_rfn = util::logger::easy_logger_static::get_relative_path(lg_sl.file_name());       \
-      util::logger::easy_logger::log(                                                                       \
-        {lg_rfn.data(), lg_sl.line(), lg_sl.function_name()}, spdlog::level::warn, msg, ##__VA_ARGS__);     \
-    }                                                                                                       \
-  }
-#define LOG_ERROR(msg, ...)                                                                                \
-  {                                                                                                        \
-    if (util::logger::easy_logger_static::should_log(spdlog::level::err)) {                                \
-      constexpr auto lg_sl = logger_source_location::current();                                            \
-      constexpr auto lg_rfn = util::logger::easy_logger_static::get_relative_path(lg_sl.file_name());      \
-      util::logger::easy_logger::log(                                                                      \
-        {lg_rfn.data(), lg_sl.line(), lg_sl.function_name()}, spdlog::level::err, msg, ##__VA_ARGS__);     \
-    }                                                                                                      \
-  }
-#define LOG_CRIT(msg, ...)                                                                                      \
-  {                                                                                                             \
-    if (util::logger::easy_logger_static::should_log(spdlog::level::critical)) {                                \
-      constexpr auto lg_sl = logger_source_location::current();                                                 \
-      constexpr auto lg_rfn = util::logger::easy_logger_static::get_relative_path(lg_sl.file_name());           \
-      util::logger::easy_logger::log(                                                                           \
-        {lg_rfn.data(), lg_sl.line(), lg_sl.function_name()}, spdlog::level::critical, msg, ##__VA_ARGS__);     \
-    }                                                                                                           \
+// sites below EASY_LOGGER_ACTIVE_LEVEL (one of SPDLOG_LEVEL_*) are compiled out, arguments included
+#ifndef EASY_LOGGER_ACTIVE_LEVEL
+#define EASY_LOGGER_ACTIVE_LEVEL SPDLOG_LEVEL_TRACE
+#endif
+
+#if EASY_LOGGER_ACTIVE_LEVEL <= SPDLOG_LEVEL_TRACE
+#define EASY_LOGGER_IF_TRACE_(...) __VA_ARGS__
+#else
+#define EASY_LOGGER_IF_TRACE_(...) (void)0
+#endif
+#if EASY_LOGGER_ACTIVE_LEVEL <= SPDLOG_LEVEL_DEBUG
+#define EASY_LOGGER_IF_DEBUG_(...) __VA_ARGS__
+#else
+#define EASY_LOGGER_IF_DEBUG_(...) (void)0
+#endif
+#if EASY_LOGGER_ACTIVE_LEVEL <= SPDLOG_LEVEL_INFO
+#define EASY_LOGGER_IF_INFO_(...) __VA_ARGS__
+#else
+#define EASY_LOGGER_IF_INFO_(...) (void)0
+#endif
+#if EASY_LOGGER_ACTIVE_LEVEL <= SPDLOG_LEVEL_WARN
+#define EASY_LOGGER_IF_WARN_(...) __VA_ARGS__
+#else
+#define EASY_LOGGER_IF_WARN_(...) (void)0
+#endif
+#if EASY_LOGGER_ACTIVE_LEVEL <= SPDLOG_LEVEL_ERROR
+#define EASY_LOGGER_IF_ERROR_(...) __VA_ARGS__
+#else
+#define EASY_LOGGER_IF_ERROR_(...) (void)0
+#endif
+#if EASY_LOGGER_ACTIVE_LEVEL <= SPDLOG_LEVEL_CRITICAL
+#define EASY_LOGGER_IF_CRIT_(...) __VA_ARGS__
+#else
+#define EASY_LOGGER_IF_CRIT_(...) (void)0
+#endif
+
+// every macro expands to a static log_site registered once in site_registry, records only carry its id
+#define EASY_LOGGER_SITE_(lvl, fmt, compiled, kind, keys)                                             \
+  constexpr auto lg_sl = logger_source_location::current();                                           \
+  constexpr auto lg_rfn = util::logger::easy_logger_static::get_relative_path(lg_sl.file_name());     \
+  static constexpr util::logger::log_site lg_site{                                                    \
+    lvl, lg_rfn.data(), lg_sl.line(), lg_sl.function_name(), fmt, compiled, kind, keys};              \
+  static util::logger::site_slot lg_slot{lg_site};
+
+// PRINT_*/STM_*: fmt is not a std::format string
+#define EASY_LOGGER_SITE_CALL_(lvl, fmt, func, ...)                                                   \
+  {                                                                                                   \
+    if (util::logger::easy_logger_static::should_log(lvl)) {                                          \
+      EASY_LOGGER_SITE_(lvl, fmt, {}, util::logger::site_kind::func, {})                              \
+      if (util::logger::easy_logger_static::should_log(lg_slot))                                      \
+        util::logger::easy_logger::func(lg_slot, ##__VA_ARGS__);                                        \
+      else if (util::logger::flight::recorder::records(lvl))                                          \
+        util::logger::easy_logger::record<util::logger::site_kind::func>(lg_slot, ##__VA_ARGS__);       \
+    }                                                                                                 \
   }
 
-// use like sprintf, e.g. PRINT_TRACE("warn log, %d-%d", 1, 2);
-#define PRINT_TRACE(msg, ...)                                                                                \
-  {                                                                                                          \
-    if (util::logger::easy_logger_static::should_log(spdlog::level::trace)) {                                \
-      constexpr auto lg_sl = logger_source_location::current();                                              \
-      constexpr auto lg_rfn = util::logger::easy_logger_static::get_relative_path(lg_sl.file_name());        \
-      util::logger::easy_logger::print(                                                                      \
-        {lg_rfn.data(), lg_sl.line(), lg_sl.function_name()}, spdlog::level::trace, msg, ##__VA_ARGS__);     \
-    }                                                                                                        \
-  }
-
-#define PRINT_DEBUG(msg, ...)                                                                                \
-  {                                                                                                          \
-    if (util::logger::easy_logger_static::should_log(spdlog::level::debug)) {                                \
-      constexpr auto lg_sl = logger_source_location::current();                                              \
-      constexpr auto lg_rfn = util::logger::easy_logger_static::get_relative_path(lg_sl.file_name());        \
-      util::logger::easy_logger::print(                                                                      \
-        {lg_rfn.data(), lg_sl.line(), lg_sl.function_name()}, spdlog::level::debug, msg, ##__VA_ARGS__);     \
-    }                                                                                                        \
-  }
-#define PRINT_INFO(msg, ...)                                                                                \
-  {                                                                                                         \
-    if (util::logger::easy_logger_static::should_log(spdlog::level::info)) {                                \
-      constexpr auto lg_sl = logger_source_location::current();                                             \
-      constexpr auto lg_rfn = util::logger::easy_logger_static::get_relative_path(lg_sl.file_name());       \
-      util::logger::easy_logger::print(                                                                     \
-        {lg_rfn.data(), lg_sl.line(), lg_sl.function_name()}, spdlog::level::info, msg, ##__VA_ARGS__);     \
-    }                                                                                                       \
-  }
-#define PRINT_WARN(msg, ...)                                                                                \
-  {                                                                                                         \
-    if (util::logger::easy_logger_static::should_log(spdlog::level::warn)) {                                \
-      constexpr auto lg_sl = logger_source_location::current();                                             \
-      constexpr auto lg_rfn = util::logger::easy_logger_static::get_relative_path(lg_sl.file_name());       \
-      util::logger::easy_logger::print(                                                                     \
-        {lg_rfn.data(), lg_sl.line(), lg_sl.function_name()}, spdlog::level::warn, msg, ##__VA_ARGS__);     \
-    }                                                                                                       \
-  }
-#define PRINT_ERROR(msg, ...)                                                                              \
-  {                                                                                                        \
-    if (util::logger::easy_logger_static::should_log(spdlog::level::err)) {                                \
-      constexpr auto lg_sl = logger_source_location::current();                                            \
-      constexpr auto lg_rfn = util::logger::easy_logger_static::get_relative_path(lg_sl.file_name());      \
-      util::logger::easy_logger::print(                                                                    \
-        {lg_rfn.data(), lg_sl.line(), lg_sl.function_name()}, spdlog::level::err, msg, ##__VA_ARGS__);     \
-    }                                                                                                      \
-  }
-#define PRINT_CRIT(msg, ...)                                                                                    \
-  {                                                                                                             \
-    if (util::logger::easy_logger_static::should_log(spdlog::level::critical)) {                                \
-      constexpr auto lg_sl = logger_source_location::current();                                                 \
-      constexpr auto lg_rfn = util::logger::easy_logger_static::get_relative_path(lg_sl.file_name());           \
-      util::logger::easy_logger::print(                                                                         \
-        {lg_rfn.data(), lg_sl.line(), lg_sl.function_name()}, spdlog::level::critical, msg, ##__VA_ARGS__);     \
-    }                                                                                                           \
+// LOG_*: fmt is checked against the arguments and split into pieces at compile time
+#define EASY_LOGGER_FORMAT_CALL_(lvl, fmt, ...)                                                       \
+  {                                                                                                   \
+    if (util::logger::easy_logger_static::should_log(lvl)) {                                          \
+      constexpr auto lg_shape = util::logger::measure_format(fmt);                                    \
+      static constexpr auto lg_fmt = util::logger::compile_format<lg_shape.segments, lg_shape.chars>(fmt); \
+      EASY_LOGGER_SITE_(lvl, fmt, lg_fmt.view(), util::logger::site_kind::log, {})                    \
+      if (util::logger::easy_logger_static::should_log(lg_slot))                                      \
+        util::logger::easy_logger::log(lg_slot, fmt, ##__VA_ARGS__);                                    \
+      else if (util::logger::flight::recorder::records(lvl))                                          \
+        util::logger::easy_logger::record<util::logger::site_kind::log>(lg_slot, ##__VA_ARGS__);        \
+    }                                                                                                 \
   }
 
-// use like std::format, e.g. STM_TRACE("warn log:", 1, '\t', 2);
-#define STM_TRACE(...)                                                                                  \
-  {                                                                                                     \
-    if (util::logger::easy_logger_static::should_log(spdlog::level::trace)) {                           \
-      constexpr auto lg_sl = logger_source_location::current();                                         \
-      constexpr auto lg_rfn = util::logger::easy_logger_static::get_relative_path(lg_sl.file_name());   \
-      util::logger::easy_logger::stm(                                                                   \
-        {lg_rfn.data(), lg_sl.line(), lg_sl.function_name()}, spdlog::level::trace, ##__VA_ARGS__);     \
-    }                                                                                                   \
-  }
-#define STM_DEBUG(...)                                                                                  \
-  {                                                                                                     \
-    if (util::logger::easy_logger_static::should_log(spdlog::level::debug)) {                           \
-      constexpr auto lg_sl = logger_source_location::current();                                         \
-      constexpr auto lg_rfn = util::logger::easy_logger_static::get_relative_path(lg_sl.file_name());   \
-      util::logger::easy_logger::stm(                                                                   \
-        {lg_rfn.data(), lg_sl.line(), lg_sl.function_name()}, spdlog::level::debug, ##__VA_ARGS__);     \
-    }                                                                                                   \
-  }
-#define STM_INFO(...)                                                                                  \
-  {                                                                                                    \
-    if (util::logger::easy_logger_static::should_log(spdlog::level::info)) {                           \
-      constexpr auto lg_sl = logger_source_location::current();                                        \
-      constexpr auto lg_rfn = util::logger::easy_logger_static::get_relative_path(lg_sl.file_name());  \
-      util::logger::easy_logger::stm(                                                                  \
-        {lg_rfn.data(), lg_sl.line(), lg_sl.function_name()}, spdlog::level::info, ##__VA_ARGS__);     \
-    }                                                                                                  \
-  }
-#define STM_WARN(msg, ...)                                                                             \
-  {                                                                                                    \
-    if (util::logger::easy_logger_static::should_log(spdlog::level::warn)) {                           \
-      constexpr auto lg_sl = logger_source_location::current();                                        \
-      constexpr auto lg_rfn = util::logger::easy_logger_static::get_relative_path(lg_sl.file_name());  \
-      util::logger::easy_logger::stm(                                                                  \
-        {lg_rfn.data(), lg_sl.line(), lg_sl.function_name()}, spdlog::level::warn, ##__VA_ARGS__);     \
-    }                                                                                                  \
-  }
-#define STM_ERROR(msg, ...)                                                                           \
+// LOG_*_ONCE and friends: limit is a constant util::logger::log_limit, state lives next to the site
+#define EASY_LOGGER_LIMITED_CALL_(lvl, limit, fmt, ...)                                               \
   {                                                                                                   \
-    if (util::logger::easy_logger_static::should_log(spdlog::level::err)) {                           \
-      constexpr auto lg_sl = logger_source_location::current();                                       \
-      constexpr auto lg_rfn = util::logger::easy_logger_static::get_relative_path(lg_sl.file_name()); \
-      util::logger::easy_logger::stm(                                                                 \
-        {lg_rfn.data(), lg_sl.line(), lg_sl.function_name()}, spdlog::level::err, ##__VA_ARGS__);     \
+    if (util::logger::easy_logger_static::should_log(lvl)) {                                          \
+      static constexpr util::logger::log_limit lg_limit = limit;                                      \
+      static util::logger::site_limiter lg_limiter;                                                   \
+      constexpr auto lg_shape = util::logger::measure_format(fmt);                                    \
+      static constexpr auto lg_fmt = util::logger::compile_format<lg_shape.segments, lg_shape.chars>(fmt); \
+      EASY_LOGGER_SITE_(lvl, fmt, lg_fmt.view(), util::logger::site_kind::log, {})                    \
+      constexpr auto lg_summary_shape = util::logger::measure_format(lg_limit.summary());             \
+      static constexpr auto lg_summary_fmt =                                                          \
+        util::logger::compile_format<lg_summary_shape.segments, lg_summary_shape.chars>(lg_limit.summary()); \
+      static constexpr util::logger::log_site lg_summary_site{lvl, lg_site.file, lg_site.line,        \
+        lg_site.function, lg_limit.summary(), lg_summary_fmt.view(), util::logger::site_kind::log};   \
+      static util::logger::site_slot lg_summary_slot{lg_summary_site};                                \
+      if (util::logger::easy_logger_static::should_log(lg_slot))                                      \
+        util::logger::easy_logger::log_limited(lg_limiter, lg_limit, lg_summary_slot, lg_slot, fmt, ##__VA_ARGS__); \
+      else if (util::logger::flight::recorder::records(lvl))                                          \
+        util::logger::easy_logger::record_limited(lg_limiter, lg_limit, lg_slot, ##__VA_ARGS__);        \
     }                                                                                                 \
   }
-#define STM_CRIT(msg, ...)                                                                                 \
-  {                                                                                                        \
-    if (util::logger::easy_logger_static::should_log(spdlog::level::critical)) {                           \
-      constexpr auto lg_sl = logger_source_location::current();                                            \
-      constexpr auto lg_rfn = util::logger::easy_logger_static::get_relative_path(lg_sl.file_name());      \
-      util::logger::easy_logger::stm(                                                                      \
-        {lg_rfn.data(), lg_sl.line(), lg_sl.function_name()}, spdlog::level::critical, ##__VA_ARGS__); \
-    }                                                                                                      \
+
+// LOG_*_CH: the site looks its channel up once
+#define EASY_LOGGER_CHANNEL_CALL_(ch, lvl, fmt, ...)                                                  \
+  {                                                                                                   \
+    static util::logger::channel_handle lg_channel{#ch};                                              \
+    if (util::logger::easy_logger_static::should_log(lg_channel.get(), lvl)) {                        \
+      constexpr auto lg_shape = util::logger::measure_format(fmt);                                    \
+      static constexpr auto lg_fmt = util::logger::compile_format<lg_shape.segments, lg_shape.chars>(fmt); \
+      EASY_LOGGER_SITE_(lvl, fmt, lg_fmt.view(), util::logger::site_kind::log, {})                    \
+      util::logger::easy_logger::log_channel(lg_channel.get(), lg_slot, fmt, ##__VA_ARGS__);           \
+    }                                                                                                 \
+  }
+
+// KV_*: msg and the keys are literals kept with the site, the values are the only arguments
+#define EASY_LOGGER_KV_CALL_(lvl, msg, ...)                                                           \
+  {                                                                                                   \
+    if (util::logger::easy_logger_static::should_log(lvl)) {                                          \
+      static constexpr auto lg_keys =                                                                 \
+        util::logger::kv::make_keys(EASY_LOGGER_KV_KEYS_(msg, ##__VA_ARGS__));                         \
+      static_assert(util::logger::kv::valid_keys(lg_keys), "KV_* keys are literals of [A-Za-z0-9_.-], not msg"); \
+      EASY_LOGGER_SITE_(lvl, msg, {}, util::logger::site_kind::kv, lg_keys)                           \
+      if (util::logger::easy_logger_static::should_log(lg_slot))                                      \
+        util::logger::easy_logger::kv(lg_slot EASY_LOGGER_KV_VALUES_(msg, ##__VA_ARGS__));           \
+      else if (util::logger::flight::recorder::records(lvl))                                          \
+        util::logger::easy_logger::record<util::logger::site_kind::kv>(lg_slot EASY_LOGGER_KV_VALUES_(msg, ##__VA_ARGS__)); \
+    }                                                                                                 \
+  }
+
+// splits "k1, v1, k2, v2, ..." into "k1, k2, ..." and ", v1, v2, ...", up to 12 pairs;
+// an odd count fails on an undefined EASY_LOGGER_KV_KEYS_<n>
+#define EASY_LOGGER_KV_EXPAND_(x) x
+#define EASY_LOGGER_KV_CAT_(a, b) EASY_LOGGER_KV_CAT2_(a, b)
+#define EASY_LOGGER_KV_CAT2_(a, b) a##b
+#define EASY_LOGGER_KV_COUNT_(msg, ...) EASY_LOGGER_KV_EXPAND_(EASY_LOGGER_KV_COUNT_N_(msg, ##__VA_ARGS__, 24, 23, 22, \
+  21, 20, 19, 18, 17, 16, 15, 14, 13, 12, 11, 10, 9, 8, 7, 6, 5, 4, 3, 2, 1, 0))
+#define EASY_LOGGER_KV_COUNT_N_(_0, _1, _2, _3, _4, _5, _6, _7, _8, _9, _10, _11, _12, _13, _14, _15, _16, _17, _18, _19, \
+  _20, _21, _22, _23, _24, n, ...) n
+#define EASY_LOGGER_KV_KEYS_(msg, ...)                                                                    \
+  EASY_LOGGER_KV_EXPAND_(                                                                                 \
+    EASY_LOGGER_KV_CAT_(EASY_LOGGER_KV_KEYS_, EASY_LOGGER_KV_COUNT_(msg, ##__VA_ARGS__))(__VA_ARGS__))
+#define EASY_LOGGER_KV_VALUES_(msg, ...)                                                                  \
+  EASY_LOGGER_KV_EXPAND_(                                                                                 \
+    EASY_LOGGER_KV_CAT_(EASY_LOGGER_KV_VALUES_, EASY_LOGGER_KV_COUNT_(msg, ##__VA_ARGS__))(__VA_ARGS__))
+#define EASY_LOGGER_KV_KEYS_0()
+#define EASY_LOGGER_KV_KEYS_2(k, v) k
+#define EASY_LOGGER_KV_KEYS_4(k, v, ...) k, EASY_LOGGER_KV_EXPAND_(EASY_LOGGER_KV_KEYS_2(__VA_ARGS__))
+#define EASY_LOGGER_KV_KEYS_6(k, v, ...) k, EASY_LOGGER_KV_EXPAND_(EASY_LOGGER_KV_KEYS_4(__VA_ARGS__))
+#define EASY_LOGGER_KV_KEYS_8(k, v, ...) k, EASY_LOGGER_KV_EXPAND_(EASY_LOGGER_KV_KEYS_6(__VA_ARGS__))
+#define EASY_LOGGER_KV_KEYS_10(k, v, ...) k, EASY_LOGGER_KV_EXPAND_(EASY_LOGGER_KV_KEYS_8(__VA_ARGS__))
+#define EASY_LOGGER_KV_KEYS_12(k, v, ...) k, EASY_LOGGER_KV_EXPAND_(EASY_LOGGER_KV_KEYS_10(__VA_ARGS__))
+#define EASY_LOGGER_KV_KEYS_14(k, v, ...) k, EASY_LOGGER_KV_EXPAND_(EASY_LOGGER_KV_KEYS_12(__VA_ARGS__))
+#define EASY_LOGGER_KV_KEYS_16(k, v, ...) k, EASY_LOGGER_KV_EXPAND_(EASY_LOGGER_KV_KEYS_14(__VA_ARGS__))
+#define EASY_LOGGER_KV_KEYS_18(k, v, ...) k, EASY_LOGGER_KV_EXPAND_(EASY_LOGGER_KV_KEYS_16(__VA_ARGS__))
+#define EASY_LOGGER_KV_KEYS_20(k, v, ...) k, EASY_LOGGER_KV_EXPAND_(EASY_LOGGER_KV_KEYS_18(__VA_ARGS__))
+#define EASY_LOGGER_KV_KEYS_22(k, v, ...) k, EASY_LOGGER_KV_EXPAND_(EASY_LOGGER_KV_KEYS_20(__VA_ARGS__))
+#define EASY_LOGGER_KV_KEYS_24(k, v, ...) k, EASY_LOGGER_KV_EXPAND_(EASY_LOGGER_KV_KEYS_22(__VA_ARGS__))
+#define EASY_LOGGER_KV_VALUES_0()
+#define EASY_LOGGER_KV_VALUES_2(k, v) , v
+#define EASY_LOGGER_KV_VALUES_4(k, v, ...) , v EASY_LOGGER_KV_EXPAND_(EASY_LOGGER_KV_VALUES_2(__VA_ARGS__))
+#define EASY_LOGGER_KV_VALUES_6(k, v, ...) , v EASY_LOGGER_KV_EXPAND_(EASY_LOGGER_KV_VALUES_4(__VA_ARGS__))
+#define EASY_LOGGER_KV_VALUES_8(k, v, ...) , v EASY_LOGGER_KV_EXPAND_(EASY_LOGGER_KV_VALUES_6(__VA_ARGS__))
+#define EASY_LOGGER_KV_VALUES_10(k, v, ...) , v EASY_LOGGER_KV_EXPAND_(EASY_LOGGER_KV_VALUES_8(__VA_ARGS__))
+#define EASY_LOGGER_KV_VALUES_12(k, v, ...) , v EASY_LOGGER_KV_EXPAND_(EASY_LOGGER_KV_VALUES_10(__VA_ARGS__))
+#define EASY_LOGGER_KV_VALUES_14(k, v, ...) , v EASY_LOGGER_KV_EXPAND_(EASY_LOGGER_KV_VALUES_12(__VA_ARGS__))
+#define EASY_LOGGER_KV_VALUES_16(k, v, ...) , v EASY_LOGGER_KV_EXPAND_(EASY_LOGGER_KV_VALUES_14(__VA_ARGS__))
+#define EASY_LOGGER_KV_VALUES_18(k, v, ...) , v EASY_LOGGER_KV_EXPAND_(EASY_LOGGER_KV_VALUES_16(__VA_ARGS__))
+#define EASY_LOGGER_KV_VALUES_20(k, v, ...) , v EASY_LOGGER_KV_EXPAND_(EASY_LOGGER_KV_VALUES_18(__VA_ARGS__))
+#define EASY_LOGGER_KV_VALUES_22(k, v, ...) , v EASY_LOGGER_KV_EXPAND_(EASY_LOGGER_KV_VALUES_20(__VA_ARGS__))
+#define EASY_LOGGER_KV_VALUES_24(k, v, ...) , v EASY_LOGGER_KV_EXPAND_(EASY_LOGGER_KV_VALUES_22(__VA_ARGS__))
+
+// default
+// use fmt lib, e.g. LOG_TRACE("warn log, {1}, {1}, {2}", 1, 2);
+#define LOG_TRACE(msg, ...) \
+  EASY_LOGGER_IF_TRACE_(EASY_LOGGER_FORMAT_CALL_(spdlog::level::trace, msg, ##__VA_ARGS__))
+#define LOG_DEBUG(msg, ...) \
+  EASY_LOGGER_IF_DEBUG_(EASY_LOGGER_FORMAT_CALL_(spdlog::level::debug, msg, ##__VA_ARGS__))
+#define LOG_INFO(msg, ...) \
+  EASY_LOGGER_IF_INFO_(EASY_LOGGER_FORMAT_CALL_(spdlog::level::info, msg, ##__VA_ARGS__))
+#define LOG_WARN(msg, ...) \
+  EASY_LOGGER_IF_WARN_(EASY_LOGGER_FORMAT_CALL_(spdlog::level::warn, msg, ##__VA_ARGS__))
+#define LOG_ERROR(msg, ...) \
+  EASY_LOGGER_IF_ERROR_(EASY_LOGGER_FORMAT_CALL_(spdlog::level::err, msg, ##__VA_ARGS__))
+#define LOG_CRIT(msg, ...) \
+  EASY_LOGGER_IF_CRIT_(EASY_LOGGER_FORMAT_CALL_(spdlog::level::critical, msg, ##__VA_ARGS__))
+
+// to a named channel, e.g. LOG_INFO_CH(access, "{} {} {}", method, path, status); see easy_logger::add_channel
+#define LOG_TRACE_CH(channel, msg, ...) \
+  EASY_LOGGER_IF_TRACE_(EASY_LOGGER_CHANNEL_CALL_(channel, spdlog::level::trace, msg, ##__VA_ARGS__))
+#define LOG_DEBUG_CH(channel, msg, ...) \
+  EASY_LOGGER_IF_DEBUG_(EASY_LOGGER_CHANNEL_CALL_(channel, spdlog::level::debug, msg, ##__VA_ARGS__))
+#define LOG_INFO_CH(channel, msg, ...) \
+  EASY_LOGGER_IF_INFO_(EASY_LOGGER_CHANNEL_CALL_(channel, spdlog::level::info, msg, ##__VA_ARGS__))
+#define LOG_WARN_CH(channel, msg, ...) \
+  EASY_LOGGER_IF_WARN_(EASY_LOGGER_CHANNEL_CALL_(channel, spdlog::level::warn, msg, ##__VA_ARGS__))
+#define LOG_ERROR_CH(channel, msg, ...) \
+  EASY_LOGGER_IF_ERROR_(EASY_LOGGER_CHANNEL_CALL_(channel, spdlog::level::err, msg, ##__VA_ARGS__))
+#define LOG_CRIT_CH(channel, msg, ...) \
+  EASY_LOGGER_IF_CRIT_(EASY_LOGGER_CHANNEL_CALL_(channel, spdlog::level::critical, msg, ##__VA_ARGS__))
+
+// rate limited, e.g. LOG_ERROR_RATE(10, std::chrono::seconds(1), "request failed: {}", code);
+// _ONCE: the first record only, _EVERY_N: every n-th, _RATE: at most count per interval (token bucket),
+// _DEDUP: identical consecutive records within interval are folded into "last message repeated N times"
+#define LOG_TRACE_ONCE(msg, ...) \
+  EASY_LOGGER_IF_TRACE_(         \
+    EASY_LOGGER_LIMITED_CALL_(spdlog::level::trace, util::logger::log_limit::once(), msg, ##__VA_ARGS__))
+#define LOG_DEBUG_ONCE(msg, ...) \
+  EASY_LOGGER_IF_DEBUG_(         \
+    EASY_LOGGER_LIMITED_CALL_(spdlog::level::debug, util::logger::log_limit::once(), msg, ##__VA_ARGS__))
+#define LOG_INFO_ONCE(msg, ...) \
+  EASY_LOGGER_IF_INFO_(         \
+    EASY_LOGGER_LIMITED_CALL_(spdlog::level::info, util::logger::log_limit::once(), msg, ##__VA_ARGS__))
+#define LOG_WARN_ONCE(msg, ...) \
+  EASY_LOGGER_IF_WARN_(         \
+    EASY_LOGGER_LIMITED_CALL_(spdlog::level::warn, util::logger::log_limit::once(), msg, ##__VA_ARGS__))
+#define LOG_ERROR_ONCE(msg, ...) \
+  EASY_LOGGER_IF_ERROR_(         \
+    EASY_LOGGER_LIMITED_CALL_(spdlog::level::err, util::logger::log_limit::once(), msg, ##__VA_ARGS__))
+#define LOG_CRIT_ONCE(msg, ...) \
+  EASY_LOGGER_IF_CRIT_(         \
+    EASY_LOGGER_LIMITED_CALL_(spdlog::level::critical, util::logger::log_limit::once(), msg, ##__VA_ARGS__))
+#define LOG_TRACE_EVERY_N(n, msg, ...) \
+  EASY_LOGGER_IF_TRACE_(               \
+    EASY_LOGGER_LIMITED_CALL_(spdlog::level::trace, util::logger::log_limit::every_n(n), msg, ##__VA_ARGS__))
+#define LOG_DEBUG_EVERY_N(n, msg, ...) \
+  EASY_LOGGER_IF_DEBUG_(               \
+    EASY_LOGGER_LIMITED_CALL_(spdlog::level::debug, util::logger::log_limit::every_n(n), msg, ##__VA_ARGS__))
+#define LOG_INFO_EVERY_N(n, msg, ...) \
+  EASY_LOGGER_IF_INFO_(               \
+    EASY_LOGGER_LIMITED_CALL_(spdlog::level::info, util::logger::log_limit::every_n(n), msg, ##__VA_ARGS__))
+#define LOG_WARN_EVERY_N(n, msg, ...) \
+  EASY_LOGGER_IF_WARN_(               \
+    EASY_LOGGER_LIMITED_CALL_(spdlog::level::warn, util::logger::log_limit::every_n(n), msg, ##__VA_ARGS__))
+#define LOG_ERROR_EVERY_N(n, msg, ...) \
+  EASY_LOGGER_IF_ERROR_(               \
+    EASY_LOGGER_LIMITED_CALL_(spdlog::level::err, util::logger::log_limit::every_n(n), msg, ##__VA_ARGS__))
+#define LOG_CRIT_EVERY_N(n, msg, ...) \
+  EASY_LOGGER_IF_CRIT_(               \
+    EASY_LOGGER_LIMITED_CALL_(spdlog::level::critical, util::logger::log_limit::every_n(n), msg, ##__VA_ARGS__))
+#define LOG_TRACE_RATE(count, interval, msg, ...) \
+  EASY_LOGGER_IF_TRACE_(                          \
+    EASY_LOGGER_LIMITED_CALL_(spdlog::level::trace, util::logger::log_limit::rate(count, interval), msg, ##__VA_ARGS__))
+#define LOG_DEBUG_RATE(count, interval, msg, ...) \
+  EASY_LOGGER_IF_DEBUG_(                          \
+    EASY_LOGGER_LIMITED_CALL_(spdlog::level::debug, util::logger::log_limit::rate(count, interval), msg, ##__VA_ARGS__))
+#define LOG_INFO_RATE(count, interval, msg, ...) \
+  EASY_LOGGER_IF_INFO_(                          \
+    EASY_LOGGER_LIMITED_CALL_(spdlog::level::info, util::logger::log_limit::rate(count, interval), msg, ##__VA_ARGS__))
+#define LOG_WARN_RATE(count, interval, msg, ...) \
+  EASY_LOGGER_IF_WARN_(                          \
+    EASY_LOGGER_LIMITED_CALL_(spdlog::level::warn, util::logger::log_limit::rate(count, interval), msg, ##__VA_ARGS__))
+#define LOG_ERROR_RATE(count, interval, msg, ...) \
+  EASY_LOGGER_IF_ERROR_(                          \
+    EASY_LOGGER_LIMITED_CALL_(spdlog::level::err, util::logger::log_limit::rate(count, interval), msg, ##__VA_ARGS__))
+#define LOG_CRIT_RATE(count, interval, msg, ...) \
+  EASY_LOGGER_IF_CRIT_(                          \
+    EASY_LOGGER_LIMITED_CALL_(spdlog::level::critical, util::logger::log_limit::rate(count, interval), msg, ##__VA_ARGS__))
+#define LOG_TRACE_DEDUP(interval, msg, ...) \
+  EASY_LOGGER_IF_TRACE_(                    \
+    EASY_LOGGER_LIMITED_CALL_(spdlog::level::trace, util::logger::log_limit::dedup(interval), msg, ##__VA_ARGS__))
+#define LOG_DEBUG_DEDUP(interval, msg, ...) \
+  EASY_LOGGER_IF_DEBUG_(                    \
+    EASY_LOGGER_LIMITED_CALL_(spdlog::level::debug, util::logger::log_limit::dedup(interval), msg, ##__VA_ARGS__))
+#define LOG_INFO_DEDUP(interval, msg, ...) \
+  EASY_LOGGER_IF_INFO_(                    \
+    EASY_LOGGER_LIMITED_CALL_(spdlog::level::info, util::logger::log_limit::dedup(interval), msg, ##__VA_ARGS__))
+#define LOG_WARN_DEDUP(interval, msg, ...) \
+  EASY_LOGGER_IF_WARN_(                    \
+    EASY_LOGGER_LIMITED_CALL_(spdlog::level::warn, util::logger::log_limit::dedup(interval), msg, ##__VA_ARGS__))
+#define LOG_ERROR_DEDUP(interval, msg, ...) \
+  EASY_LOGGER_IF_ERROR_(                    \
+    EASY_LOGGER_LIMITED_CALL_(spdlog::level::err, util::logger::log_limit::dedup(interval), msg, ##__VA_ARGS__))
+#define LOG_CRIT_DEDUP(interval, msg, ...) \
+  EASY_LOGGER_IF_CRIT_(                    \
+    EASY_LOGGER_LIMITED_CALL_(spdlog::level::critical, util::logger::log_limit::dedup(interval), msg, ##__VA_ARGS__))
+
+// use like sprintf, e.g. PRINT_TRACE("warn log, %d-%d", 1, 2);
+#define PRINT_TRACE(msg, ...) \
+  EASY_LOGGER_IF_TRACE_(EASY_LOGGER_SITE_CALL_(spdlog::level::trace, msg, print, ##__VA_ARGS__))
+#define PRINT_DEBUG(msg, ...) \
+  EASY_LOGGER_IF_DEBUG_(EASY_LOGGER_SITE_CALL_(spdlog::level::debug, msg, print, ##__VA_ARGS__))
+#define PRINT_INFO(msg, ...) \
+  EASY_LOGGER_IF_INFO_(EASY_LOGGER_SITE_CALL_(spdlog::level::info, msg, print, ##__VA_ARGS__))
+#define PRINT_WARN(msg, ...) \
+  EASY_LOGGER_IF_WARN_(EASY_LOGGER_SITE_CALL_(spdlog::level::warn, msg, print, ##__VA_ARGS__))
+#define PRINT_ERROR(msg, ...) \
+  EASY_LOGGER_IF_ERROR_(EASY_LOGGER_SITE_CALL_(spdlog::level::err, msg, print, ##__VA_ARGS__))
+#define PRINT_CRIT(msg, ...) \
+  EASY_LOGGER_IF_CRIT_(EASY_LOGGER_SITE_CALL_(spdlog::level::critical, msg, print, ##__VA_ARGS__))
+
+// use like std::format, e.g. STM_TRACE("warn log:", 1, '\t', 2);
+#define STM_TRACE(...) \
+  EASY_LOGGER_IF_TRACE_(EASY_LOGGER_SITE_CALL_(spdlog::level::trace, "", stm, __VA_ARGS__))
+#define STM_DEBUG(...) \
+  EASY_LOGGER_IF_DEBUG_(EASY_LOGGER_SITE_CALL_(spdlog::level::debug, "", stm, __VA_ARGS__))
+#define STM_INFO(...) \
+  EASY_LOGGER_IF_INFO_(EASY_LOGGER_SITE_CALL_(spdlog::level::info, "", stm, __VA_ARGS__))
+#define STM_WARN(...) \
+  EASY_LOGGER_IF_WARN_(EASY_LOGGER_SITE_CALL_(spdlog::level::warn, "", stm, __VA_ARGS__))
+#define STM_ERROR(...) \
+  EASY_LOGGER_IF_ERROR_(EASY_LOGGER_SITE_CALL_(spdlog::level::err, "", stm, __VA_ARGS__))
+#define STM_CRIT(...) \
+  EASY_LOGGER_IF_CRIT_(EASY_LOGGER_SITE_CALL_(spdlog::level::critical, "", stm, __VA_ARGS__))
+
+// structured, e.g. KV_INFO("login", "user", id, "latency_us", t) -> msg=login user=42 latency_us=130
+#define KV_TRACE(msg, ...) \
+  EASY_LOGGER_IF_TRACE_(EASY_LOGGER_KV_CALL_(spdlog::level::trace, msg, ##__VA_ARGS__))
+#define KV_DEBUG(msg, ...) \
+  EASY_LOGGER_IF_DEBUG_(EASY_LOGGER_KV_CALL_(spdlog::level::debug, msg, ##__VA_ARGS__))
+#define KV_INFO(msg, ...) \
+  EASY_LOGGER_IF_INFO_(EASY_LOGGER_KV_CALL_(spdlog::level::info, msg, ##__VA_ARGS__))
+#define KV_WARN(msg, ...) \
+  EASY_LOGGER_IF_WARN_(EASY_LOGGER_KV_CALL_(spdlog::level::warn, msg, ##__VA_ARGS__))
+#define KV_ERROR(msg, ...) \
+  EASY_LOGGER_IF_ERROR_(EASY_LOGGER_KV_CALL_(spdlog::level::err, msg, ##__VA_ARGS__))
+#define KV_CRIT(msg, ...) \
+  EASY_LOGGER_IF_CRIT_(EASY_LOGGER_KV_CALL_(spdlog::level::critical, msg, ##__VA_ARGS__))
+
+inline void util::logger::easy_logger::log_telemetry(const telemetry_snapshot &interval) {
+  std::uint32_t top = invalid_site_id;
+  for (std::uint32_t id = 0; id < interval.sites.size(); ++id) {
+    if (interval.sites[id].messages != 0 &&
+        (top == invalid_site_id || interval.sites[id].messages > interval.sites[top].messages))
+      top = id;
+  }
+  std::string top_site;
+  if (top != invalid_site_id) {
+    const log_site &site = *site_registry::get()[top].site;
+    top_site = std::string(site.file) + ':' + std::to_string(site.line);
   }
+  [[maybe_unused]] const auto ns = [](std::chrono::nanoseconds value) { return value.count(); };
+  KV_INFO("logger telemetry", "messages", interval.total_messages(), "bytes", interval.total_bytes(),
+    "dropped", interval.dropped, "queue_high_water", interval.queue_high_water,
+    "queue_capacity", interval.queue_capacity, "enqueue_p50_ns", ns(interval.enqueue.percentile(0.5)),
+    "enqueue_p99_ns", ns(interval.enqueue.percentile(0.99)), "lag_p99_ns", ns(interval.lag.percentile(0.99)),
+    "sink_write_p99_ns", ns(interval.sink_write.percentile(0.99)),
+    "sink_flush_p99_ns", ns(interval.sink_flush.percentile(0.99)), "top_site", top_site,
+    "top_site_messages", top != invalid_site_id ? interval.sites[top].messages : 0);
+}
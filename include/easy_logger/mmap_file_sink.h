@@ -0,0 +1,304 @@
+//
+//  mmap_file_sink.h
+//  inlay
+//
+//  daily file sink without a write lock: the file is preallocated and mapped in large segments,
+//  writers reserve their bytes with one fetch_add on the file offset and copy the record in place
+//
+
+#pragma once
+
+#ifndef _WIN32
+
+#include <spdlog/details/os.h>
+#include <spdlog/pattern_formatter.h>
+#include <spdlog/sinks/sink.h>
+
+#include <algorithm>
+#include <array>
+#include <atomic>
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <list>
+#include <memory>
+#include <mutex>
+#include <string>
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <cerrno>
+
+#include "daily_rotation.h"
+#include "spsc_ring.h"
+
+namespace util::logger {
+
+struct mmap_options {
+  std::size_t segment_size = 1024ull * 1024 * 64;  // mapped and preallocated at a time, rounded to the page size
+  daily_rotation rotation;                         // rotation time, 00:02 as with init()'s daily_file_sink
+};
+
+// the bytes of a day's file are reserved by atomically moving its offset, every segment counts the bytes
+// copied into it and is unmapped by whichever writer completes it; the mapping is shared, so records
+// already copied survive a crash of the process, the preallocated tail stays zero filled until close
+class mmap_file_sink final : public spdlog::sinks::sink {
+ public:
+  static constexpr std::size_t max_segments = 4096;
+
+ private:
+  struct segment {
+    std::atomic<char *> data{nullptr};
+    std::atomic<std::size_t> committed{0};
+  };
+
+  struct file_state {
+    int fd = -1;
+    spdlog::filename_t filename;
+    std::size_t segment_size = 0;
+    std::size_t base = 0;  // bytes found in the file when it was opened
+    alignas(cache_line_size) std::atomic<std::size_t> offset{0};
+    alignas(cache_line_size) std::array<segment, max_segments> segments;
+  };
+
+  // each thread formats with its own clone of the sink's formatter, kept for the last few sinks it wrote to
+  struct local_formatter {
+    std::uint64_t owner = 0;
+    std::uint64_t version = 0;
+    std::unique_ptr<spdlog::formatter> formatter;
+    spdlog::memory_buf_t buffer;
+  };
+
+  static constexpr std::size_t local_formatters = 4;
+
+  static inline std::atomic<std::uint64_t> _next_id{1};
+
+  const std::uint64_t _id = _next_id.fetch_add(1);
+  spdlog::filename_t _base_filename;
+  mmap_options _options;
+
+  std::mutex _mutex;  // formatter changes, segment mapping and rotation only
+  std::unique_ptr<spdlog::formatter> _formatter;
+  std::atomic<std::uint64_t> _formatter_version{1};
+  std::atomic<file_state *> _state{nullptr};
+  std::list<std::unique_ptr<file_state>> _states;  // current day last, earlier ones finish their in-flight records
+  std::atomic<spdlog::log_clock::rep> _rotation_tp{0};
+  std::atomic<std::size_t> _dropped{0};
+
+ public:
+  explicit mmap_file_sink(spdlog::filename_t base_filename, const mmap_options &options = {})
+      : _base_filename(std::move(base_filename)), _options(options),
+        _formatter(std::make_unique<spdlog::pattern_formatter>()) {
+    _options.rotation.validate();
+    const auto page = static_cast<std::size_t>(::sysconf(_SC_PAGESIZE));
+    _options.segment_size = (std::max(_options.segment_size, page) + page - 1) / page * page;
+    std::lock_guard lock(_mutex);
+    rotate(spdlog::log_clock::now());
+  }
+
+  ~mmap_file_sink() override {
+    for (auto &state : _states)
+      finish(*state);
+  }
+
+  mmap_file_sink(const mmap_file_sink &) = delete;
+  void operator=(const mmap_file_sink &) = delete;
+
+  void log(const spdlog::details::log_msg &msg) override {
+    if (msg.time.time_since_epoch().count() >= _rotation_tp.load(std::memory_order_acquire)) {
+      std::lock_guard lock(_mutex);
+      if (msg.time.time_since_epoch().count() >= _rotation_tp.load(std::memory_order_relaxed))
+        rotate(msg.time);
+    }
+
+    auto &local = formatter();
+    local.buffer.clear();
+    local.formatter->format(msg, local.buffer);
+    write(*_state.load(std::memory_order_acquire), local.buffer.data(), local.buffer.size());
+  }
+
+  // records are in the shared mapping as soon as they are copied, the kernel writes them back
+  void flush() override {}
+
+  void set_pattern(const std::string &pattern) override {
+    set_formatter(std::make_unique<spdlog::pattern_formatter>(pattern));
+  }
+
+  void set_formatter(std::unique_ptr<spdlog::formatter> sink_formatter) override {
+    std::lock_guard lock(_mutex);
+    _formatter = std::move(sink_formatter);
+    _formatter_version.fetch_add(1, std::memory_order_release);
+  }
+
+  spdlog::filename_t filename() {
+    std::lock_guard lock(_mutex);
+    return _states.back()->filename;
+  }
+
+  // records lost because a day's file ran out of segments or could not grow
+  std::size_t dropped_count() const {
+    return _dropped.load(std::memory_order_relaxed);
+  }
+
+ private:
+  // ids are never reused, an entry of a destroyed sink just waits to be replaced
+  local_formatter &formatter() {
+    static thread_local std::array<local_formatter, local_formatters> cache;
+    static thread_local std::size_t next = 0;
+    const auto version = _formatter_version.load(std::memory_order_acquire);
+    auto local = std::find_if(cache.begin(), cache.end(), [&](const auto &entry) { return entry.owner == _id; });
+    if (local == cache.end()) {
+      local = cache.begin() + next;
+      next = (next + 1) % local_formatters;
+      local->owner = 0;
+    }
+    if (local->owner != _id || local->version != version) {
+      std::lock_guard lock(_mutex);
+      local->formatter = _formatter->clone();
+      local->owner = _id;
+      local->version = _formatter_version.load(std::memory_order_relaxed);
+    }
+    return *local;
+  }
+
+  // called with _mutex held; the previous day's file keeps accepting the records already on their way
+  // and is closed one rotation later, once nobody can still be writing to it
+  void rotate(spdlog::log_clock::time_point time) {
+    auto state = std::make_unique<file_state>();
+    state->filename = daily_rotation::filename(_base_filename, time);
+    state->segment_size = _options.segment_size;
+    spdlog::details::os::create_dir(spdlog::details::os::dir_name(state->filename));
+    state->fd = ::open(state->filename.c_str(), O_RDWR | O_CREAT | O_CLOEXEC, 0644);
+    if (state->fd < 0)
+      spdlog::throw_spdlog_ex("Failed opening file " + spdlog::details::os::filename_to_str(state->filename), errno);
+    state->base = data_end(state->fd);
+    state->offset.store(state->base, std::memory_order_relaxed);
+
+    while (_states.size() > 1) {
+      finish(*_states.front());
+      _states.pop_front();
+    }
+    _state.store(state.get(), std::memory_order_release);
+    _states.push_back(std::move(state));
+    _rotation_tp.store(_options.rotation.next().time_since_epoch().count(), std::memory_order_release);
+  }
+
+  // end of the text in a file reopened on the same day, a crash leaves the preallocated tail zero filled
+  static std::size_t data_end(int fd) {
+    struct stat info {};
+    if (::fstat(fd, &info) != 0)
+      return 0;
+    auto end = static_cast<std::size_t>(info.st_size);
+    char block[4096];
+    while (end > 0) {
+      const std::size_t size = std::min(end, sizeof(block));
+      if (::pread(fd, block, size, static_cast<off_t>(end - size)) != static_cast<ssize_t>(size))
+        break;
+      for (std::size_t i = size; i > 0; --i) {
+        if (block[i - 1] != '\0')
+          return end - size + i;
+      }
+      end -= size;
+    }
+    return end;
+  }
+
+  char *mapping(file_state &state, std::size_t index) {
+    if (index >= max_segments)
+      return nullptr;
+    if (char *data = state.segments[index].data.load(std::memory_order_acquire))
+      return data;
+
+    std::lock_guard lock(_mutex);
+    // map one segment ahead so writers seldom wait here
+    for (std::size_t i = index; i < std::min(index + 2, max_segments); ++i) {
+      segment &target = state.segments[i];
+      if (target.data.load(std::memory_order_relaxed) != nullptr ||
+          target.committed.load(std::memory_order_relaxed) == state.segment_size)
+        continue;
+      const auto offset = static_cast<off_t>(i * state.segment_size);
+#ifdef __linux__
+      if (::posix_fallocate(state.fd, offset, static_cast<off_t>(state.segment_size)) != 0)
+        return i == index ? nullptr : state.segments[index].data.load(std::memory_order_relaxed);
+#else
+      if (::ftruncate(state.fd, offset + static_cast<off_t>(state.segment_size)) != 0)
+        return i == index ? nullptr : state.segments[index].data.load(std::memory_order_relaxed);
+#endif
+      void *data = ::mmap(nullptr, state.segment_size, PROT_READ | PROT_WRITE, MAP_SHARED, state.fd, offset);
+      if (data == MAP_FAILED)
+        return i == index ? nullptr : state.segments[index].data.load(std::memory_order_relaxed);
+      // bytes before the reopened file's end count as committed, next to any abandoned ones
+      const std::size_t begin = i * state.segment_size;
+      if (state.base > begin)
+        target.committed.fetch_add(std::min(state.base - begin, state.segment_size), std::memory_order_relaxed);
+      target.data.store(static_cast<char *>(data), std::memory_order_release);
+    }
+    return state.segments[index].data.load(std::memory_order_relaxed);
+  }
+
+  void write(file_state &state, const char *data, std::size_t size) {
+    std::size_t offset = state.offset.fetch_add(size, std::memory_order_relaxed);
+    while (size > 0) {
+      const std::size_t index = offset / state.segment_size;
+      const std::size_t inner = offset % state.segment_size;
+      const std::size_t count = std::min(size, state.segment_size - inner);
+      char *target = mapping(state, index);
+      if (target == nullptr) {
+        _dropped.fetch_add(1, std::memory_order_relaxed);
+        abandon(state, offset, size);
+        return;
+      }
+      std::memcpy(target + inner, data, count);
+      commit(state, index, count);
+      offset += count;
+      data += count;
+      size -= count;
+    }
+  }
+
+  // the writer completing a segment unmaps it, the data stays in the page cache
+  static void commit(file_state &state, std::size_t index, std::size_t count) {
+    segment &target = state.segments[index];
+    if (target.committed.fetch_add(count, std::memory_order_acq_rel) + count == state.segment_size) {
+      if (char *data = target.data.exchange(nullptr, std::memory_order_acq_rel))
+        ::munmap(data, state.segment_size);
+    }
+  }
+
+  // the reserved bytes of a dropped record that will never be copied still complete their segments,
+  // otherwise a segment the record started in would stay mapped until the file is closed
+  static void abandon(file_state &state, std::size_t offset, std::size_t size) {
+    while (size > 0) {
+      const std::size_t index = offset / state.segment_size;
+      if (index >= max_segments)
+        return;
+      const std::size_t count = std::min(size, state.segment_size - offset % state.segment_size);
+      commit(state, index, count);
+      offset += count;
+      size -= count;
+    }
+  }
+
+  // trims the preallocated tail, the file then holds exactly the records written
+  static void finish(file_state &state) {
+    for (auto &target : state.segments) {
+      if (char *data = target.data.exchange(nullptr))
+        ::munmap(data, state.segment_size);
+    }
+    if (state.fd >= 0) {
+      if (::ftruncate(state.fd, static_cast<off_t>(state.offset.load())) != 0) {
+        // keep the zero filled tail, data_end() skips it on the next open
+      }
+      ::close(state.fd);
+      state.fd = -1;
+    }
+  }
+};
+
+}  // namespace util::logger
+
+#endif  // _WIN32
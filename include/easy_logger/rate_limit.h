@@ -0,0 +1,159 @@
+//
+//  rate_limit.h
+//  inlay
+//
+//  admission policies of the LOG_*_ONCE / _EVERY_N / _RATE / _DEDUP sites, each keeps its state in one
+//  static site_limiter next to the site, so a check is an atomic or two and never takes a lock
+//
+
+#pragma once
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <concepts>
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+#include <string_view>
+#include <type_traits>
+
+namespace util::logger {
+
+enum class limit_kind : std::uint8_t {
+  once,     // the first record only
+  every_n,  // records 1, n + 1, 2n + 1, ...
+  rate,     // at most count records per interval, bursts up to count (token bucket)
+  dedup,    // identical consecutive records within interval are folded into a "repeated" line
+};
+
+struct log_limit {
+  limit_kind kind = limit_kind::once;
+  std::uint64_t count = 1;
+  std::chrono::nanoseconds interval{0};
+
+  static constexpr log_limit once() {
+    return {limit_kind::once};
+  }
+
+  static constexpr log_limit every_n(std::uint64_t n) {
+    return {limit_kind::every_n, std::max<std::uint64_t>(n, 1)};
+  }
+
+  static constexpr log_limit rate(std::uint64_t count, std::chrono::nanoseconds interval) {
+    return {limit_kind::rate, std::max<std::uint64_t>(count, 1), std::max(interval, std::chrono::nanoseconds(1))};
+  }
+
+  static constexpr log_limit dedup(std::chrono::nanoseconds interval) {
+    return {limit_kind::dedup, 1, interval};
+  }
+
+  // the line logged before the next admitted record when some were held back
+  constexpr std::string_view summary() const {
+    return kind == limit_kind::dedup ? "last message repeated {} times" : "{} messages suppressed by the rate limit";
+  }
+};
+
+namespace detail {
+
+template <typename tt>
+concept hashable_arg = std::is_convertible_v<const tt &, std::string_view> || requires(const tt &value) {
+  { std::hash<std::decay_t<tt>>()(value) } -> std::convertible_to<std::size_t>;
+};
+
+template <typename tt>
+std::size_t hash_arg(const tt &value) {
+  using value_t = std::decay_t<tt>;
+  if constexpr (std::is_convertible_v<const tt &, std::string_view> && !std::is_null_pointer_v<value_t>) {
+    if constexpr (std::is_pointer_v<value_t> && !std::is_array_v<tt>) {
+      if (value == nullptr)
+        return 0;
+    }
+    return std::hash<std::string_view>()(std::string_view(value));
+  } else {
+    return std::hash<value_t>()(value);
+  }
+}
+
+// 0 when an argument has no hash, such records are never taken for duplicates
+template <typename... args_tt>
+std::uint64_t hash_args([[maybe_unused]] const args_tt &...args) {
+  if constexpr (!(hashable_arg<args_tt> && ...)) {
+    return 0;
+  } else {
+    std::uint64_t hash = 0x9e3779b97f4a7c15ull;
+    ((hash = (hash ^ hash_arg(args)) * 0x100000001b3ull), ...);
+    return hash | 1;
+  }
+}
+
+inline std::int64_t steady_ns() {
+  return std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now().time_since_epoch())
+    .count();
+}
+
+}  // namespace detail
+
+// constant initialized, like site_slot; counts are approximate when threads race on one site
+class site_limiter {
+ private:
+  // once: fired, every_n: calls, rate: theoretical arrival time, dedup: start of the run of duplicates
+  std::atomic<std::int64_t> _state{0};
+  std::atomic<std::uint64_t> _hash{0};  // dedup: arguments of the last admitted record
+  std::atomic<std::uint64_t> _suppressed{0};
+
+ public:
+  // true when the record goes out; held is then the number of records held back since the last one
+  // that should be reported (rate and dedup only)
+  template <typename... args_tt>
+  bool admit(const log_limit &limit, std::uint64_t &held, [[maybe_unused]] const args_tt &...args) {
+    held = 0;
+    switch (limit.kind) {
+      case limit_kind::once:
+        return _state.load(std::memory_order_relaxed) == 0 && _state.exchange(1, std::memory_order_relaxed) == 0;
+      case limit_kind::every_n:
+        return static_cast<std::uint64_t>(_state.fetch_add(1, std::memory_order_relaxed)) % limit.count == 0;
+      case limit_kind::rate:
+        if (!take_token(limit))
+          return reject();
+        break;
+      case limit_kind::dedup: {
+        const std::uint64_t hash = detail::hash_args(args...);
+        const std::int64_t now = detail::steady_ns();
+        if (hash != 0 && _hash.load(std::memory_order_relaxed) == hash &&
+            now - _state.load(std::memory_order_relaxed) < limit.interval.count())
+          return reject();
+        _hash.store(hash, std::memory_order_relaxed);
+        _state.store(now, std::memory_order_relaxed);
+        break;
+      }
+    }
+    if (_suppressed.load(std::memory_order_relaxed) != 0)
+      held = _suppressed.exchange(0, std::memory_order_relaxed);
+    return true;
+  }
+
+ private:
+  bool reject() {
+    _suppressed.fetch_add(1, std::memory_order_relaxed);
+    return false;
+  }
+
+  // generic cell rate algorithm: a token bucket of limit.count tokens refilled at count per interval,
+  // kept as the one timestamp at which the bucket will be full again
+  bool take_token(const log_limit &limit) {
+    const std::int64_t now = detail::steady_ns();
+    const std::int64_t step =
+      std::max<std::int64_t>(limit.interval.count() / static_cast<std::int64_t>(limit.count), 1);
+    std::int64_t arrival = _state.load(std::memory_order_relaxed);
+    while (true) {
+      const std::int64_t next = std::max(arrival, now) + step;
+      if (next - now > limit.interval.count())
+        return false;
+      if (_state.compare_exchange_weak(arrival, next, std::memory_order_relaxed))
+        return true;
+    }
+  }
+};
+
+}  // namespace util::logger
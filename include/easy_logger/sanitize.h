@@ -0,0 +1,284 @@
+//
+//  sanitize.h
+//  inlay
+//
+//  escaping of user strings for JSON, logfmt and the console: a SIMD kernel (AVX2, SSE2 or NEON, chosen
+//  at compile time) skips 16/32 clean bytes per step and clean runs are copied in bulk, only the bytes it
+//  stops at (escapes and non-ASCII, validated as UTF-8) go through the scalar path
+//
+
+#pragma once
+
+#include <spdlog/details/log_msg.h>
+#include <spdlog/formatter.h>
+
+#include <bit>
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <string_view>
+
+#if defined(__AVX2__)
+#include <immintrin.h>
+#endif
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#include <emmintrin.h>
+#define EASY_LOGGER_SANITIZE_SSE2 1
+#endif
+#if defined(__ARM_NEON) || defined(_M_ARM64)
+#include <arm_neon.h>
+#define EASY_LOGGER_SANITIZE_NEON 1
+#endif
+
+#include "compiled_format.h"
+
+namespace util::logger::sanitize {
+
+// the bytes a kernel stops at: every byte below `below`, every byte from 0x80 up and the specials
+struct byte_class {
+  unsigned char below;
+  char specials[4];
+
+  constexpr bool stops(char c) const {
+    const auto u = static_cast<unsigned char>(c);
+    return u < below || u >= 0x80 || c == specials[0] || c == specials[1] || c == specials[2] || c == specials[3];
+  }
+};
+
+constexpr byte_class json_class{0x20, {'"', '\\', '"', '\\'}};
+constexpr byte_class logfmt_class{0x21, {'=', '"', '\\', '\x7f'}};  // space too: bare logfmt values end there
+constexpr byte_class console_class{0x20, {'\x7f', '\x7f', '\x7f', '\x7f'}};
+
+// U+FFFD, written for every byte that does not start a valid UTF-8 sequence
+constexpr std::string_view replacement = "\xef\xbf\xbd";
+
+// the length of the well-formed UTF-8 sequence at in (*in >= 0x80), 0 when there is none:
+// no overlong forms, surrogates or code points above U+10FFFF
+inline std::size_t utf8_length(const char *in, const char *end) {
+  const auto at = [&](std::size_t i) { return static_cast<unsigned char>(in[i]); };
+  const auto tail = [&](std::size_t i) { return (at(i) & 0xc0) == 0x80; };
+  const auto lead = at(0);
+  const auto available = static_cast<std::size_t>(end - in);
+  if (lead >= 0xc2 && lead <= 0xdf)
+    return available >= 2 && tail(1) ? 2 : 0;
+  if (lead >= 0xe0 && lead <= 0xef) {
+    if (available < 3 || !tail(1) || !tail(2))
+      return 0;
+    if ((lead == 0xe0 && at(1) < 0xa0) || (lead == 0xed && at(1) > 0x9f))
+      return 0;
+    return 3;
+  }
+  if (lead >= 0xf0 && lead <= 0xf4) {
+    if (available < 4 || !tail(1) || !tail(2) || !tail(3))
+      return 0;
+    if ((lead == 0xf0 && at(1) < 0x90) || (lead == 0xf4 && at(1) > 0x8f))
+      return 0;
+    return 4;
+  }
+  return 0;
+}
+
+// the reference every kernel is tested against
+struct scalar_scan {
+  static const char *find(const char *in, const char *end, const byte_class &set) {
+    while (in != end && !set.stops(*in))
+      ++in;
+    return in;
+  }
+};
+
+#if EASY_LOGGER_SANITIZE_SSE2
+// a signed compare against `below` also catches 0x80-0xff, they are negative
+struct sse2_scan {
+  static const char *find(const char *in, const char *end, const byte_class &set) {
+    const __m128i below = _mm_set1_epi8(static_cast<char>(set.below));
+    const __m128i s0 = _mm_set1_epi8(set.specials[0]), s1 = _mm_set1_epi8(set.specials[1]);
+    const __m128i s2 = _mm_set1_epi8(set.specials[2]), s3 = _mm_set1_epi8(set.specials[3]);
+    for (; end - in >= 16; in += 16) {
+      const __m128i v = _mm_loadu_si128(reinterpret_cast<const __m128i *>(in));
+      const __m128i hit = _mm_or_si128(_mm_or_si128(_mm_cmplt_epi8(v, below), _mm_cmpeq_epi8(v, s0)),
+        _mm_or_si128(_mm_or_si128(_mm_cmpeq_epi8(v, s1), _mm_cmpeq_epi8(v, s2)), _mm_cmpeq_epi8(v, s3)));
+      const auto mask = static_cast<unsigned>(_mm_movemask_epi8(hit));
+      if (mask != 0)
+        return in + std::countr_zero(mask);
+    }
+    return scalar_scan::find(in, end, set);
+  }
+};
+#endif
+
+#if defined(__AVX2__)
+struct avx2_scan {
+  static const char *find(const char *in, const char *end, const byte_class &set) {
+    const __m256i below = _mm256_set1_epi8(static_cast<char>(set.below));
+    const __m256i s0 = _mm256_set1_epi8(set.specials[0]), s1 = _mm256_set1_epi8(set.specials[1]);
+    const __m256i s2 = _mm256_set1_epi8(set.specials[2]), s3 = _mm256_set1_epi8(set.specials[3]);
+    for (; end - in >= 32; in += 32) {
+      const __m256i v = _mm256_loadu_si256(reinterpret_cast<const __m256i *>(in));
+      const __m256i hit = _mm256_or_si256(_mm256_or_si256(_mm256_cmpgt_epi8(below, v), _mm256_cmpeq_epi8(v, s0)),
+        _mm256_or_si256(_mm256_or_si256(_mm256_cmpeq_epi8(v, s1), _mm256_cmpeq_epi8(v, s2)), _mm256_cmpeq_epi8(v, s3)));
+      const auto mask = static_cast<std::uint32_t>(_mm256_movemask_epi8(hit));
+      if (mask != 0)
+        return in + std::countr_zero(mask);
+    }
+    return sse2_scan::find(in, end, set);
+  }
+};
+#endif
+
+#if EASY_LOGGER_SANITIZE_NEON
+struct neon_scan {
+  static const char *find(const char *in, const char *end, const byte_class &set) {
+    const int8x16_t below = vdupq_n_s8(static_cast<std::int8_t>(set.below));
+    const uint8x16_t s0 = vdupq_n_u8(static_cast<std::uint8_t>(set.specials[0]));
+    const uint8x16_t s1 = vdupq_n_u8(static_cast<std::uint8_t>(set.specials[1]));
+    const uint8x16_t s2 = vdupq_n_u8(static_cast<std::uint8_t>(set.specials[2]));
+    const uint8x16_t s3 = vdupq_n_u8(static_cast<std::uint8_t>(set.specials[3]));
+    for (; end - in >= 16; in += 16) {
+      const uint8x16_t v = vld1q_u8(reinterpret_cast<const std::uint8_t *>(in));
+      const uint8x16_t hit = vorrq_u8(vorrq_u8(vcltq_s8(vreinterpretq_s8_u8(v), below), vceqq_u8(v, s0)),
+        vorrq_u8(vorrq_u8(vceqq_u8(v, s1), vceqq_u8(v, s2)), vceqq_u8(v, s3)));
+      // 4 bits per byte
+      const std::uint64_t mask = vget_lane_u64(vreinterpret_u64_u8(vshrn_n_u16(vreinterpretq_u16_u8(hit), 4)), 0);
+      if (mask != 0)
+        return in + (std::countr_zero(mask) >> 2);
+    }
+    return scalar_scan::find(in, end, set);
+  }
+};
+#endif
+
+#if defined(__AVX2__)
+using native_scan = avx2_scan;
+#elif EASY_LOGGER_SANITIZE_SSE2
+using native_scan = sse2_scan;
+#elif EASY_LOGGER_SANITIZE_NEON
+using native_scan = neon_scan;
+#else
+using native_scan = scalar_scan;
+#endif
+
+// true when text needs no change: every stop byte starts a valid UTF-8 sequence
+template <typename scan_tt = native_scan>
+bool clean(std::string_view text, const byte_class &set) {
+  const char *in = text.data();
+  const char *end = text.data() + text.size();
+  while ((in = scan_tt::find(in, end, set)) != end) {
+    const std::size_t length = static_cast<unsigned char>(*in) >= 0x80 ? utf8_length(in, end) : 0;
+    if (length == 0)
+      return false;
+    in += length;
+  }
+  return true;
+}
+
+// copies text into dest, escape_tt writes the ASCII stop bytes; a run of stop bytes, common in
+// non-ASCII text, is walked here without going back to the kernel
+template <typename scan_tt, typename escape_tt>
+void copy(spdlog::memory_buf_t &dest, std::string_view text, const byte_class &set, escape_tt &&escape) {
+  const char *in = text.data();
+  const char *end = text.data() + text.size();
+  while (true) {
+    const char *stop = scan_tt::find(in, end, set);
+    dest.append(in, stop);
+    for (in = stop; in != end && set.stops(*in);) {
+      const auto c = static_cast<unsigned char>(*in);
+      const std::size_t length = c >= 0x80 ? utf8_length(in, end) : 0;
+      if (c < 0x80)
+        escape(dest, c);
+      else if (length != 0)
+        dest.append(in, in + length);
+      else
+        append(dest, replacement);
+      in += length != 0 ? length : 1;
+    }
+    if (in == end)
+      return;
+  }
+}
+
+// the inside of a JSON string: '"', '\' and control characters escaped
+template <typename scan_tt = native_scan>
+void escape_json(spdlog::memory_buf_t &dest, std::string_view text) {
+  copy<scan_tt>(dest, text, json_class, [](spdlog::memory_buf_t &out, unsigned char c) {
+    switch (c) {
+      case '"':
+        append(out, "\\\"");
+        break;
+      case '\\':
+        append(out, "\\\\");
+        break;
+      case '\n':
+        append(out, "\\n");
+        break;
+      case '\r':
+        append(out, "\\r");
+        break;
+      case '\t':
+        append(out, "\\t");
+        break;
+      default: {
+        const char hex[] = {'\\', 'u', '0', '0', "0123456789abcdef"[c >> 4], "0123456789abcdef"[c & 0xf]};
+        out.append(hex, hex + sizeof(hex));
+      }
+    }
+  });
+}
+
+// a console line stays one line: control characters but '\t' become \n, \r or \xNN
+template <typename scan_tt = native_scan>
+void escape_console(spdlog::memory_buf_t &dest, std::string_view text) {
+  copy<scan_tt>(dest, text, console_class, [](spdlog::memory_buf_t &out, unsigned char c) {
+    if (c == '\t') {
+      out.push_back('\t');
+    } else if (c == '\n') {
+      append(out, "\\n");
+    } else if (c == '\r') {
+      append(out, "\\r");
+    } else {
+      const char hex[] = {'\\', 'x', "0123456789abcdef"[c >> 4], "0123456789abcdef"[c & 0xf]};
+      out.append(hex, hex + sizeof(hex));
+    }
+  });
+}
+
+// a logfmt value is written bare unless it is empty or holds a space, '=', '"', '\', a control character
+// or invalid UTF-8
+template <typename scan_tt = native_scan>
+bool needs_quoting(std::string_view text) {
+  return text.empty() || !clean<scan_tt>(text, logfmt_class);
+}
+
+}  // namespace util::logger::sanitize
+
+namespace util::logger {
+
+// runs a record's payload through sanitize::escape_console before the wrapped formatter sees it,
+// a clean payload costs one scan
+class sanitizing_formatter final : public spdlog::formatter {
+ private:
+  std::unique_ptr<spdlog::formatter> _inner;
+  spdlog::memory_buf_t _payload;
+
+ public:
+  explicit sanitizing_formatter(std::unique_ptr<spdlog::formatter> inner) : _inner(std::move(inner)) {}
+
+  void format(const spdlog::details::log_msg &msg, spdlog::memory_buf_t &dest) override {
+    const std::string_view payload(msg.payload.data(), msg.payload.size());
+    if (sanitize::clean(payload, sanitize::console_class)) {
+      _inner->format(msg, dest);
+      return;
+    }
+    _payload.clear();
+    sanitize::escape_console(_payload, payload);
+    spdlog::details::log_msg copy = msg;
+    copy.payload = spdlog::string_view_t(_payload.data(), _payload.size());
+    _inner->format(copy, dest);
+  }
+
+  std::unique_ptr<spdlog::formatter> clone() const override {
+    return std::make_unique<sanitizing_formatter>(_inner->clone());
+  }
+};
+
+}  // namespace util::logger
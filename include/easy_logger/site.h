@@ -0,0 +1,133 @@
+//
+//  site.h
+//  inlay
+//
+//  static description of the LOG_* call sites and the registry giving each a dense id
+//
+
+#pragma once
+
+#include <spdlog/common.h>
+
+#include <array>
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <span>
+#include <string_view>
+
+#include "compiled_format.h"
+
+namespace util::logger {
+
+// the macro family of a site, named after the easy_logger function it calls
+enum class site_kind : std::uint8_t {
+  log,    // LOG_*, fmt is a std::format string
+  print,  // PRINT_*, fmt is a printf string
+  stm,    // STM_*, every argument is a field, fmt is empty
+  kv,     // KV_*, fmt is the message, keys name the arguments
+};
+
+// built once per macro expansion as a static constexpr object
+struct log_site {
+  spdlog::level::level_enum level;
+  const char *file;  // relative path, null terminated
+  std::uint32_t line;
+  const char *function;
+  std::string_view fmt;
+  format_view compiled{};  // fmt split at compile time, dynamic for sites without a std::format string
+  site_kind kind = site_kind::log;
+  std::span<const std::string_view> keys{};  // KV_* only
+
+  constexpr spdlog::source_loc loc() const {
+    return {file, static_cast<int>(line), function};
+  }
+};
+
+constexpr std::uint32_t invalid_site_id = ~std::uint32_t{0};
+
+// mutable per call site state living next to the constexpr metadata,
+// constant initialized so the hot path pays no static init guard
+struct site_slot {
+  const log_site &site;
+  std::atomic<std::uint32_t> id{invalid_site_id};
+  std::atomic<std::uint64_t> level{0};  // generation << 8 | resolved level, see level_overrides
+};
+
+// rebuilds the message of one record from its encoded arguments
+using format_fn = void (*)(const log_site &site, const std::byte *args, spdlog::memory_buf_t &dest);
+
+// destroys the objects a record's arguments hold, see is_deferred_movable
+using release_fn = void (*)(const std::byte *args);
+
+struct site_info {
+  const log_site *site = nullptr;
+  std::string_view signature;  // one type code per argument, see codec::type_code
+  format_fn format = nullptr;
+  release_fn release = nullptr;  // null unless the records hold objects
+};
+
+// dense ids in registration order, so backends, filters and counters can index flat arrays;
+// entries live in fixed chunks that never move, lookups take no lock
+class site_registry {
+ public:
+  static constexpr std::size_t chunk_bits = 10;
+  static constexpr std::size_t chunk_size = std::size_t{1} << chunk_bits;
+  static constexpr std::size_t max_chunks = 1024;
+  static constexpr std::size_t max_sites = chunk_size * max_chunks;
+
+ private:
+  std::mutex _mutex;
+  std::atomic<std::uint32_t> _count{0};
+  std::array<std::unique_ptr<site_info[]>, max_chunks> _chunks;
+
+ public:
+  static site_registry &get() {
+    static site_registry instance;
+    return instance;
+  }
+
+  // ids are published with release, a reader holding an id also sees its entry
+  const site_info &operator[](std::uint32_t id) const {
+    return _chunks[id >> chunk_bits][id & (chunk_size - 1)];
+  }
+
+  std::uint32_t size() const {
+    return _count.load(std::memory_order_acquire);
+  }
+
+  // registers the site once, concurrent callers of the same slot get the same id
+  std::uint32_t add(site_slot &slot, std::string_view signature, format_fn format, release_fn release) {
+    std::lock_guard lock(_mutex);
+    if (const auto id = slot.id.load(std::memory_order_relaxed); id != invalid_site_id)
+      return id;
+
+    const auto id = _count.load(std::memory_order_relaxed);
+    if (id >= max_sites)
+      return invalid_site_id;
+    auto &chunk = _chunks[id >> chunk_bits];
+    if (!chunk)
+      chunk = std::make_unique<site_info[]>(chunk_size);
+    chunk[id & (chunk_size - 1)] = {&slot.site, signature, format, release};
+    _count.store(id + 1, std::memory_order_release);
+    slot.id.store(id, std::memory_order_release);
+    return id;
+  }
+
+ private:
+  site_registry() = default;
+  ~site_registry() = default;
+
+  site_registry(const site_registry &) = delete;
+  void operator=(const site_registry &) = delete;
+};
+
+inline std::uint32_t site_id(
+  site_slot &slot, std::string_view signature, format_fn format, release_fn release = nullptr) {
+  const auto id = slot.id.load(std::memory_order_acquire);
+  return id != invalid_site_id ? id : site_registry::get().add(slot, signature, format, release);
+}
+
+}  // namespace util::logger
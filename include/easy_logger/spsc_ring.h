@@ -0,0 +1,158 @@
+//
+//  spsc_ring.h
+//  inlay
+//
+//  lock-free single producer / single consumer byte ring for variable sized records
+//
+
+#pragma once
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <memory>
+
+namespace util::logger {
+
+// std::hardware_destructive_interference_size is not ABI stable across compiler flags
+constexpr std::size_t cache_line_size = 64;
+
+// every record starts with its uint32 size (a multiple of record_align), a size of 0 marks a wrap
+// back to the start; producer and consumer positions sit on their own cache lines together with
+// a cached copy of the other side's position, so the shared lines are only touched when needed
+class alignas(cache_line_size) spsc_ring {
+ public:
+  static constexpr std::size_t record_align = 8;
+
+ private:
+  std::unique_ptr<std::byte[]> _data;
+  std::size_t _capacity;
+
+  alignas(cache_line_size) std::atomic<std::size_t> _write{0};
+  std::size_t _read_cache = 0;  // producer's view of _read
+  std::atomic_bool _busy{false};  // producer between enter() and leave()
+
+  alignas(cache_line_size) std::atomic<std::size_t> _read{0};
+  std::size_t _write_cache = 0;  // consumer's view of _write
+
+  alignas(cache_line_size) std::atomic_bool _closed{false};
+
+ public:
+  // capacity is rounded up to a power of two
+  explicit spsc_ring(std::size_t capacity) {
+    _capacity = 64;
+    while (_capacity < capacity)
+      _capacity <<= 1;
+    _data = std::make_unique<std::byte[]>(_capacity);
+  }
+
+  spsc_ring(const spsc_ring &) = delete;
+  void operator=(const spsc_ring &) = delete;
+
+  static constexpr std::size_t align_up(std::size_t size) {
+    return (size + record_align - 1) & ~(record_align - 1);
+  }
+
+  std::size_t capacity() const {
+    return _capacity;
+  }
+
+  // producer: room for size bytes (already aligned) or nullptr when full, publish with commit(size)
+  std::byte *prepare(std::size_t size) {
+    const std::size_t write = _write.load(std::memory_order_relaxed);
+    const std::size_t index = write & (_capacity - 1);
+    const std::size_t tail = _capacity - index;
+    const std::size_t need = tail < size ? tail + size : size;
+    if (write + need - _read_cache > _capacity) {
+      _read_cache = _read.load(std::memory_order_acquire);
+      if (write + need - _read_cache > _capacity)
+        return nullptr;
+    }
+    if (tail < size) {
+      // not enough room before the end, leave a wrap marker and start over
+      constexpr std::uint32_t wrap = 0;
+      std::memcpy(_data.get() + index, &wrap, sizeof(wrap));
+      _write.store(write + tail, std::memory_order_release);
+      return _data.get();
+    }
+    return _data.get() + index;
+  }
+
+  void commit(std::size_t size) {
+    _write.store(_write.load(std::memory_order_relaxed) + size, std::memory_order_release);
+  }
+
+  // producer: bytes not yet consumed, wrap padding included; reads the consumer's line
+  std::size_t size() const {
+    return _write.load(std::memory_order_relaxed) - _read.load(std::memory_order_relaxed);
+  }
+
+  // producer: brackets a push for whoever waits for pushes to finish; sequentially consistent, so a producer
+  // that enters after a flag was cleared sees it cleared, or the waiter sees it busy
+  void enter() {
+    _busy.store(true);
+  }
+
+  void leave() {
+    _busy.store(false, std::memory_order_release);
+  }
+
+  bool busy() const {
+    return _busy.load(std::memory_order_acquire);
+  }
+
+  // producer: no more records will follow, the consumer reclaims the ring once it is drained
+  void close() {
+    _closed.store(true, std::memory_order_release);
+  }
+
+  bool closed() const {
+    return _closed.load(std::memory_order_acquire);
+  }
+
+  // consumer: next complete record or nullptr, release it with pop()
+  const std::byte *front() {
+    while (true) {
+      const std::size_t read = _read.load(std::memory_order_relaxed);
+      if (read == _write_cache) {
+        _write_cache = _write.load(std::memory_order_acquire);
+        if (read == _write_cache)
+          return nullptr;
+      }
+      const std::size_t index = read & (_capacity - 1);
+      std::uint32_t size;
+      std::memcpy(&size, _data.get() + index, sizeof(size));
+      if (size != 0)
+        return _data.get() + index;
+      _read.store(read + (_capacity - index), std::memory_order_release);
+    }
+  }
+
+  void pop(std::size_t size) {
+    _read.store(_read.load(std::memory_order_relaxed) + size, std::memory_order_release);
+  }
+
+  // any thread, for crash dumps only: calls fn(record, size) for each record not consumed yet; the consumer
+  // may release records meanwhile, so sizes are checked and fn must check what it reads
+  template <typename fn_tt>
+  void peek(fn_tt &&fn) const {
+    std::size_t read = _read.load(std::memory_order_acquire);
+    const std::size_t write = _write.load(std::memory_order_acquire);
+    while (read < write && write - read <= _capacity) {
+      const std::size_t index = read & (_capacity - 1);
+      std::uint32_t size;
+      std::memcpy(&size, _data.get() + index, sizeof(size));
+      if (size == 0) {
+        read += _capacity - index;
+        continue;
+      }
+      if (size > _capacity - index || size > write - read)
+        return;
+      fn(static_cast<const std::byte *>(_data.get() + index), static_cast<std::size_t>(size));
+      read += size;
+    }
+  }
+};
+
+}  // namespace util::logger
@@ -0,0 +1,432 @@
+//
+//  telemetry.h
+//  inlay
+//
+//  the logger's own numbers: messages and bytes per level and call site, time spent in the logging call,
+//  queue high water, lag from a record's timestamp to its sink write and sink write/flush times; every
+//  thread counts into its own cache line aligned shard and the shards are only added up by a snapshot
+//
+
+#pragma once
+
+#include <spdlog/common.h>
+#include <spdlog/details/log_msg.h>
+#include <spdlog/sinks/sink.h>
+
+#include <algorithm>
+#include <array>
+#include <atomic>
+#include <bit>
+#include <chrono>
+#include <condition_variable>
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+#include "site.h"
+#include "spsc_ring.h"
+
+namespace util::logger {
+
+struct telemetry_options {
+  bool enabled = false;
+  std::chrono::seconds summary_interval{0};  // > 0: a KV_INFO summary of every interval, from a background thread
+};
+
+// bucket i counts durations in [2^i, 2^(i+1)) ns, bucket 0 also the ones below 1 ns
+struct latency_histogram {
+  static constexpr std::size_t size = 40;  // the last bucket takes everything from about 9 minutes up
+  std::array<std::uint64_t, size> buckets{};
+
+  static std::size_t bucket(std::int64_t ns) {
+    return ns <= 1 ? 0 : std::min<std::size_t>(std::bit_width(static_cast<std::uint64_t>(ns)) - 1, size - 1);
+  }
+
+  std::uint64_t count() const {
+    std::uint64_t count = 0;
+    for (auto n : buckets)
+      count += n;
+    return count;
+  }
+
+  // upper bound of the bucket holding the p-th quantile, p in [0, 1]; 0 when empty
+  std::chrono::nanoseconds percentile(double p) const {
+    const auto total = count();
+    if (total == 0)
+      return std::chrono::nanoseconds(0);
+    const auto rank = std::max<std::uint64_t>(static_cast<std::uint64_t>(p * static_cast<double>(total) + 0.5), 1);
+    std::uint64_t seen = 0;
+    for (std::size_t i = 0; i < size; ++i) {
+      if ((seen += buckets[i]) >= rank)
+        return std::chrono::nanoseconds(std::int64_t{2} << i);
+    }
+    return std::chrono::nanoseconds(std::int64_t{2} << (size - 1));
+  }
+};
+
+struct site_telemetry {
+  std::uint64_t messages = 0;
+  std::uint64_t bytes = 0;
+};
+
+// counts since the telemetry was enabled; see easy_logger::telemetry()
+struct telemetry_snapshot {
+  std::array<std::uint64_t, spdlog::level::n_levels> messages{};
+  std::array<std::uint64_t, spdlog::level::n_levels> bytes{};  // formatted text, encoded records when deferred
+  std::vector<site_telemetry> sites;  // by site id, see site_registry
+  latency_histogram enqueue;          // the caller's time in a LOG_*/PRINT_*/STM_*/KV_* call
+  latency_histogram lag;              // record timestamp to sink write
+  latency_histogram sink_write;
+  latency_histogram sink_flush;
+  std::size_t queue_high_water = 0;  // fullest deferred ring in bytes, or the async queue in messages
+  std::size_t queue_capacity = 0;    // in the same unit
+  std::size_t dropped = 0;
+
+  std::uint64_t total_messages() const {
+    std::uint64_t total = 0;
+    for (auto n : messages)
+      total += n;
+    return total;
+  }
+
+  std::uint64_t total_bytes() const {
+    std::uint64_t total = 0;
+    for (auto n : bytes)
+      total += n;
+    return total;
+  }
+
+  // the counts since an earlier snapshot, high water and capacity are kept as they are
+  telemetry_snapshot since(const telemetry_snapshot &earlier) const {
+    telemetry_snapshot delta = *this;
+    for (std::size_t i = 0; i < messages.size(); ++i) {
+      delta.messages[i] -= earlier.messages[i];
+      delta.bytes[i] -= earlier.bytes[i];
+    }
+    for (std::size_t i = 0; i < std::min(sites.size(), earlier.sites.size()); ++i) {
+      delta.sites[i].messages -= earlier.sites[i].messages;
+      delta.sites[i].bytes -= earlier.sites[i].bytes;
+    }
+    const auto subtract = [](latency_histogram &histogram, const latency_histogram &before) {
+      for (std::size_t i = 0; i < latency_histogram::size; ++i)
+        histogram.buckets[i] -= before.buckets[i];
+    };
+    subtract(delta.enqueue, earlier.enqueue);
+    subtract(delta.lag, earlier.lag);
+    subtract(delta.sink_write, earlier.sink_write);
+    subtract(delta.sink_flush, earlier.sink_flush);
+    delta.dropped -= std::min(earlier.dropped, dropped);
+    return delta;
+  }
+};
+
+namespace telemetry {
+
+inline std::int64_t now_ns() {
+  return std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now().time_since_epoch())
+    .count();
+}
+
+// one thread's counters: only that thread writes them, with a load and a store instead of a locked
+// read-modify-write, snapshots read them from any thread
+class alignas(cache_line_size) shard {
+ private:
+  using counter = std::atomic<std::uint64_t>;
+  using histogram = std::array<counter, latency_histogram::size>;
+
+  struct site_counters {
+    counter messages{0};
+    counter bytes{0};
+  };
+
+  std::array<counter, spdlog::level::n_levels> _messages{};
+  std::array<counter, spdlog::level::n_levels> _bytes{};
+  histogram _enqueue{};
+  histogram _lag{};
+  histogram _write{};
+  histogram _flush{};
+  counter _queue_high_water{0};
+  // by site id, chunks of site_registry::chunk_size allocated on first use
+  std::array<std::atomic<site_counters *>, site_registry::max_chunks> _sites{};
+
+  static void bump(counter &value, std::uint64_t n) {
+    value.store(value.load(std::memory_order_relaxed) + n, std::memory_order_relaxed);
+  }
+
+  static void add(histogram &histogram, std::int64_t ns) {
+    bump(histogram[latency_histogram::bucket(ns)], 1);
+  }
+
+  static void read(const histogram &from, latency_histogram &to) {
+    for (std::size_t i = 0; i < latency_histogram::size; ++i)
+      to.buckets[i] += from[i].load(std::memory_order_relaxed);
+  }
+
+ public:
+  shard() = default;
+  ~shard() {
+    for (auto &chunk : _sites)
+      delete[] chunk.load(std::memory_order_relaxed);
+  }
+
+  shard(const shard &) = delete;
+  void operator=(const shard &) = delete;
+
+  void count(spdlog::level::level_enum level, std::uint32_t site_id, std::size_t bytes, std::int64_t ns) {
+    bump(_messages[level], 1);
+    bump(_bytes[level], bytes);
+    add(_enqueue, ns);
+    if (site_id == invalid_site_id)
+      return;
+    auto &chunk = _sites[site_id >> site_registry::chunk_bits];
+    auto *counters = chunk.load(std::memory_order_relaxed);
+    if (counters == nullptr) {
+      counters = new site_counters[site_registry::chunk_size];
+      chunk.store(counters, std::memory_order_release);
+    }
+    auto &site = counters[site_id & (site_registry::chunk_size - 1)];
+    bump(site.messages, 1);
+    bump(site.bytes, bytes);
+  }
+
+  void sink_write(std::int64_t ns, std::int64_t lag_ns) {
+    add(_write, ns);
+    add(_lag, lag_ns);
+  }
+
+  void sink_flush(std::int64_t ns) {
+    add(_flush, ns);
+  }
+
+  void queue_depth(std::size_t depth) {
+    if (depth > _queue_high_water.load(std::memory_order_relaxed))
+      _queue_high_water.store(depth, std::memory_order_relaxed);
+  }
+
+  void add_to(telemetry_snapshot &snapshot, std::uint32_t site_count) const {
+    for (std::size_t i = 0; i < _messages.size(); ++i) {
+      snapshot.messages[i] += _messages[i].load(std::memory_order_relaxed);
+      snapshot.bytes[i] += _bytes[i].load(std::memory_order_relaxed);
+    }
+    read(_enqueue, snapshot.enqueue);
+    read(_lag, snapshot.lag);
+    read(_write, snapshot.sink_write);
+    read(_flush, snapshot.sink_flush);
+    snapshot.queue_high_water =
+      std::max<std::size_t>(snapshot.queue_high_water, _queue_high_water.load(std::memory_order_relaxed));
+
+    if (snapshot.sites.size() < site_count)
+      snapshot.sites.resize(site_count);
+    for (std::uint32_t id = 0; id < site_count; id += site_registry::chunk_size) {
+      const auto *counters = _sites[id >> site_registry::chunk_bits].load(std::memory_order_acquire);
+      if (counters == nullptr)
+        continue;
+      const auto end = std::min<std::uint32_t>(site_count - id, site_registry::chunk_size);
+      for (std::uint32_t i = 0; i < end; ++i) {
+        snapshot.sites[id + i].messages += counters[i].messages.load(std::memory_order_relaxed);
+        snapshot.sites[id + i].bytes += counters[i].bytes.load(std::memory_order_relaxed);
+      }
+    }
+  }
+};
+
+// the live shards, plus the counts of threads that have exited
+class collector {
+ private:
+  static inline std::atomic_bool _enabled{false};
+  std::mutex _mutex;
+  std::vector<std::unique_ptr<shard>> _shards;
+  telemetry_snapshot _retired;
+
+  // folds the shard into _retired when its thread exits
+  struct shard_holder {
+    shard *owned = nullptr;
+
+    ~shard_holder() {
+      if (owned)
+        collector::get().retire(owned);
+    }
+  };
+
+ public:
+  static collector &get() {
+    static collector instance;
+    return instance;
+  }
+
+  static bool enabled() {
+    return _enabled.load(std::memory_order_relaxed);
+  }
+
+  void enable(bool on) {
+    _enabled.store(on, std::memory_order_relaxed);
+  }
+
+  // lazily created on the first count of each thread
+  shard &local() {
+    static thread_local shard_holder holder;
+    if (holder.owned == nullptr) {
+      auto owned = std::make_unique<shard>();
+      holder.owned = owned.get();
+      std::lock_guard lock(_mutex);
+      _shards.push_back(std::move(owned));
+    }
+    return *holder.owned;
+  }
+
+  telemetry_snapshot snapshot() {
+    const auto site_count = site_registry::get().size();
+    std::lock_guard lock(_mutex);
+    telemetry_snapshot snapshot = _retired;
+    snapshot.sites.resize(std::max<std::size_t>(snapshot.sites.size(), site_count));
+    for (const auto &shard : _shards)
+      shard->add_to(snapshot, site_count);
+    return snapshot;
+  }
+
+ private:
+  collector() = default;
+  ~collector() = default;
+
+  collector(const collector &) = delete;
+  void operator=(const collector &) = delete;
+
+  void retire(shard *owned) {
+    std::lock_guard lock(_mutex);
+    owned->add_to(_retired, site_registry::get().size());
+    std::erase_if(_shards, [&](const std::unique_ptr<shard> &shard) { return shard.get() == owned; });
+  }
+};
+
+// times one logging call, costs a relaxed load while telemetry is off
+class call_timer {
+ private:
+  std::int64_t _start = collector::enabled() ? now_ns() : 0;
+
+ public:
+  bool timing() const {
+    return _start != 0;
+  }
+
+  // the record went out, bytes long
+  void done(const site_slot &slot, std::size_t bytes) const {
+    if (timing())
+      collector::get().local().count(
+        slot.site.level, slot.id.load(std::memory_order_relaxed), bytes, now_ns() - _start);
+  }
+};
+
+inline void queue_depth(std::size_t depth) {
+  if (collector::enabled())
+    collector::get().local().queue_depth(depth);
+}
+
+// wraps a sink to time its writes and flushes and the lag of each record; loggers and the deferred backend
+// ask the wrapper's level, which starts out as the wrapped sink's
+class timed_sink final : public spdlog::sinks::sink {
+ private:
+  spdlog::sink_ptr _inner;
+
+ public:
+  explicit timed_sink(spdlog::sink_ptr inner) : _inner(std::move(inner)) {
+    set_level(_inner->level());
+  }
+
+  const spdlog::sink_ptr &inner() const {
+    return _inner;
+  }
+
+  void log(const spdlog::details::log_msg &msg) override {
+    if (!_inner->should_log(msg.level))
+      return;
+    if (!collector::enabled()) {
+      _inner->log(msg);
+      return;
+    }
+    const auto lag = spdlog::log_clock::now() - msg.time;
+    const auto start = now_ns();
+    _inner->log(msg);
+    collector::get().local().sink_write(
+      now_ns() - start, std::chrono::duration_cast<std::chrono::nanoseconds>(lag).count());
+  }
+
+  void flush() override {
+    if (!collector::enabled()) {
+      _inner->flush();
+      return;
+    }
+    const auto start = now_ns();
+    _inner->flush();
+    collector::get().local().sink_flush(now_ns() - start);
+  }
+
+  void set_pattern(const std::string &pattern) override {
+    _inner->set_pattern(pattern);
+  }
+
+  void set_formatter(std::unique_ptr<spdlog::formatter> formatter) override {
+    _inner->set_formatter(std::move(formatter));
+  }
+};
+
+// the sink init() or add_channel() was given, whether telemetry wrapped it or not
+inline spdlog::sink_ptr unwrap(const spdlog::sink_ptr &sink) {
+  const auto *timed = dynamic_cast<const timed_sink *>(sink.get());
+  return timed != nullptr ? timed->inner() : sink;
+}
+
+// calls tick every interval on its own thread until stopped
+class reporter {
+ private:
+  std::thread _thread;
+  std::mutex _mutex;
+  std::condition_variable _wake;
+  bool _stop = false;
+
+ public:
+  static reporter &get() {
+    static reporter instance;
+    return instance;
+  }
+
+  void start(std::chrono::seconds interval, std::function<void()> tick) {
+    stop();
+    _stop = false;
+    _thread = std::thread([this, interval, tick = std::move(tick)] {
+      std::unique_lock lock(_mutex);
+      while (!_wake.wait_for(lock, interval, [this] { return _stop; })) {
+        lock.unlock();
+        tick();
+        lock.lock();
+      }
+    });
+  }
+
+  void stop() {
+    if (!_thread.joinable())
+      return;
+    {
+      std::lock_guard lock(_mutex);
+      _stop = true;
+    }
+    _wake.notify_all();
+    _thread.join();
+  }
+
+ private:
+  reporter() = default;
+  ~reporter() {
+    stop();
+  }
+
+  reporter(const reporter &) = delete;
+  void operator=(const reporter &) = delete;
+};
+
+}  // namespace telemetry
+
+}  // namespace util::logger
@@ -0,0 +1,208 @@
+//
+//  tsc_clock.h
+//  inlay
+//
+//  timestamps of the deferred backend: callers read the CPU's tick counter (rdtsc, cntvct_el0), the
+//  backend thread keeps a calibrated mapping to the system clock and converts when it formats
+//
+
+#pragma once
+
+#include <spdlog/common.h>
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <cstdlib>
+#include <thread>
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <cpuid.h>
+#include <x86intrin.h>
+#elif defined(_M_X64) || defined(_M_IX86)
+#include <intrin.h>
+#endif
+
+namespace util::logger {
+
+// how far the calibrated clock was from the system clock at the last calibrations
+struct clock_drift {
+  bool tsc = false;                  // false: records are stamped with the system clock, nothing drifts
+  double ns_per_tick = 0;            // current estimate
+  std::uint64_t calibrations = 0;    // since the backend started
+  std::chrono::nanoseconds last{0};  // converted minus system time, at the last calibration
+  std::chrono::nanoseconds max{0};   // largest absolute value seen
+};
+
+class tsc_clock {
+ public:
+  static constexpr std::chrono::milliseconds warmup{10};  // first calibration, spent in enable()
+
+ private:
+  struct sample {
+    std::int64_t ticks;
+    std::int64_t ns;
+  };
+
+  std::atomic_bool _ticking{false};
+  // conversion parameters, written by the backend under a sequence lock, read by any thread formatting
+  std::atomic<std::uint32_t> _sequence{0};
+  std::atomic<std::int64_t> _base_ticks{0};
+  std::atomic<std::int64_t> _base_ns{0};
+  std::atomic<double> _ns_per_tick{1};
+  // calibration state, backend thread only
+  sample _anchor{};
+  std::atomic<std::uint64_t> _calibrations{0};
+  std::atomic<std::int64_t> _last_drift{0};
+  std::atomic<std::int64_t> _max_drift{0};
+
+ public:
+  static tsc_clock &get() {
+    static tsc_clock instance;
+    return instance;
+  }
+
+  static std::int64_t ticks() {
+#if defined(__x86_64__) || defined(__i386__) || defined(_M_X64) || defined(_M_IX86)
+    return static_cast<std::int64_t>(__rdtsc());
+#elif defined(__aarch64__)
+    std::uint64_t value;
+    asm volatile("mrs %0, cntvct_el0" : "=r"(value));
+    return static_cast<std::int64_t>(value);
+#else
+    return std::chrono::steady_clock::now().time_since_epoch().count();
+#endif
+  }
+
+  // a counter that ticks at a constant rate whatever the core's frequency or sleep state
+  static bool invariant() {
+#if defined(__x86_64__) || defined(__i386__)
+    unsigned eax, ebx, ecx, edx;
+    return __get_cpuid(0x80000007, &eax, &ebx, &ecx, &edx) && (edx & (1u << 8)) != 0;
+#elif defined(_M_X64) || defined(_M_IX86)
+    int info[4];
+    __cpuid(info, 0x80000000);
+    if (static_cast<unsigned>(info[0]) < 0x80000007)
+      return false;
+    __cpuid(info, 0x80000007);
+    return (info[3] & (1 << 8)) != 0;
+#elif defined(__aarch64__)
+    return true;  // the generic timer runs at a fixed frequency
+#else
+    return false;
+#endif
+  }
+
+  // called before the backend starts, while no record is in flight; falls back to the system clock
+  // when tsc is off or the counter is not invariant (often hidden from VMs)
+  void enable(bool tsc) {
+    if (!tsc || !invariant()) {
+      _ticking.store(false, std::memory_order_release);
+      return;
+    }
+    const sample first = measure();
+    std::this_thread::sleep_for(warmup);
+    const sample second = measure();
+    _anchor = first;
+    publish(second, static_cast<double>(second.ns - first.ns) / std::max<std::int64_t>(second.ticks - first.ticks, 1));
+    _calibrations.store(0, std::memory_order_relaxed);
+    _last_drift.store(0, std::memory_order_relaxed);
+    _max_drift.store(0, std::memory_order_relaxed);
+    _ticking.store(true, std::memory_order_release);
+  }
+
+  bool ticking() const {
+    return _ticking.load(std::memory_order_relaxed);
+  }
+
+  // a record's stamp, ticks or the system clock's count
+  std::int64_t now() const {
+    return ticking() ? ticks() : spdlog::log_clock::now().time_since_epoch().count();
+  }
+
+  spdlog::log_clock::time_point to_time(std::int64_t stamp) const {
+    if (!ticking())
+      return spdlog::log_clock::time_point(spdlog::log_clock::duration(stamp));
+    return spdlog::log_clock::time_point(
+      std::chrono::duration_cast<spdlog::log_clock::duration>(std::chrono::nanoseconds(to_ns(stamp))));
+  }
+
+  // backend thread: measures the drift since the last calibration, refines the rate over the
+  // whole time since enable() and restarts the conversion at the system clock's time
+  void calibrate() {
+    if (ticking())
+      calibrate(measure());
+  }
+
+  // the same against a system time the caller has just read, e.g. a test stepping the clock
+  void calibrate(std::chrono::system_clock::time_point now) {
+    if (ticking())
+      calibrate({ticks(), std::chrono::duration_cast<std::chrono::nanoseconds>(now.time_since_epoch()).count()});
+  }
+
+  clock_drift drift() const {
+    return {ticking(), _ns_per_tick.load(std::memory_order_relaxed), _calibrations.load(std::memory_order_relaxed),
+      std::chrono::nanoseconds(_last_drift.load(std::memory_order_relaxed)),
+      std::chrono::nanoseconds(_max_drift.load(std::memory_order_relaxed))};
+  }
+
+ private:
+  void calibrate(const sample &current) {
+    const std::int64_t drift = to_ns(current.ticks) - current.ns;
+    // a stepped system clock would skew the rate, measure from here on instead
+    if (drift > 100'000'000 || drift < -100'000'000)
+      _anchor = current;
+    const double rate = current.ticks > _anchor.ticks
+                          ? static_cast<double>(current.ns - _anchor.ns) / (current.ticks - _anchor.ticks)
+                          : _ns_per_tick.load(std::memory_order_relaxed);
+    publish(current, rate);
+
+    _calibrations.fetch_add(1, std::memory_order_relaxed);
+    _last_drift.store(drift, std::memory_order_relaxed);
+    if (std::abs(drift) > _max_drift.load(std::memory_order_relaxed))
+      _max_drift.store(std::abs(drift), std::memory_order_relaxed);
+  }
+
+  // the system time between two tick reads, the tightest of a few tries
+  static sample measure() {
+    sample best{};
+    std::int64_t best_window = INT64_MAX;
+    for (int i = 0; i < 5; ++i) {
+      const std::int64_t before = ticks();
+      const auto ns = std::chrono::duration_cast<std::chrono::nanoseconds>(
+        std::chrono::system_clock::now().time_since_epoch()).count();
+      const std::int64_t after = ticks();
+      if (after - before < best_window) {
+        best_window = after - before;
+        best = {before + (after - before) / 2, ns};
+      }
+    }
+    return best;
+  }
+
+  void publish(const sample &base, double ns_per_tick) {
+    _sequence.fetch_add(1, std::memory_order_relaxed);
+    std::atomic_thread_fence(std::memory_order_release);
+    _base_ticks.store(base.ticks, std::memory_order_relaxed);
+    _base_ns.store(base.ns, std::memory_order_relaxed);
+    _ns_per_tick.store(ns_per_tick, std::memory_order_relaxed);
+    _sequence.fetch_add(1, std::memory_order_release);
+  }
+
+  std::int64_t to_ns(std::int64_t stamp) const {
+    std::uint32_t sequence;
+    std::int64_t base_ticks, base_ns;
+    double ns_per_tick;
+    do {
+      sequence = _sequence.load(std::memory_order_acquire);
+      base_ticks = _base_ticks.load(std::memory_order_relaxed);
+      base_ns = _base_ns.load(std::memory_order_relaxed);
+      ns_per_tick = _ns_per_tick.load(std::memory_order_relaxed);
+      std::atomic_thread_fence(std::memory_order_acquire);
+    } while ((sequence & 1) != 0 || sequence != _sequence.load(std::memory_order_relaxed));
+    return base_ns + static_cast<std::int64_t>(static_cast<double>(stamp - base_ticks) * ns_per_tick);
+  }
+};
+
+}  // namespace util::logger
@@ -0,0 +1,31 @@
+// built with LOG_DEBUG and below compiled out, the other tests see every level
+#define EASY_LOGGER_ACTIVE_LEVEL SPDLOG_LEVEL_INFO
+
+#include <easy_logger/logger.h>
+#include <gtest/gtest.h>
+
+namespace {
+int evaluated = 0;
+
+int evaluate() {
+    return ++evaluated;
+}
+}  // namespace
+
+TEST(LoggerTest, StrippedSitesEvaluateNothing) {
+    auto &sites = util::logger::site_registry::get();
+    util::logger::easy_logger::set_level(spdlog::level::trace);
+    const auto before = sites.size();
+
+    LOG_TRACE("stripped {}", evaluate());
+    LOG_DEBUG("stripped {}", evaluate());
+    PRINT_DEBUG("stripped %d", evaluate());
+    STM_DEBUG("stripped", evaluate());
+    KV_DEBUG("stripped", "n", evaluate());
+    EXPECT_EQ(evaluated, 0);
+    EXPECT_EQ(sites.size(), before);
+
+    LOG_INFO("kept {}", evaluate());
+    EXPECT_EQ(evaluated, 1);
+    EXPECT_EQ(sites.size(), before + 1);
+}
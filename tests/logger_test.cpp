@@ -1,9 +1,907 @@
 #include <easy_logger/logger.h>
 #include <gtest/gtest.h>
+#include <spdlog/sinks/null_sink.h>
+#include <spdlog/sinks/ostream_sink.h>
+
+#include <atomic>
+#include <csignal>
+#include <cstdio>
+#include <cstdlib>
+#include <fstream>
+#include <new>
+#include <random>
+#include <sstream>
+#include <thread>
+
+#ifdef __linux__
+#include <sys/resource.h>
+#endif
+
+namespace {
+std::atomic_bool counting{false};
+std::atomic<std::size_t> allocations{0};
+std::atomic<std::size_t> deallocations{0};
+
+struct order {
+    static inline std::atomic<int> live{0};
+    std::string id;
+    int quantity = 0;
+
+    order(std::string id, int quantity) : id(std::move(id)), quantity(quantity) { ++live; }
+    order(const order &other) : id(other.id), quantity(other.quantity) { ++live; }
+    order(order &&other) noexcept : id(std::move(other.id)), quantity(other.quantity) { ++live; }
+    ~order() { --live; }
+};
+}  // namespace
+
+void *operator new(std::size_t size) {
+    if (counting.load(std::memory_order_relaxed))
+        allocations.fetch_add(1, std::memory_order_relaxed);
+    if (void *p = std::malloc(size != 0 ? size : 1))
+        return p;
+    throw std::bad_alloc();
+}
+
+void operator delete(void *p) noexcept {
+    if (p != nullptr && counting.load(std::memory_order_relaxed))
+        deallocations.fetch_add(1, std::memory_order_relaxed);
+    std::free(p);
+}
+
+void operator delete(void *p, std::size_t) noexcept {
+    operator delete(p);
+}
+
+template <>
+struct util::logger::is_deferred_movable<order> : std::true_type {};
+
+template <>
+struct std::formatter<order> : std::formatter<std::string_view> {
+    auto format(const order &value, std::format_context &ctx) const {
+        return std::format_to(ctx.out(), "{}x{}", value.id, value.quantity);
+    }
+};
+
+// not deferrable, formatted on the calling thread
+struct tally {
+    static inline std::atomic<int> formatted{0};
+    std::string name;
+};
+
+template <>
+struct std::formatter<tally> : std::formatter<std::string_view> {
+    auto format(const tally &value, std::format_context &ctx) const {
+        ++tally::formatted;
+        return std::format_to(ctx.out(), "<{}>", value.name);
+    }
+};
 
 TEST(LoggerTest, BasicLogging) {
     util::logger::easy_logger::get().init("test.log");
 
     LOG_INFO("Test message");
     STM_INFO(1, 2, 3);
-}
\ No newline at end of file
+}
+
+TEST(LoggerTest, CompiledFormatMatchesStdFormat) {
+    constexpr std::string_view fmt = "{{x}} {1} {0:>6}|{2:.3f} {3} {4}";
+    constexpr auto shape = util::logger::measure_format(fmt);
+    constexpr auto compiled = util::logger::compile_format<shape.segments, shape.chars>(fmt);
+    static_assert(!compiled.dynamic);
+
+    spdlog::memory_buf_t out;
+    util::logger::format_compiled(compiled.view(), fmt, out, 1, "two", 3.14159, true, 'c');
+    EXPECT_EQ(std::string(out.data(), out.size()), std::format(fmt, 1, "two", 3.14159, true, 'c'));
+
+    // a null C string writes nothing, with or without a spec, like its deferred record
+    constexpr std::string_view nulls = "[{}|{:>3}]";
+    constexpr auto null_shape = util::logger::measure_format(nulls);
+    constexpr auto null_compiled = util::logger::compile_format<null_shape.segments, null_shape.chars>(nulls);
+    const char *null = nullptr;
+    out.clear();
+    util::logger::format_compiled(null_compiled.view(), nulls, out, null, null);
+    EXPECT_EQ(std::string(out.data(), out.size()), "[|   ]");
+
+    static_assert(util::logger::compile_format<0, 0>("{:{}}").dynamic);
+}
+
+TEST(LoggerTest, PrintKeepsBracesInArguments) {
+    const auto text = util::logger::easy_logger::sprintf_view("%d %s|%5.1f", 7, std::string("{x}{"), 2.25);
+    EXPECT_EQ(text, "7 {x}{|  2.2");
+}
+
+TEST(LoggerTest, StmWritersMatchTypeFormatStrings) {
+    using namespace auto_format_rules::detail;
+    static_assert(fixed_precision<double>() == 2 && fixed_precision<int>() == -1);
+    const std::string s = "str{}";
+    const auto pair = std::pair{7u, 2.5f};
+
+    spdlog::memory_buf_t out;
+    write_args(out, -42, 3.14159, s, 'c', true, pair, "lit");
+    const auto fmt = type_format_string_placeholders<int, double, std::string, char, bool, unsigned, float, const char *>::sv;
+    EXPECT_EQ(std::string(out.data(), out.size()), std::vformat(fmt, std::make_format_args(-42, 3.14159, s, 'c', true, pair.first, pair.second, "lit")));
+}
+
+TEST(LoggerTest, DefaultFormatterMatchesPattern) {
+    util::logger::default_formatter fast;
+    spdlog::pattern_formatter generic{std::string(util::logger::default_formatter::pattern)};
+    const auto now = spdlog::log_clock::now();
+    const spdlog::source_loc loc{"src/main.cpp", 216, "main"};
+
+    for (int i = 0; i < 4; ++i) {
+        spdlog::details::log_msg msg(now + std::chrono::milliseconds(i * 700), i == 3 ? spdlog::source_loc{} : loc, "",
+            static_cast<spdlog::level::level_enum>(i + 1), "payload {}");
+        msg.thread_id = 210852 + i % 2;
+        spdlog::memory_buf_t expected, actual;
+        generic.format(msg, expected);
+        fast.format(msg, actual);
+        EXPECT_EQ(std::string(actual.data(), actual.size()), std::string(expected.data(), expected.size()));
+    }
+}
+
+TEST(LoggerTest, SiteLimiterPolicies) {
+    using util::logger::log_limit;
+    std::uint64_t held = 0;
+    const auto admitted = [&](util::logger::site_limiter &limiter, const log_limit &limit, auto... args) {
+        int count = 0;
+        for (int i = 0; i < 10; ++i)
+            count += limiter.admit(limit, held, args...) ? 1 : 0;
+        return count;
+    };
+
+    util::logger::site_limiter once, every, rate, dedup;
+    EXPECT_EQ(admitted(once, log_limit::once()), 1);
+    EXPECT_EQ(admitted(every, log_limit::every_n(3)), 4);
+    EXPECT_EQ(admitted(rate, log_limit::rate(2, std::chrono::hours(1))), 2);
+
+    EXPECT_EQ(admitted(dedup, log_limit::dedup(std::chrono::hours(1)), 7, "same"), 1);
+    EXPECT_TRUE(dedup.admit(log_limit::dedup(std::chrono::hours(1)), held, 8, "other"));
+    EXPECT_EQ(held, 9u);
+}
+
+TEST(LoggerTest, LevelOverridesResolvePerSite) {
+    using util::logger::easy_logger;
+    using util::logger::override_scope;
+    static constexpr util::logger::log_site socket{spdlog::level::debug, "src/net/socket.cpp", 10, "void net::server::accept(int)", "x"};
+    static constexpr util::logger::log_site disk{spdlog::level::debug, "src/io/disk.cpp", 20, "void io::flush()", "x"};
+    util::logger::site_slot socket_slot{socket}, disk_slot{disk};
+
+    easy_logger::set_level(spdlog::level::info);
+    EXPECT_FALSE(easy_logger::should_log(spdlog::level::debug));
+    EXPECT_FALSE(easy_logger::should_log(socket_slot));
+
+    std::istringstream file("# comment\nprefix src/net/ = debug\nfile io/disk.cpp = err\nfunction server::accept = warn\n");
+    util::logger::level_config config;
+    std::string error;
+    ASSERT_TRUE(util::logger::parse_level_config(file, config, error)) << error;
+    easy_logger::set_level_overrides(config.rules);
+    EXPECT_TRUE(easy_logger::should_log(spdlog::level::debug));
+    EXPECT_EQ(util::logger::level_overrides::get().level_of(socket), spdlog::level::warn);
+    EXPECT_EQ(util::logger::level_overrides::get().level_of(disk), spdlog::level::err);
+
+    easy_logger::set_level_overrides({{override_scope::prefix, "src/net/", spdlog::level::debug}});
+    EXPECT_TRUE(easy_logger::should_log(socket_slot));
+    EXPECT_FALSE(easy_logger::should_log(disk_slot));
+
+    easy_logger::clear_level_overrides();
+    EXPECT_FALSE(easy_logger::should_log(socket_slot));
+    EXPECT_EQ(easy_logger::level(), spdlog::level::info);
+
+    std::istringstream bad("file = trace\n");
+    EXPECT_FALSE(util::logger::parse_level_config(bad, config, error));
+    easy_logger::set_level(spdlog::level::trace);
+}
+
+TEST(LoggerTest, LegacyCallsKeepTheBaseLevel) {
+    using util::logger::easy_logger;
+    std::ostringstream out;
+    const auto previous = spdlog::default_logger();
+    spdlog::set_default_logger(
+        std::make_shared<spdlog::logger>("", std::make_shared<spdlog::sinks::ostream_sink_mt>(out)));
+    easy_logger::set_level(spdlog::level::info);
+    easy_logger::set_level_overrides({{util::logger::override_scope::prefix, "src/net/", spdlog::level::trace}});
+    const spdlog::source_loc loc{"src/io/disk.cpp", 1, "flush"};
+    easy_logger::log(loc, spdlog::level::debug, "hidden {}", 1);
+    easy_logger::print(loc, spdlog::level::trace, "hidden %d", 2);
+    easy_logger::stm(loc, spdlog::level::debug, "hidden", 3);
+    easy_logger::log(loc, spdlog::level::info, "shown {}", 4);
+    easy_logger::clear_level_overrides();
+    easy_logger::set_level(spdlog::level::trace);
+    spdlog::set_default_logger(previous);
+    EXPECT_EQ(out.str().find("hidden"), std::string::npos);
+    EXPECT_NE(out.str().find("] shown 4"), std::string::npos);
+}
+
+TEST(LoggerTest, FlightRingKeepsLastRecords) {
+    util::logger::flight::ring ring(4);
+    for (int i = 0; i < 6; ++i)
+        ring.push(static_cast<std::uint32_t>(i), i);
+    ring.push(6, std::string_view(std::string(1000, 'x')), 7);
+
+    std::vector<std::uint32_t> sites;
+    std::size_t clipped = 0;
+    ring.visit([&](const auto &header, const std::byte *args, const std::byte *end) {
+        sites.push_back(header.site_id);
+        if (header.site_id == 6) {
+            EXPECT_TRUE(util::logger::binary::encoded_fits("si", args, end));
+            const auto text = util::logger::codec::read<std::string_view>(args);
+            clipped = text.size();
+            EXPECT_EQ(util::logger::codec::read<int>(args), 7);
+        }
+    });
+    EXPECT_EQ(sites, (std::vector<std::uint32_t>{3, 4, 5, 6}));
+    EXPECT_GT(clipped, 0u);
+    EXPECT_LT(clipped, util::logger::flight::slot::size);
+}
+
+TEST(LoggerTest, BinaryRecordsReadBack) {
+    namespace binary = util::logger::binary;
+    using util::logger::deferred::backend;
+    static_assert(binary::unzigzag(binary::zigzag(-1234567890123)) == -1234567890123);
+    util::logger::easy_logger::set_level(spdlog::level::trace);
+
+    const auto before = std::chrono::system_clock::now();
+    auto writer = std::make_shared<binary::writer>("test_binary.log");
+    const auto filename = util::logger::daily_rotation::filename("test_binary.log", spdlog::log_clock::now());
+    backend::get().start(
+        std::make_shared<spdlog::logger>("", std::make_shared<spdlog::sinks::null_sink_mt>()), {}, true, writer);
+    const int line = __LINE__ + 1;
+    LOG_WARN("round {} {} {} {}", -5, 300u, -1234567890123ll, std::string("trip"));
+    STM_INFO(1.5, 'c', true);
+    KV_INFO("placed", "id", 42u, "who", "me");
+    backend::get().stop();
+    writer.reset();
+
+    std::ifstream in(filename, std::ios::binary);
+    const std::string data((std::istreambuf_iterator<char>(in)), std::istreambuf_iterator<char>());
+    in.close();
+    std::filesystem::remove(filename);
+
+    binary::reader reader;
+    std::vector<binary::site_description> sites;
+    std::vector<std::vector<binary::value>> records;
+    std::vector<std::string> strings;
+    std::int64_t last = 0;
+    // fed a byte at a time, every frame is cut somewhere
+    for (const char c : data) {
+        ASSERT_TRUE(reader.feed(&c, 1,
+            [&](const auto &site, std::uint64_t, std::int64_t time, std::uint64_t thread, const char *args,
+                const char *end) {
+                EXPECT_GE(time, last);
+                last = time;
+                EXPECT_EQ(thread, spdlog::details::os::thread_id());
+                sites.push_back(site);
+                ASSERT_TRUE(binary::unpack(site.signature, args, end, records.emplace_back()));
+                for (const auto &value : records.back())
+                    strings.emplace_back(value.s);
+            }));
+    }
+    EXPECT_EQ(reader.pending(), 0u);
+    ASSERT_EQ(records.size(), 3u);
+    EXPECT_GE(last, std::chrono::duration_cast<std::chrono::nanoseconds>(before.time_since_epoch()).count());
+
+    EXPECT_EQ(sites[0].level, spdlog::level::warn);
+    EXPECT_EQ(sites[0].layout, binary::layout::format);
+    EXPECT_NE(sites[0].file.find("logger_test.cpp"), std::string::npos);
+    EXPECT_EQ(sites[0].line, static_cast<std::uint32_t>(line));
+    EXPECT_EQ(sites[0].fmt, "round {} {} {} {}");
+    ASSERT_EQ(records[0].size(), 4u);
+    EXPECT_EQ(records[0][0].i, -5);
+    EXPECT_EQ(records[0][1].u, 300u);
+    EXPECT_EQ(records[0][2].i, -1234567890123);
+    EXPECT_EQ(strings[3], "trip");
+
+    EXPECT_EQ(sites[1].layout, binary::layout::fields);
+    ASSERT_EQ(records[1].size(), 3u);
+    EXPECT_EQ(records[1][0].d, 1.5);
+    EXPECT_EQ(records[1][1].u, static_cast<std::uint64_t>('c'));
+    EXPECT_EQ(records[1][2].u, 1u);
+
+    EXPECT_EQ(sites[2].layout, binary::layout::kv);
+    EXPECT_EQ(sites[2].fmt, "placed");
+    EXPECT_EQ(sites[2].keys, (std::vector<std::string>{"id", "who"}));
+    ASSERT_EQ(records[2].size(), 2u);
+    EXPECT_EQ(records[2][0].u, 42u);
+    EXPECT_EQ(strings.back(), "me");
+}
+
+TEST(LoggerTest, TscClockFollowsSystemClock) {
+    using util::logger::tsc_clock;
+    using std::chrono::system_clock;
+    if (!tsc_clock::invariant())
+        GTEST_SKIP() << "no invariant tick counter";
+    tsc_clock clock;
+    clock.enable(true);
+    ASSERT_TRUE(clock.ticking());
+    const auto tolerance = std::chrono::milliseconds(10);
+    const auto off = [](system_clock::time_point a, system_clock::time_point b) { return std::chrono::abs(a - b); };
+
+    auto previous = clock.to_time(clock.now());
+    for (int i = 0; i < 1000; ++i) {
+        const auto time = clock.to_time(clock.now());
+        EXPECT_GE(time, previous);
+        previous = time;
+    }
+    EXPECT_LE(off(clock.to_time(clock.now()), system_clock::now()), tolerance);
+
+    std::this_thread::sleep_for(std::chrono::milliseconds(50));
+    clock.calibrate();
+    auto drift = clock.drift();
+    EXPECT_TRUE(drift.tsc);
+    EXPECT_EQ(drift.calibrations, 1u);
+    EXPECT_LE(std::chrono::abs(drift.last), tolerance);
+    ASSERT_GT(drift.ns_per_tick, 0);
+    const double rate = drift.ns_per_tick;
+
+    // the system clock steps a minute ahead: reported as drift, conversions follow it, the rate stays
+    const auto step = std::chrono::minutes(1);
+    const auto before = clock.now();
+    clock.calibrate(system_clock::now() + step);
+    drift = clock.drift();
+    EXPECT_EQ(drift.calibrations, 2u);
+    EXPECT_LE(std::chrono::abs(drift.last + step), tolerance);
+    EXPECT_GE(drift.max, step - tolerance);
+    EXPECT_EQ(drift.ns_per_tick, rate);
+    EXPECT_LE(off(clock.to_time(clock.now()), system_clock::now() + step), tolerance);
+    EXPECT_LT(clock.to_time(before), clock.to_time(clock.now()));
+
+    // the rate is measured from the step on, not across it
+    std::this_thread::sleep_for(std::chrono::milliseconds(50));
+    clock.calibrate(system_clock::now() + step);
+    drift = clock.drift();
+    EXPECT_LE(std::chrono::abs(drift.last), tolerance);
+    EXPECT_NEAR(drift.ns_per_tick, rate, rate * 0.05);
+}
+
+TEST(LoggerTest, KvEncodesLogfmtAndJson) {
+    using util::logger::kv_format;
+    static constexpr auto keys = util::logger::kv::make_keys("user", "name", "ok");
+    static_assert(util::logger::kv::valid_keys(keys));
+    static_assert(!util::logger::kv::valid_key("msg") && !util::logger::kv::valid_key("a b"));
+    static constexpr util::logger::log_site site{spdlog::level::info, "src/main.cpp", 1, "main", "login done", {},
+        util::logger::site_kind::kv, keys};
+    const auto render = [](kv_format format) {
+        util::logger::kv::current_format = format;
+        spdlog::memory_buf_t out;
+        util::logger::kv::write(out, site, 42, std::string("a \"b\"\n"), true);
+        return std::string(out.data(), out.size());
+    };
+
+    EXPECT_EQ(render(kv_format::logfmt), "msg=\"login done\" user=42 name=\"a \\\"b\\\"\\n\" ok=true");
+    EXPECT_EQ(render(kv_format::json), "{\"msg\":\"login done\",\"user\":42,\"name\":\"a \\\"b\\\"\\n\",\"ok\":true}");
+
+    const auto fields = render(kv_format::json_lines);
+    util::logger::json_formatter formatter;
+    spdlog::details::log_msg msg(spdlog::source_loc{"main.cpp", 7, "main"}, "", spdlog::level::warn,
+        spdlog::string_view_t(fields.data(), fields.size()));
+    msg.thread_id = 12;
+    spdlog::memory_buf_t line;
+    formatter.format(msg, line);
+    const std::string text(line.data(), line.size());
+    EXPECT_EQ(text.substr(0, 9), "{\"time\":\"");
+    EXPECT_NE(text.find("\",\"level\":\"warning\",\"src\":\"main.cpp:7\",\"thread\":12,\"msg\":\"login done\",\"user\":42,"),
+        std::string::npos);
+    EXPECT_TRUE(text.ends_with(std::string("\"ok\":true}") + spdlog::details::os::default_eol));
+    util::logger::kv::current_format = kv_format::logfmt;
+}
+
+TEST(LoggerTest, SanitizeKernelsMatchScalar) {
+    namespace sanitize = util::logger::sanitize;
+    const auto json = [](auto scan, std::string_view text) {
+        spdlog::memory_buf_t out;
+        sanitize::escape_json<decltype(scan)>(out, text);
+        return std::string(out.data(), out.size());
+    };
+    const auto console = [](auto scan, std::string_view text) {
+        spdlog::memory_buf_t out;
+        sanitize::escape_console<decltype(scan)>(out, text);
+        return std::string(out.data(), out.size());
+    };
+
+    EXPECT_EQ(json(sanitize::native_scan{}, "a\"b\\\n\x01\xc3\xa9\xe4\xb8\xad\xf0\x9f\x98\x80"),
+        "a\\\"b\\\\\\n\\u0001\xc3\xa9\xe4\xb8\xad\xf0\x9f\x98\x80");
+    // truncated, overlong, surrogate and stray continuation bytes
+    EXPECT_EQ(json(sanitize::native_scan{}, "\xe4\xb8|\xc0\xaf|\xed\xa0\x80|\x80"),
+        "\xef\xbf\xbd\xef\xbf\xbd|\xef\xbf\xbd\xef\xbf\xbd|\xef\xbf\xbd\xef\xbf\xbd\xef\xbf\xbd|\xef\xbf\xbd");
+    EXPECT_EQ(console(sanitize::native_scan{}, "line\r\ninjected\tx\x1b[31m"), "line\\r\\ninjected\tx\\x1b[31m");
+    EXPECT_FALSE(sanitize::needs_quoting("plain.value-1"));
+    EXPECT_TRUE(sanitize::needs_quoting("a=b"));
+    EXPECT_FALSE(sanitize::needs_quoting("\xe4\xb8\xad"));
+
+    // random strings biased towards the bytes the kernels stop at, cut short so every tail length is taken
+    std::mt19937 random(20240715);
+    const std::string_view alphabet[] = {"a", "Z", " ", "=", "\"", "\\", "\n", "\t", "\x01", "\x7f", "\xc3\xa9",
+        "\xe4\xb8\xad", "\xf0\x9f\x98\x80", "\xff", "\x80", "\xe4\xb8", "abcdefghijklmnopqrstuvwxyz0123456789"};
+    for (int round = 0; round < 20000; ++round) {
+        std::string text;
+        const auto pieces = random() % 24;
+        for (std::uint32_t i = 0; i < pieces; ++i)
+            text += alphabet[random() % std::size(alphabet)];
+        const std::string_view view(text.data(), random() % (text.size() + 1));
+        ASSERT_EQ(json(sanitize::native_scan{}, view), json(sanitize::scalar_scan{}, view)) << round;
+        ASSERT_EQ(console(sanitize::native_scan{}, view), console(sanitize::scalar_scan{}, view)) << round;
+        ASSERT_EQ(sanitize::needs_quoting<sanitize::native_scan>(view), sanitize::needs_quoting<sanitize::scalar_scan>(view))
+            << round;
+#if EASY_LOGGER_SANITIZE_SSE2
+        ASSERT_EQ(json(sanitize::sse2_scan{}, view), json(sanitize::scalar_scan{}, view)) << round;
+#endif
+    }
+}
+
+TEST(LoggerTest, TelemetryShardsAddUp) {
+    namespace telemetry = util::logger::telemetry;
+    static constexpr util::logger::log_site site{spdlog::level::warn, "src/main.cpp", 1, "main", "x"};
+    util::logger::site_slot slot{site};
+    util::logger::site_id(slot, "", nullptr);
+
+    auto &collector = telemetry::collector::get();
+    collector.enable(true);
+    const auto before = collector.snapshot();
+    std::vector<std::thread> threads;
+    for (int t = 0; t < 4; ++t) {
+        threads.emplace_back([&] {
+            for (int i = 0; i < 1000; ++i)
+                telemetry::call_timer().done(slot, 10);
+        });
+    }
+    for (auto &thread : threads)
+        thread.join();
+    telemetry::timed_sink sink(std::make_shared<spdlog::sinks::null_sink_mt>());
+    sink.log(spdlog::details::log_msg(spdlog::source_loc{}, "", spdlog::level::warn, "x"));
+    sink.flush();
+    // the wrapper filters like the sink it wraps
+    auto quiet = std::make_shared<spdlog::sinks::null_sink_mt>();
+    quiet->set_level(spdlog::level::err);
+    const spdlog::sink_ptr wrapped = std::make_shared<telemetry::timed_sink>(quiet);
+    EXPECT_FALSE(wrapped->should_log(spdlog::level::warn));
+    wrapped->log(spdlog::details::log_msg(spdlog::source_loc{}, "", spdlog::level::warn, "x"));
+    EXPECT_EQ(telemetry::unwrap(wrapped), quiet);
+    collector.enable(false);
+
+    // the threads have exited, their shards were folded into the retired counts
+    const auto delta = collector.snapshot().since(before);
+    EXPECT_EQ(delta.messages[spdlog::level::warn], 4000u);
+    EXPECT_EQ(delta.bytes[spdlog::level::warn], 40000u);
+    EXPECT_EQ(delta.sites.at(slot.id).messages, 4000u);
+    EXPECT_EQ(delta.enqueue.count(), 4000u);
+    EXPECT_EQ(delta.sink_write.count(), 1u);
+    EXPECT_EQ(delta.sink_flush.count(), 1u);
+    EXPECT_EQ(telemetry::call_timer().timing(), false);
+
+    util::logger::latency_histogram histogram;
+    for (std::int64_t ns : {0, 3, 100, 100, 5000})
+        ++histogram.buckets[util::logger::latency_histogram::bucket(ns)];
+    EXPECT_EQ(histogram.percentile(0.5), std::chrono::nanoseconds(128));
+    EXPECT_EQ(histogram.percentile(1), std::chrono::nanoseconds(8192));
+}
+
+TEST(LoggerTest, ChannelsRouteToTheirOwnSinks) {
+    using util::logger::easy_logger;
+    std::ostringstream audit, access;
+    util::logger::channel_options options;
+    options.async = false;
+    options.sinks = {std::make_shared<spdlog::sinks::ostream_sink_mt>(audit)};
+    ASSERT_TRUE(easy_logger::add_channel("test_audit", options));
+    options.async = true;
+    options.level = spdlog::level::debug;
+    options.sinks = {std::make_shared<spdlog::sinks::ostream_sink_mt>(access)};
+    ASSERT_TRUE(easy_logger::add_channel("test_access", options));
+#if SPDLOG_VERSION < 11300
+    options.policy = util::logger::overflow_policy::drop_newest;
+    EXPECT_FALSE(easy_logger::add_channel("test_dropping", options));
+    options.policy = util::logger::overflow_policy::block;
+#endif
+
+    LOG_INFO_CH(test_audit, "deleted {}", 7);
+    LOG_DEBUG_CH(test_audit, "hidden {}", 8);
+    LOG_DEBUG_CH(test_access, "GET {}", "/item");
+    EXPECT_NE(audit.str().find("]:deleted 7"), std::string::npos);
+    EXPECT_EQ(audit.str().find("hidden"), std::string::npos);
+    EXPECT_EQ(audit.str().find("GET"), std::string::npos);
+
+    easy_logger::set_channel_level("test_audit", spdlog::level::debug);
+    LOG_DEBUG_CH(test_audit, "shown {}", 9);
+    EXPECT_NE(audit.str().find("]:shown 9"), std::string::npos);
+    EXPECT_FALSE(util::logger::channel_registry::get().resolve("test_unknown").configured());
+
+    // drains the access channel's queue
+    util::logger::channel_registry::get().clear();
+    EXPECT_NE(access.str().find("][debug]["), std::string::npos);
+    EXPECT_NE(access.str().find("]:GET /item"), std::string::npos);
+    EXPECT_FALSE(util::logger::channel_registry::get().resolve("test_audit").configured());
+}
+
+TEST(LoggerTest, ConsoleSinkFiltersColorsAndDrops) {
+    using util::logger::async_console_sink;
+    std::FILE *file = std::tmpfile();
+    ASSERT_NE(file, nullptr);
+    const auto record = [](spdlog::level::level_enum level, std::string_view text) {
+        return spdlog::details::log_msg("test", level, spdlog::string_view_t(text.data(), text.size()));
+    };
+    {
+        util::logger::console_options options;
+        options.color = util::logger::console_color::always;
+        options.buffer_size = 256;
+        async_console_sink sink(options, file);
+        EXPECT_FALSE(sink.should_log(spdlog::level::info));
+        ASSERT_TRUE(sink.should_log(spdlog::level::warn));
+        sink.log(record(spdlog::level::warn, "disk almost full"));
+        sink.log(record(spdlog::level::err, std::string(300, 'x')));
+        EXPECT_EQ(sink.dropped_count(), 1u);
+    }
+    {
+        // a file is no terminal
+        async_console_sink sink({}, file);
+        EXPECT_FALSE(sink.colored());
+        sink.log(record(spdlog::level::err, "plain"));
+    }
+    std::string written(static_cast<std::size_t>(std::ftell(file)), '\0');
+    std::rewind(file);
+    ASSERT_EQ(std::fread(written.data(), 1, written.size(), file), written.size());
+    std::fclose(file);
+    EXPECT_NE(written.find("\033[33m\033[1m["), std::string::npos);
+    EXPECT_NE(written.find("][warning]["), std::string::npos);
+    EXPECT_EQ(written.find("xxx"), std::string::npos);
+    EXPECT_NE(written.find("]:disk almost full\033[m"), std::string::npos);
+    EXPECT_NE(written.find("]:plain\n"), std::string::npos);
+}
+
+TEST(LoggerTest, BatchSinkCommitsOnBytesCountAndTime) {
+    util::logger::batch_options options;
+    options.max_bytes = 1000;
+    options.max_records = 4;
+    options.max_delay = std::chrono::milliseconds(100);
+    spdlog::filename_t filename;
+    {
+        auto sink = std::make_shared<util::logger::batch_file_sink_mt>("test_batch.log", options);
+        filename = sink->filename();
+        spdlog::logger logger("test_batch", sink);
+
+        for (int i = 0; i < 4; ++i)
+            logger.info("count {}", i);
+        auto stats = sink->stats();
+        EXPECT_EQ(stats.commits, 1u);
+        EXPECT_EQ(stats.last_batch_records, 4u);
+
+        logger.info("bytes {}", std::string(1200, 'b'));
+        stats = sink->stats();
+        EXPECT_EQ(stats.commits, 2u);
+        EXPECT_EQ(stats.last_batch_records, 1u);
+        EXPECT_GT(stats.last_batch_bytes, 1200u);
+        const auto byte_batch = stats.last_batch_bytes;
+
+        // no further record or flush, the timer commits it
+        const auto begin = std::chrono::steady_clock::now();
+        logger.info("time");
+        for (int i = 0; i < 2000 && sink->stats().commits < 3; ++i)
+            std::this_thread::sleep_for(std::chrono::milliseconds(1));
+        stats = sink->stats();
+        EXPECT_EQ(stats.commits, 3u);
+        EXPECT_GE(std::chrono::steady_clock::now() - begin, options.max_delay);
+        EXPECT_EQ(stats.last_batch_records, 1u);
+        EXPECT_EQ(stats.records, 6u);
+        EXPECT_EQ(stats.max_batch_bytes, byte_batch);
+        EXPECT_GE(stats.total_commit, stats.max_commit);
+        EXPECT_EQ(stats.bytes, std::filesystem::file_size(filename));
+    }
+    std::filesystem::remove(filename);
+}
+
+#ifdef __linux__
+TEST(LoggerTest, MmapSinkCommitsRangesOfDroppedRecords) {
+    util::logger::mmap_options options;
+    options.segment_size = 4096;
+    constexpr rlim_t limit = 16 * 4096;
+    spdlog::filename_t filename;
+    {
+        auto sink = std::make_shared<util::logger::mmap_file_sink>("test_mmap.log", options);
+        filename = sink->filename();
+        sink->set_pattern("%v");
+        spdlog::logger logger("test_mmap", sink);
+        const auto mapped = [&](std::size_t offset) {
+            std::ifstream maps("/proc/self/maps");
+            char column[32];
+            std::snprintf(column, sizeof(column), " %08zx ", offset);
+            for (std::string line; std::getline(maps, line);) {
+                if (line.find(filename) != std::string::npos && line.find(column) != std::string::npos)
+                    return true;
+            }
+            return false;
+        };
+
+        // segment 16 cannot be preallocated while the file size is limited, records reaching into it are dropped
+        rlimit saved{};
+        ASSERT_EQ(::getrlimit(RLIMIT_FSIZE, &saved), 0);
+        rlimit lowered = saved;
+        lowered.rlim_cur = limit;
+        const auto handler = std::signal(SIGXFSZ, SIG_IGN);
+        ASSERT_EQ(::setrlimit(RLIMIT_FSIZE, &lowered), 0);
+        const std::string text(1000, 'm');
+        for (int i = 0; i < 67; ++i)
+            logger.info(text);
+        ::setrlimit(RLIMIT_FSIZE, &saved);
+        std::signal(SIGXFSZ, handler);
+        EXPECT_EQ(sink->dropped_count(), 2u);
+
+        // segment 16 is mapped by the next record and unmapped once full, the dropped ranges count as written
+        for (int i = 0; i < 10; ++i)
+            logger.info(text);
+        EXPECT_EQ(sink->dropped_count(), 2u);
+        EXPECT_FALSE(mapped(limit));
+        EXPECT_TRUE(mapped(limit + 2 * 4096));
+    }
+    std::filesystem::remove(filename);
+}
+
+TEST(LoggerTest, MmapSinksKeepTheirFormatterPerThread) {
+    struct counted_formatter final : spdlog::formatter {
+        std::atomic<int> &clones;
+        explicit counted_formatter(std::atomic<int> &clones) : clones(clones) {}
+        void format(const spdlog::details::log_msg &msg, spdlog::memory_buf_t &dest) override {
+            dest.append(msg.payload.begin(), msg.payload.end());
+            dest.push_back('\n');
+        }
+        std::unique_ptr<spdlog::formatter> clone() const override {
+            ++clones;
+            return std::make_unique<counted_formatter>(clones);
+        }
+    };
+    std::atomic<int> clones{0};
+    spdlog::filename_t filenames[2];
+    {
+        auto first = std::make_shared<util::logger::mmap_file_sink>("test_mmap_first.log");
+        auto second = std::make_shared<util::logger::mmap_file_sink>("test_mmap_second.log");
+        filenames[0] = first->filename();
+        filenames[1] = second->filename();
+        first->set_formatter(std::make_unique<counted_formatter>(clones));
+        second->set_formatter(std::make_unique<counted_formatter>(clones));
+        spdlog::logger logger("test_mmap_pair", {first, second});
+        for (int i = 0; i < 100; ++i)
+            logger.info("alternating {}", i);
+    }
+    EXPECT_EQ(clones.load(), 2);
+    for (const auto &filename : filenames) {
+        std::ifstream in(filename);
+        const std::string data((std::istreambuf_iterator<char>(in)), std::istreambuf_iterator<char>());
+        EXPECT_NE(data.find("alternating 99\n"), std::string::npos);
+        in.close();
+        std::filesystem::remove(filename);
+    }
+}
+#endif
+
+TEST(LoggerTest, CompressedSinkCutsOnFlushLevel) {
+    util::logger::compressed_options options;
+    options.codec = util::logger::compression::none;
+    spdlog::filename_t filename;
+    {
+        auto sink = std::make_shared<util::logger::compressed_file_sink_mt>("test_compressed.log", options);
+        filename = sink->filename();
+        spdlog::logger logger("test_compressed", sink);
+        logger.flush_on(options.flush_level);
+        const auto written = [&](std::uint64_t blocks) {
+            for (int i = 0; i < 1000 && sink->stats().blocks < blocks; ++i)
+                std::this_thread::sleep_for(std::chrono::milliseconds(1));
+            return sink->stats();
+        };
+
+        // a flush below flush_level leaves the block open, the next warn cuts both records
+        logger.info("queued");
+        logger.flush();
+        logger.warn("cut");
+        EXPECT_EQ(written(1).blocks, 1u);
+        EXPECT_EQ(sink->stats().last.records, 2u);
+        logger.info("queued again");
+        logger.flush();
+        logger.error("cut again");
+        EXPECT_EQ(written(2).blocks, 2u);
+        EXPECT_EQ(sink->stats().last.records, 2u);
+    }
+    std::filesystem::remove(filename);
+    std::filesystem::remove(util::logger::index_filename(filename));
+}
+
+TEST(LoggerTest, DeferredRecordsAllocateNothing) {
+    using util::logger::easy_logger;
+    using util::logger::deferred::backend;
+    const auto drain = [] {
+        std::size_t queued;
+        do {
+            std::this_thread::yield();
+            queued = 0;
+            while (!backend::get().visit_pending([&](auto &&...) { ++queued; }))
+                std::this_thread::yield();
+        } while (queued != 0);
+    };
+    easy_logger::set_level(spdlog::level::trace);
+
+    // moved in or copied, formatted on the backend and destroyed there
+    std::ostringstream out;
+    backend::get().start(
+        std::make_shared<spdlog::logger>("", std::make_shared<spdlog::sinks::ostream_sink_mt>(out)), {}, true);
+    const order kept("kept-order-0000000001", 2);
+    LOG_INFO("order {} {}", order("moved-order-000000001", 3), kept);
+    backend::get().stop();
+    EXPECT_NE(out.str().find("order moved-order-000000001x3 kept-order-0000000001x2"), std::string::npos);
+    EXPECT_EQ(order::live.load(), 1);
+
+    backend::get().start(std::make_shared<spdlog::logger>("", std::make_shared<spdlog::sinks::null_sink_mt>()), {}, true);
+    constexpr int rounds = 200;
+    std::vector<order> orders;
+    for (int i = 0; i < rounds * 2; ++i)
+        orders.emplace_back("order-id-beyond-short-string-" + std::to_string(i), i);
+    const std::string name = "a string well past the small string buffer";
+    const auto load = [&](int i) {
+        LOG_INFO("int {} double {} text {} {}", i, i * 0.5, name, "literal");
+        LOG_INFO("order {}", std::move(orders[static_cast<std::size_t>(i)]));
+        STM_INFO(i, name, 2.5);
+        KV_INFO("placed", "id", i, "who", name);
+    };
+    for (int i = 0; i < rounds; ++i)
+        load(i);
+    drain();
+
+    allocations = 0;
+    deallocations = 0;
+    counting = true;
+    for (int i = rounds; i < rounds * 2; ++i)
+        load(i);
+    drain();
+    counting = false;
+    backend::get().stop();
+    EXPECT_EQ(allocations.load(), 0u);
+    // only the strings moved into the records, freed by the backend
+    EXPECT_EQ(deallocations.load(), static_cast<std::size_t>(rounds));
+    orders.clear();
+    EXPECT_EQ(order::live.load(), 1);
+}
+
+TEST(LoggerTest, DeferredStopDrainsProducersInOrder) {
+    using util::logger::deferred::backend;
+    util::logger::easy_logger::set_level(spdlog::level::trace);
+    util::logger::deferred::backend_options options;
+    options.thread_buffer_size = 1024;
+
+    // records too large for the ring travel on the heap but keep their place
+    std::ostringstream out;
+    backend::get().start(
+        std::make_shared<spdlog::logger>("", std::make_shared<spdlog::sinks::ostream_sink_mt>(out)), options, true);
+    const int live = order::live.load();
+    LOG_INFO("step {}", 1);
+    LOG_INFO("step {} {}", 2, order(std::string(2000, 'o'), 5));
+    LOG_INFO("step {}", 3);
+    backend::get().stop();
+    const auto text = out.str();
+    const auto first = text.find("step 1"), second = text.find("step 2 oooo"), third = text.find("step 3");
+    ASSERT_NE(second, std::string::npos);
+    EXPECT_LT(first, second);
+    EXPECT_LT(second, third);
+    EXPECT_EQ(order::live.load(), live);
+
+    // stopping under load: nobody hangs, records that made it in are written whole, the rest go to the
+    // synchronous logger once the backend is down
+    std::ostringstream busy;
+    backend::get().start(
+        std::make_shared<spdlog::logger>("", std::make_shared<spdlog::sinks::ostream_sink_mt>(busy)), options, true);
+    const auto dropped = backend::get().dropped_count();
+    constexpr int threads = 4, records = 2000;
+    std::atomic<int> started{0};
+    std::vector<std::thread> producers;
+    for (int t = 0; t < threads; ++t) {
+        producers.emplace_back([&] {
+            ++started;
+            for (int i = 0; i < records; ++i)
+                LOG_INFO("busy {}", i);
+        });
+    }
+    while (started.load() != threads)
+        std::this_thread::yield();
+    backend::get().stop();
+    for (auto &producer : producers)
+        producer.join();
+    const auto written = busy.str();
+    const auto lines = static_cast<std::size_t>(std::count(written.begin(), written.end(), '\n'));
+    EXPECT_LE(lines + backend::get().dropped_count() - dropped, static_cast<std::size_t>(threads * records));
+    std::istringstream stream(written);
+    for (std::string line; std::getline(stream, line);)
+        EXPECT_NE(line.find("] busy "), std::string::npos);
+}
+
+TEST(LoggerTest, DeferredBackendSurvivesThrowingSinks) {
+    using util::logger::deferred::backend;
+    struct throwing_sink final : spdlog::sinks::sink {
+        void log(const spdlog::details::log_msg &) override { throw spdlog::spdlog_ex("disk full"); }
+        void flush() override { throw std::runtime_error("flush failed"); }
+        void set_pattern(const std::string &) override {}
+        void set_formatter(std::unique_ptr<spdlog::formatter>) override {}
+    };
+    util::logger::easy_logger::set_level(spdlog::level::trace);
+    std::ostringstream out;
+    const std::vector<spdlog::sink_ptr> sinks{
+        std::make_shared<throwing_sink>(), std::make_shared<spdlog::sinks::ostream_sink_mt>(out)};
+    auto logger = std::make_shared<spdlog::logger>("", sinks.begin(), sinks.end());
+    logger->flush_on(spdlog::level::warn);
+    backend::get().start(logger, {}, true);
+    LOG_INFO("first {}", 1);
+    LOG_WARN("second {}", 2);
+    backend::get().stop();
+    EXPECT_NE(out.str().find("] first 1"), std::string::npos);
+    EXPECT_NE(out.str().find("] second 2"), std::string::npos);
+}
+
+TEST(LoggerTest, FlightRecordedMessagesAreFormattedOnce) {
+    using util::logger::deferred::backend;
+    static_assert(!util::logger::codec::deferrable_v<tally>);
+    tally::formatted = 0;
+    util::logger::easy_logger::set_level(spdlog::level::trace);
+    util::logger::flight_options flight;
+    flight.dump_on_signal = false;
+    flight.dump_on_critical = false;
+    util::logger::flight::recorder::get().start(flight, "test_flight.log");
+    std::ostringstream out;
+    backend::get().start(
+        std::make_shared<spdlog::logger>("", std::make_shared<spdlog::sinks::ostream_sink_mt>(out)), {}, true);
+    LOG_INFO("seen {}", tally{"a"});
+    STM_INFO(tally{"b"});
+    KV_INFO("kept", "who", tally{"c"});
+    backend::get().stop();
+    util::logger::flight::recorder::get().stop();
+    EXPECT_EQ(tally::formatted.load(), 3);
+    EXPECT_NE(out.str().find("] seen <a>"), std::string::npos);
+    EXPECT_NE(out.str().find("<b>"), std::string::npos);
+    EXPECT_NE(out.str().find("<c>"), std::string::npos);
+}
+
+TEST(LoggerTest, AsyncDropNewestNeverBlocksCallers) {
+    using util::logger::easy_logger;
+    // holds the worker on its first record until the callers are done
+    struct gate_formatter final : spdlog::formatter {
+        std::atomic_bool &open;
+        explicit gate_formatter(std::atomic_bool &open) : open(open) {}
+        void format(const spdlog::details::log_msg &msg, spdlog::memory_buf_t &dest) override {
+            while (!open.load())
+                std::this_thread::sleep_for(std::chrono::milliseconds(1));
+            dest.append(msg.payload.begin(), msg.payload.end());
+            dest.push_back('\n');
+        }
+        std::unique_ptr<spdlog::formatter> clone() const override { return std::make_unique<gate_formatter>(open); }
+    };
+    easy_logger::shutdown();
+    util::logger::init_options options;
+    options.queue_capacity = 4;
+    options.policy = util::logger::overflow_policy::drop_newest;
+    options.console.enabled = false;
+    ASSERT_TRUE(easy_logger::get().init("test_drop.log", options));
+    auto file =
+        std::dynamic_pointer_cast<spdlog::sinks::daily_file_sink_mt>(spdlog::default_logger()->sinks().front());
+    ASSERT_NE(file, nullptr);
+    const auto filename = file->filename();
+    std::atomic_bool open{false};
+    file->set_formatter(std::make_unique<gate_formatter>(open));
+    const auto before = easy_logger::dropped_count();
+
+    constexpr std::size_t threads = 4, records = 1000;
+    std::vector<std::thread> callers;
+    for (std::size_t t = 0; t < threads; ++t)
+        callers.emplace_back([] {
+            for (std::size_t i = 0; i < records; ++i)
+                LOG_INFO("record {}", i);
+        });
+    for (auto &caller : callers)
+        caller.join();
+    // the queue and the record on the worker hold the rest
+    const auto dropped = easy_logger::dropped_count() - before;
+    EXPECT_GE(dropped, threads * records - options.queue_capacity - 1);
+    open = true;
+    easy_logger::shutdown();
+    file.reset();
+
+    std::ifstream in(filename);
+    std::size_t lines = 0;
+    for (std::string line; std::getline(in, line);)
+        ++lines;
+    in.close();
+    std::filesystem::remove(filename);
+    EXPECT_EQ(lines + dropped, threads * records);
+    ASSERT_TRUE(easy_logger::get().init("test.log"));
+}
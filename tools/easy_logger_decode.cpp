@@ -0,0 +1,321 @@
+// turns the binary log written with init_options::binary back into the text easy_logger::init() would have
+// written, one line per record
+//
+// usage: easy_logger_decode [--level lvl] [--since time] [--until time] [--site id] [--file text]
+//                           [--pattern pattern] [-f | --follow] file...
+//   times are local, "YYYY-MM-DD HH:MM:SS"; --follow keeps reading records appended to the (single) file,
+//   then to the later days' files the logger rotates to
+#include <easy_logger/auto_format_rules.h>
+#include <easy_logger/binary_log.h>
+#include <easy_logger/kv_encoding.h>
+#include <spdlog/pattern_formatter.h>
+
+#include <chrono>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <ctime>
+#include <filesystem>
+#include <format>
+#include <fstream>
+#include <iomanip>
+#include <iterator>
+#include <optional>
+#include <sstream>
+#include <string>
+#include <string_view>
+#include <thread>
+#include <vector>
+
+namespace {
+
+namespace binary = util::logger::binary;
+
+struct filter {
+  spdlog::level::level_enum level = spdlog::level::trace;
+  std::optional<spdlog::log_clock::time_point> since;
+  std::optional<spdlog::log_clock::time_point> until;
+  std::optional<std::uint64_t> site;
+  std::string file;
+};
+
+using site = binary::site_description;
+
+// calls fn with the argument as the type it had when it was logged
+template <typename fn_tt>
+void visit(const binary::value &value, fn_tt &&fn) {
+  switch (value.code) {
+    case 's': fn(value.s); break;
+    case 'b': fn(value.u != 0); break;
+    case 'c': fn(static_cast<char>(value.u)); break;
+    case 'a': fn(static_cast<signed char>(value.i)); break;
+    case 'h': fn(static_cast<short>(value.i)); break;
+    case 'i': fn(static_cast<int>(value.i)); break;
+    case 'l': fn(static_cast<long long>(value.i)); break;
+    case 'A': fn(static_cast<unsigned char>(value.u)); break;
+    case 'H': fn(static_cast<unsigned short>(value.u)); break;
+    case 'I': fn(static_cast<unsigned int>(value.u)); break;
+    case 'L': fn(static_cast<unsigned long long>(value.u)); break;
+    case 'f': fn(value.f); break;
+    case 'd': fn(value.d); break;
+    case 'p': fn(reinterpret_cast<const void *>(static_cast<std::uintptr_t>(value.u))); break;
+  }
+}
+
+// receives the pieces of a LOG_* format string from util::logger::detail::parse_format
+struct message_writer {
+  const std::vector<binary::value> &values;
+  spdlog::memory_buf_t &dest;
+
+  void literal(char c) {
+    dest.push_back(c);
+  }
+
+  void field(std::int32_t arg, std::string_view spec) {
+    if (arg < 0 || static_cast<std::size_t>(arg) >= values.size())
+      throw std::format_error("argument index out of range");
+    visit(values[arg], [&](const auto &value) {
+      if (spec.empty()) {
+        util::logger::write_value(value, dest);
+      } else {
+        const std::string format = "{:" + std::string(spec) + '}';
+        std::vformat_to(std::back_inserter(dest), format, std::make_format_args(value));
+      }
+    });
+  }
+};
+
+class decoder {
+ private:
+  const filter &_filter;
+  spdlog::pattern_formatter &_formatter;
+  binary::reader _reader;
+  std::vector<binary::value> _values;
+  spdlog::memory_buf_t _message;
+  spdlog::memory_buf_t _line;
+
+ public:
+  decoder(const filter &filter, spdlog::pattern_formatter &formatter) : _filter(filter), _formatter(formatter) {}
+
+  // decodes every complete frame, false once the data is corrupt
+  bool feed(const char *data, std::size_t size) {
+    const bool ok = _reader.feed(data, size,
+      [this](const site &site, std::uint64_t id, std::int64_t time, std::uint64_t thread, const char *args,
+        const char *end) { record(site, id, time, thread, args, end); });
+    if (!ok)
+      std::fprintf(stderr, "easy_logger_decode: corrupt data\n");
+    return ok;
+  }
+
+  // bytes of a frame cut off by a crash, or still being written
+  std::size_t pending() const {
+    return _reader.pending();
+  }
+
+ private:
+  void record(const site &site, std::uint64_t id, std::int64_t ns, std::uint64_t thread, const char *args,
+    const char *end) {
+    const spdlog::log_clock::time_point time{
+      std::chrono::duration_cast<spdlog::log_clock::duration>(std::chrono::nanoseconds(ns))};
+    if (site.level < _filter.level || (_filter.since && time < *_filter.since) ||
+        (_filter.until && time > *_filter.until) || (_filter.site && id != *_filter.site) ||
+        site.file.find(_filter.file) == std::string::npos)
+      return;
+
+    _message.clear();
+    if (!binary::unpack(site.signature, args, end, _values)) {
+      util::logger::append(_message, "*** DECODE ERROR ***: bad arguments");
+    } else {
+      try {
+        message(site);
+      } catch (const std::exception &ex) {
+        _message.clear();
+        util::logger::append(_message, "*** DECODE ERROR ***: ");
+        util::logger::append(_message, ex.what());
+      }
+    }
+
+    spdlog::details::log_msg msg(time, {site.file.c_str(), static_cast<int>(site.line), site.function.c_str()}, "",
+      site.level, spdlog::string_view_t(_message.data(), _message.size()));
+    msg.thread_id = thread;
+    _line.clear();
+    _formatter.format(msg, _line);
+    std::fwrite(_line.data(), 1, _line.size(), stdout);
+  }
+
+  void message(const site &site) {
+    switch (site.layout) {
+      case binary::layout::text:
+        util::logger::append(_message, _values.at(0).s);
+        break;
+      case binary::layout::fields:
+        for (std::size_t i = 0; i < _values.size(); ++i) {
+          if (i != 0)
+            _message.push_back(' ');
+          visit(_values[i], [&](const auto &value) { auto_format_rules::detail::write_arg(value, _message); });
+        }
+        break;
+      case binary::layout::kv:
+        // logfmt, the decoder writes text lines
+        util::logger::append(_message, "msg=");
+        util::logger::kv::write_logfmt_string(_message, site.fmt);
+        for (std::size_t i = 0; i < _values.size() && i < site.keys.size(); ++i) {
+          _message.push_back(' ');
+          util::logger::append(_message, site.keys[i]);
+          _message.push_back('=');
+          visit(_values[i], [&](const auto &value) { util::logger::kv::write_value(_message, value, false); });
+        }
+        break;
+      case binary::layout::format: {
+        message_writer writer{_values, _message};
+        if (!util::logger::detail::parse_format(site.fmt, writer))
+          throw std::format_error("format string not supported by the decoder: " + site.fmt);
+        break;
+      }
+    }
+  }
+};
+
+std::optional<spdlog::log_clock::time_point> parse_time(const char *text) {
+  std::tm tm{};
+  std::istringstream in(text);
+  in >> std::get_time(&tm, "%Y-%m-%d %H:%M:%S");
+  if (in.fail()) {
+    std::fprintf(stderr, "easy_logger_decode: bad time \"%s\", expected YYYY-MM-DD HH:MM:SS\n", text);
+    std::exit(2);
+  }
+  tm.tm_isdst = -1;
+  return spdlog::log_clock::from_time_t(std::mktime(&tm));
+}
+
+// reads the file from offset on, returns the new offset
+std::size_t read_file(const std::string &path, std::size_t offset, decoder &decoder, bool &ok) {
+  std::ifstream in(path, std::ios::binary);
+  if (!in) {
+    std::fprintf(stderr, "easy_logger_decode: cannot open %s\n", path.c_str());
+    ok = false;
+    return offset;
+  }
+  in.seekg(static_cast<std::streamoff>(offset));
+  char block[1024 * 64];
+  while (ok && in) {
+    in.read(block, sizeof(block));
+    const auto count = static_cast<std::size_t>(in.gcount());
+    if (count == 0)
+      break;
+    offset += count;
+    ok = decoder.feed(block, count);
+  }
+  return offset;
+}
+
+// "logs/app_2025-04-25.log" -> the earliest "logs/app_YYYY-MM-DD.log" of a later day, the file the logger
+// rotated to; days without records have no file
+std::optional<std::string> later_file(const std::string &path) {
+  namespace fs = std::filesystem;
+  constexpr std::size_t date_size = 10;
+  const fs::path current(path);
+  const std::string name = current.filename().string();
+  const std::string extension = current.extension().string();
+  if (name.size() < date_size + 1 + extension.size())
+    return std::nullopt;
+  const std::size_t date_pos = name.size() - extension.size() - date_size;
+  if (name[date_pos - 1] != '_')
+    return std::nullopt;
+  const std::string prefix = name.substr(0, date_pos);
+  const std::string date = name.substr(date_pos, date_size);
+
+  const auto is_date = [](std::string_view text) {
+    for (std::size_t i = 0; i < text.size(); ++i) {
+      const bool dash = i == 4 || i == 7;
+      if (dash ? text[i] != '-' : (text[i] < '0' || text[i] > '9'))
+        return false;
+    }
+    return true;
+  };
+  if (!is_date(date))
+    return std::nullopt;
+
+  std::optional<std::string> next;
+  std::string next_date;
+  std::error_code error;
+  const fs::path dir = current.has_parent_path() ? current.parent_path() : fs::path(".");
+  for (const auto &entry : fs::directory_iterator(dir, error)) {
+    const std::string other = entry.path().filename().string();
+    if (other.size() != name.size() || !other.starts_with(prefix) || !other.ends_with(extension))
+      continue;
+    const std::string other_date = other.substr(date_pos, date_size);
+    if (is_date(other_date) && other_date > date && (!next || other_date < next_date)) {
+      next_date = other_date;
+      next = (current.parent_path() / other).string();
+    }
+  }
+  return next;
+}
+
+}  // namespace
+
+int main(int argc, char **argv) {
+  filter filter;
+  std::string pattern = "%^[%Y-%m-%d %T.%e][%l][%@][%t]:%v%$";
+  bool follow = false;
+  std::vector<std::string> files;
+  for (int i = 1; i < argc; ++i) {
+    const std::string_view arg = argv[i];
+    const bool has_value = i + 1 < argc;
+    if (arg == "-f" || arg == "--follow")
+      follow = true;
+    else if (arg == "--level" && has_value)
+      filter.level = spdlog::level::from_str(argv[++i]);
+    else if (arg == "--since" && has_value)
+      filter.since = parse_time(argv[++i]);
+    else if (arg == "--until" && has_value)
+      filter.until = parse_time(argv[++i]);
+    else if (arg == "--site" && has_value)
+      filter.site = std::strtoull(argv[++i], nullptr, 10);
+    else if (arg == "--file" && has_value)
+      filter.file = argv[++i];
+    else if (arg == "--pattern" && has_value)
+      pattern = argv[++i];
+    else if (!arg.starts_with('-'))
+      files.emplace_back(arg);
+    else {
+      std::fprintf(stderr, "easy_logger_decode: unknown option %s\n", argv[i]);
+      return 2;
+    }
+  }
+  if (files.empty() || (follow && files.size() != 1)) {
+    std::fprintf(stderr,
+      "usage: easy_logger_decode [--level lvl] [--since time] [--until time] [--site id] [--file text]\n"
+      "                          [--pattern pattern] [-f | --follow] file...\n");
+    return 2;
+  }
+
+  spdlog::pattern_formatter formatter(pattern);
+  int status = 0;
+  for (std::string path : files) {
+    while (true) {
+      decoder decoder(filter, formatter);
+      bool ok = true;
+      std::size_t offset = read_file(path, 0, decoder, ok);
+      std::optional<std::string> next;
+      while (follow && ok && !next) {
+        std::fflush(stdout);
+        std::this_thread::sleep_for(std::chrono::milliseconds(200));
+        // the logger writes out a day's file before it opens the next one, so it is complete once read again
+        next = later_file(path);
+        offset = read_file(path, offset, decoder, ok);
+      }
+      if (ok && decoder.pending() != 0)
+        std::fprintf(stderr, "easy_logger_decode: %s ends with %zu bytes of an incomplete record\n", path.c_str(),
+          decoder.pending());
+      if (!ok)
+        status = 1;
+      if (!ok || !next)
+        break;
+      path = *next;
+    }
+  }
+  return status;
+}
@@ -0,0 +1,98 @@
+// prints the text of a file written by compressed_file_sink, using its ".idx" seek index to start at the
+// first block that can hold records of --since and to stop after the blocks of --until
+//
+// usage: easy_logger_zcat [--since time] [--until time] [--stats] file
+//   times are local, "YYYY-MM-DD HH:MM:SS"; --stats prints the blocks' sizes and ratios instead of the text
+#include <easy_logger/compressed_file_sink.h>
+
+#include <chrono>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <ctime>
+#include <iomanip>
+#include <optional>
+#include <sstream>
+#include <string>
+#include <string_view>
+#include <vector>
+
+namespace {
+
+std::optional<std::int64_t> parse_time(const char *text) {
+  std::tm tm{};
+  std::istringstream in(text);
+  in >> std::get_time(&tm, "%Y-%m-%d %H:%M:%S");
+  if (in.fail()) {
+    std::fprintf(stderr, "easy_logger_zcat: bad time \"%s\", expected YYYY-MM-DD HH:MM:SS\n", text);
+    std::exit(2);
+  }
+  tm.tm_isdst = -1;
+  return std::chrono::duration_cast<std::chrono::nanoseconds>(
+    std::chrono::system_clock::from_time_t(std::mktime(&tm)).time_since_epoch())
+    .count();
+}
+
+}  // namespace
+
+int main(int argc, char **argv) {
+  std::optional<std::int64_t> since;
+  std::optional<std::int64_t> until;
+  bool stats = false;
+  std::string path;
+  for (int i = 1; i < argc; ++i) {
+    const std::string_view arg = argv[i];
+    if (arg == "--since" && i + 1 < argc)
+      since = parse_time(argv[++i]);
+    else if (arg == "--until" && i + 1 < argc)
+      until = parse_time(argv[++i]);
+    else if (arg == "--stats")
+      stats = true;
+    else if (!arg.starts_with('-') && path.empty())
+      path = arg;
+    else {
+      std::fprintf(stderr, "easy_logger_zcat: unexpected argument %s\n", argv[i]);
+      return 2;
+    }
+  }
+  if (path.empty()) {
+    std::fprintf(stderr, "usage: easy_logger_zcat [--since time] [--until time] [--stats] file\n");
+    return 2;
+  }
+
+  const auto entries = util::logger::read_index(path);
+  std::FILE *file = std::fopen(path.c_str(), "rb");
+  if (file == nullptr || entries.empty()) {
+    std::fprintf(stderr, "easy_logger_zcat: cannot read %s or its index\n", path.c_str());
+    return 1;
+  }
+
+  std::size_t first = 0;
+  if (since)
+    first = util::logger::seek_block(entries, spdlog::log_clock::time_point(std::chrono::nanoseconds(*since)));
+  std::string compressed;
+  std::string text;
+  int status = 0;
+  for (std::size_t i = first; i < entries.size(); ++i) {
+    const auto &entry = entries[i];
+    if (until && entry.first_time > *until)
+      break;
+    if (stats) {
+      std::printf("block %zu: offset %llu, %u -> %u bytes, ratio %.2f\n", i,
+        static_cast<unsigned long long>(entry.offset), entry.raw_size, entry.compressed_size,
+        entry.compressed_size != 0 ? static_cast<double>(entry.raw_size) / entry.compressed_size : 0.0);
+      continue;
+    }
+    compressed.resize(entry.compressed_size);
+    if (std::fseek(file, static_cast<long>(entry.offset), SEEK_SET) != 0 ||
+        std::fread(compressed.data(), 1, compressed.size(), file) != compressed.size() ||
+        !util::logger::decompress_block(entry, compressed.data(), text)) {
+      std::fprintf(stderr, "easy_logger_zcat: cannot decode block %zu\n", i);
+      status = 1;
+      continue;
+    }
+    std::fwrite(text.data(), 1, text.size(), stdout);
+  }
+  std::fclose(file);
+  return status;
+}